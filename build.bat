@@ -6,7 +6,7 @@ set BaseName=palettize
 
 set WarningsFlags=-W4 -WX -wd4062 -wd4189 -wd4505 -wd4514 -wd4710 -wd4711 -wd4820 -wd5045
 
-set CompilerFlags=-arch:AVX2 -EHa- -FC -fp:except- -fp:fast -Gm- -GR- -MT -nologo -Zo -Z7
+set CompilerFlags=-EHa- -FC -fp:except- -fp:fast -Gm- -GR- -MT -nologo -Zo -Z7
 set CompilerFlags=-D_CRT_SECURE_NO_WARNINGS %CompilerFlags%
 
 set LinkerFlags=-incremental:no -opt:ref
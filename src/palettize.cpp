@@ -8,6 +8,44 @@
 #pragma warning(pop)
 
 #include "palettize.h"
+#include "palettize_kernels.cpp"
+#include "palettize_kmeans.cpp"
+#include "palettize_tiled.cpp"
+#include "palettize_incremental.cpp"
+#include "palettize_bisecting.cpp"
+#include "palettize_wu.cpp"
+#include "palettize_inflate.cpp"
+#include "palettize_stream.cpp"
+#include "palettize_octree.cpp"
+#include "palettize_histogram.cpp"
+#include "palettize_grayscale.cpp"
+#include "palettize_sequence.cpp"
+#include "palettize_selftest.cpp"
+
+static v3
+ParseV3(char *String, v3 Default)
+{
+    v3 Result = Default;
+
+    char *End;
+    Result.x = strtof(String, &End);
+    if(*End == ',')
+    {
+        Result.y = strtof(End + 1, &End);
+        if(*End == ',')
+        {
+            Result.z = strtof(End + 1, &End);
+        }
+    }
+
+    if(*End != '\0')
+    {
+        fprintf(stderr, "Warning: could not parse \"%s\" as three comma separated numbers\n", String);
+        Result = Default;
+    }
+
+    return(Result);
+}
 
 static palettize_config
 ParseCommandLine(int ArgCount, char **Args)
@@ -22,26 +60,303 @@ ParseCommandLine(int ArgCount, char **Args)
 
     Config.SourcePath = 0;
     Config.ClusterCount = 5;
+    Config.AutoClusterCount = false;
+    Config.MinClusterCount = 2;
+    Config.MaxClusterCount = 16;
+    Config.ClusterCountCriterion = ClusterCountCriterion_Elbow;
     Config.Seed = Seed;
     Config.SortType = SortType_Weight;
     Config.DestPath = "palette.bmp";
+    Config.ColorSpace = ColorSpace_CIELAB;
+    Config.ChannelWeights = V3(1.0f, 1.0f, 1.0f);
+    Config.AlphaThreshold = DEFAULT_ALPHA_THRESHOLD;
+    Config.Engine = KMeansEngine_Lloyd;
+    Config.Init = KMeansInit_Random;
+    Config.BatchSize = DEFAULT_MINI_BATCH_SIZE;
+    Config.RestartCount = 1;
+    Config.TreePath = 0;
+    Config.FramesPath = 0;
+    Config.RefinementPassCount = 0;
+    Config.SequenceFormat = SequenceFormat_None;
+    Config.SequenceWidth = 0;
+    Config.SequenceHeight = 0;
+    Config.SkipThreshold = 0.01f;
+
+    // Arguments of the form name=value are options and may appear anywhere,
+    // everything else is positional
+    char *Positional[5] = {};
+    int PositionalCount = 0;
+    for(int ArgIndex = 1;
+        ArgIndex < ArgCount;
+        ArgIndex++)
+    {
+        char *Arg = Args[ArgIndex];
+        char *Value;
+        if((Value = GetOptionValue(Arg, "space")) != 0)
+        {
+            if(StringsMatch(Value, "cielab", false))
+            {
+                Config.ColorSpace = ColorSpace_CIELAB;
+            }
+            else if(StringsMatch(Value, "oklab", false))
+            {
+                Config.ColorSpace = ColorSpace_Oklab;
+            }
+            else if(StringsMatch(Value, "linear", false))
+            {
+                Config.ColorSpace = ColorSpace_LinearRGB;
+            }
+            else if(StringsMatch(Value, "ycbcr", false))
+            {
+                Config.ColorSpace = ColorSpace_YCbCr;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: unknown color space \"%s\"\n", Value);
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "weights")) != 0)
+        {
+            v3 ChannelWeights = ParseV3(Value, Config.ChannelWeights);
+            if((ChannelWeights.x > 0.0f) &&
+               (ChannelWeights.y > 0.0f) &&
+               (ChannelWeights.z > 0.0f))
+            {
+                Config.ChannelWeights = ChannelWeights;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: channel weights must be positive\n");
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "alpha")) != 0)
+        {
+            Config.AlphaThreshold = Clampi(0, atoi(Value), 255);
+        }
+        else if((Value = GetOptionValue(Arg, "engine")) != 0)
+        {
+            if(StringsMatch(Value, "lloyd", false))
+            {
+                Config.Engine = KMeansEngine_Lloyd;
+            }
+            else if(StringsMatch(Value, "minibatch", false))
+            {
+                Config.Engine = KMeansEngine_MiniBatch;
+            }
+            else if(StringsMatch(Value, "bisecting", false))
+            {
+                Config.Engine = KMeansEngine_Bisecting;
+            }
+            else if(StringsMatch(Value, "wu", false))
+            {
+                Config.Engine = KMeansEngine_Wu;
+            }
+            else if(StringsMatch(Value, "octree", false))
+            {
+                Config.Engine = KMeansEngine_Octree;
+            }
+            else if(StringsMatch(Value, "histogram", false))
+            {
+                Config.Engine = KMeansEngine_Histogram;
+            }
+            else if(StringsMatch(Value, "tiled", false))
+            {
+                Config.Engine = KMeansEngine_Tiled;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: unknown engine \"%s\"\n", Value);
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "init")) != 0)
+        {
+            if(StringsMatch(Value, "random", false))
+            {
+                Config.Init = KMeansInit_Random;
+            }
+            else if(StringsMatch(Value, "octree", false))
+            {
+                Config.Init = KMeansInit_Octree;
+            }
+            else if(StringsMatch(Value, "mediancut", false))
+            {
+                Config.Init = KMeansInit_MedianCut;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: unknown initializer \"%s\"\n", Value);
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "batch")) != 0)
+        {
+            int BatchSize = atoi(Value);
+            if(BatchSize > 0)
+            {
+                Config.BatchSize = BatchSize;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: batch size must be positive\n");
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "tree")) != 0)
+        {
+            Config.TreePath = Value;
+        }
+        else if((Value = GetOptionValue(Arg, "frames")) != 0)
+        {
+            Config.FramesPath = Value;
+        }
+        else if((Value = GetOptionValue(Arg, "refine")) != 0)
+        {
+            Config.RefinementPassCount = Clampi(0, atoi(Value), 16);
+        }
+        else if((Value = GetOptionValue(Arg, "restarts")) != 0)
+        {
+            int RestartCount = atoi(Value);
+            if(RestartCount > 0)
+            {
+                Config.RestartCount = Minimum(RestartCount, MAX_RESTART_COUNT);
+            }
+            else
+            {
+                fprintf(stderr, "Warning: restart count must be positive\n");
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "kmin")) != 0)
+        {
+            Config.MinClusterCount = Clampi(1, atoi(Value), MAX_CLUSTER_COUNT);
+        }
+        else if((Value = GetOptionValue(Arg, "kmax")) != 0)
+        {
+            Config.MaxClusterCount = Clampi(1, atoi(Value), MAX_CLUSTER_COUNT);
+        }
+        else if((Value = GetOptionValue(Arg, "criterion")) != 0)
+        {
+            if(StringsMatch(Value, "elbow", false))
+            {
+                Config.ClusterCountCriterion = ClusterCountCriterion_Elbow;
+            }
+            else if(StringsMatch(Value, "silhouette", false))
+            {
+                Config.ClusterCountCriterion = ClusterCountCriterion_Silhouette;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: unknown criterion \"%s\"\n", Value);
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "sequence")) != 0)
+        {
+            if(StringsMatch(Value, "y4m", false))
+            {
+                Config.SequenceFormat = SequenceFormat_Y4M;
+            }
+            else if(StringsMatch(Value, "rgba", false))
+            {
+                Config.SequenceFormat = SequenceFormat_RGBA;
+            }
+            else
+            {
+                fprintf(stderr, "Warning: unknown sequence format \"%s\"\n", Value);
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "size")) != 0)
+        {
+            char *Height = Value;
+            while(*Height && (*Height != 'x') && (*Height != 'X'))
+            {
+                Height++;
+            }
+            if(*Height)
+            {
+                Config.SequenceWidth = atoi(Value);
+                Config.SequenceHeight = atoi(Height + 1);
+            }
+            else
+            {
+                fprintf(stderr, "Warning: size must be WIDTHxHEIGHT\n");
+            }
+        }
+        else if((Value = GetOptionValue(Arg, "skip")) != 0)
+        {
+            Config.SkipThreshold = Clamp(0.0f, (f32)atof(Value), 1.0f);
+        }
+        else if(PositionalCount < (int)ArrayCount(Positional))
+        {
+            Positional[PositionalCount++] = Arg;
+        }
+    }
+
+    if((Config.Engine != KMeansEngine_Lloyd) && (Config.RestartCount > 1))
+    {
+        fprintf(stderr, "Warning: restarts only apply to the lloyd engine\n");
+        Config.RestartCount = 1;
+    }
+    if((Config.Engine != KMeansEngine_Lloyd) && (Config.Init != KMeansInit_Random))
+    {
+        fprintf(stderr, "Warning: initializers only apply to the lloyd engine\n");
+        Config.Init = KMeansInit_Random;
+    }
+    if((Config.Engine != KMeansEngine_Bisecting) && Config.TreePath)
+    {
+        fprintf(stderr, "Warning: only the bisecting engine builds a palette tree\n");
+        Config.TreePath = 0;
+    }
+
+    if(Config.SequenceFormat != SequenceFormat_None)
+    {
+        if((Config.Engine != KMeansEngine_Lloyd) || (Config.RestartCount > 1) ||
+           (Config.Init != KMeansInit_Random))
+        {
+            fprintf(stderr, "Warning: sequences always use a single lloyd run, warm started from the last frame\n");
+            Config.Engine = KMeansEngine_Lloyd;
+            Config.RestartCount = 1;
+            Config.Init = KMeansInit_Random;
+        }
+        Config.DestPath = "palettes.txt";
+    }
 
-    if(ArgCount > 1)
+    if(PositionalCount > 0)
+    {
+        Config.SourcePath = Positional[0];
+    }
+    if(PositionalCount > 1)
     {
-        Config.SourcePath = Args[1];
+        if(StringsMatch(Positional[1], "auto", false))
+        {
+            Config.AutoClusterCount = true;
+        }
+        else
+        {
+            int ClusterCount = atoi(Positional[1]);
+            Config.ClusterCount = Clampi(1, ClusterCount, MAX_CLUSTER_COUNT);
+        }
     }
-    if(ArgCount > 2)
+    if(Config.AutoClusterCount)
     {
-        int ClusterCount = atoi(Args[2]);
-        Config.ClusterCount = Clampi(1, ClusterCount, 64);
+        if((Config.Engine != KMeansEngine_Lloyd) ||
+           (Config.SequenceFormat != SequenceFormat_None))
+        {
+            fprintf(stderr, "Warning: auto cluster count only applies to the lloyd engine on a single image\n");
+            Config.AutoClusterCount = false;
+        }
+
+        // NOTE: A silhouette needs a second cluster to compare against
+        if(Config.ClusterCountCriterion == ClusterCountCriterion_Silhouette)
+        {
+            Config.MinClusterCount = Maximum(Config.MinClusterCount, 2);
+        }
+        Config.MaxClusterCount = Maximum(Config.MinClusterCount, Config.MaxClusterCount);
+        Config.ClusterCount = Config.MaxClusterCount;
     }
-    if(ArgCount > 3)
+    if(PositionalCount > 2)
     {
-        Config.Seed = (u32)atoi(Args[3]);
+        Config.Seed = (u32)atoi(Positional[2]);
     }
-    if(ArgCount > 4)
+    if(PositionalCount > 3)
     {
-        char *SortTypeString = Args[4];
+        char *SortTypeString = Positional[3];
         if(StringsMatch(SortTypeString, "red", false))
         {
             Config.SortType = SortType_Red;
@@ -55,190 +370,519 @@ ParseCommandLine(int ArgCount, char **Args)
             Config.SortType = SortType_Blue;
         }
     }
-    if(ArgCount > 5)
+    if(PositionalCount > 4)
     {
-        Config.DestPath = Args[5];
+        Config.DestPath = Positional[4];
     }
 
     return(Config);
 }
 
-static bitmap
-LoadAndScaleBitmap(char *Path, f32 MaxResizedDim)
+struct file_contents
 {
-    bitmap Result = {};
+    u8 *Memory;
+    int Size;
+};
 
-    int SourceWidth;
-    int SourceHeight;
-    void *SourceMemory = stbi_load(Path, &SourceWidth, &SourceHeight, 0, sizeof(u32));
-    if(SourceMemory)
-    {
-        int SourcePitch = SourceWidth*sizeof(u32);
-
-        f32 ScaleFactor = MaxResizedDim / (f32)Maximum(SourceWidth, SourceHeight);
-        int ScaledWidth = RoundToInt(SourceWidth*ScaleFactor);
-        int ScaledHeight = RoundToInt(SourceHeight*ScaleFactor);
+static file_contents
+ReadEntireFile(char *Path)
+{
+    file_contents Result = {};
 
-        Result.Width = ScaledWidth;
-        Result.Height = ScaledHeight;
-        Result.Pitch = ScaledWidth*sizeof(u32);
-        Result.Memory = malloc(Result.Pitch*ScaledHeight);
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        s64 Size = -1;
+        if(SeekFile(File, 0, SEEK_END))
+        {
+            Size = TellFile(File);
+        }
+        if(!SeekFile(File, 0, SEEK_SET))
+        {
+            Size = -1;
+        }
 
-        u8 *Row = (u8 *)Result.Memory;
-        for(int Y = 0;
-            Y < ScaledHeight;
-            Y++)
+        if((Size > 0) && (Size <= 0x7FFFFFFF))
         {
-            u32 *Texel = (u32 *)Row;
-            for(int X = 0;
-                X < ScaledWidth;
-                X++)
+            Result.Memory = (u8 *)malloc((size_t)Size);
+            if(Result.Memory)
             {
-                f32 U = (f32)X / ((f32)ScaledWidth - 1.0f);
-                f32 V = (f32)Y / ((f32)ScaledHeight - 1.0f);
+                if(fread(Result.Memory, 1, (size_t)Size, File) == (size_t)Size)
+                {
+                    Result.Size = (int)Size;
+                }
+                else
+                {
+                    free(Result.Memory);
+                    Result.Memory = 0;
+                }
+            }
+        }
+
+        fclose(File);
+    }
+
+    return(Result);
+}
+
+// NOTE: The returned memory belongs to stb_image, free it with stbi_image_free.
+// Every frame of an animated GIF is decoded, stacked top to bottom in one
+// bitmap Height*FrameCount tall, and FrameCount says how many there are
+// (always 1 for anything else).
+static bitmap
+LoadBitmap(char *Path, int *FrameCount = 0)
+{
+    bitmap Result = {};
+    int Frames = 1;
 
-                Assert((0.0f <= U) && (U <= 1.0f));
-                Assert((0.0f <= V) && (V <= 1.0f));
+    // NOTE: stb_image reads most formats straight from the file, only a GIF
+    // has to be in memory in one piece to get at all of its frames
+    b32 Read = false;
+    int Width = 0;
+    int Height = 0;
+    void *Memory = 0;
+    FILE *File = fopen(Path, "rb");
+    if(File)
+    {
+        u8 Signature[4];
+        if((fread(Signature, 1, sizeof(Signature), File) == sizeof(Signature)) &&
+           (Signature[0] == 'G') && (Signature[1] == 'I') &&
+           (Signature[2] == 'F') && (Signature[3] == '8'))
+        {
+            fclose(File);
+            File = 0;
 
-                int SampleX = RoundToInt(U*((f32)SourceWidth - 1.0f));
-                int SampleY = RoundToInt(V*((f32)SourceHeight - 1.0f));
+            file_contents Contents = ReadEntireFile(Path);
+            if(Contents.Memory)
+            {
+                Read = true;
 
-                Assert((0 <= SampleX) && (SampleX < SourceWidth));
-                Assert((0 <= SampleY) && (SampleY < SourceHeight));
-                
-                u32 Sample = *(u32 *)((u8 *)SourceMemory +
-                                      (SampleX*sizeof(u32)) +
-                                      (SampleY*SourcePitch));
-                
-                *Texel++ = Sample;
+                int *Delays = 0;
+                int Components;
+                Memory = stbi_load_gif_from_memory(Contents.Memory, Contents.Size, &Delays,
+                                                   &Width, &Height, &Frames, &Components,
+                                                   sizeof(u32));
+                stbi_image_free(Delays);
+                free(Contents.Memory);
             }
+        }
+        else if(SeekFile(File, 0, SEEK_SET))
+        {
+            Read = true;
+            Memory = stbi_load_from_file(File, &Width, &Height, 0, sizeof(u32));
+        }
 
-            Row += Result.Pitch;
+        if(File)
+        {
+            fclose(File);
         }
+    }
 
-        stbi_image_free(SourceMemory);
+    if(Memory)
+    {
+        Result.Memory = Memory;
+        Result.Width = Width;
+        Result.Height = Height*Frames;
+        Result.Pitch = Width*sizeof(u32);
     }
-    else
+    else if(Read)
     {
         fprintf(stderr, "stb_image failed: %s\n", stbi_failure_reason());
     }
+    else
+    {
+        fprintf(stderr, "Error: couldn't read %s\n", Path);
+    }
+
+    if(FrameCount)
+    {
+        *FrameCount = Result.Memory ? Frames : 0;
+    }
 
     return(Result);
 }
 
-static bitmap
-AllocateBitmap(int Width, int Height)
+// NOTE: Which source texel a nearest-neighbor scale samples on one axis
+inline int
+GetNearestSample(int Scaled, int ScaledCount, int SourceCount)
 {
-    bitmap Result;
-    Result.Memory = malloc(sizeof(u32)*Width*Height);
-    Result.Width = Width;
-    Result.Height = Height;
-    Result.Pitch = sizeof(u32)*Width;
-    
+    f32 U = (f32)Scaled / ((f32)ScaledCount - 1.0f);
+    Assert((0.0f <= U) && (U <= 1.0f));
+
+    int Result = RoundToInt(U*((f32)SourceCount - 1.0f));
+    Assert((0 <= Result) && (Result < SourceCount));
+
     return(Result);
 }
 
-static void
-ClearObservations(cluster *Cluster)
+// NOTE: The size of the copy whose largest dimension is MaxResizedDim, and
+// the source column every one of its columns samples, which is the same for
+// every row. SampleXs is allocated with malloc.
+static bitmap
+BeginScaledBitmap(int SourceWidth, int SourceHeight, f32 MaxResizedDim, u32 **SampleXs)
 {
-    Cluster->ObservationSum = V3i(0, 0, 0);
-    Cluster->ObservationCount = 0;
-}
+    bitmap Result = {};
 
-static void
-InitializeKMeansContext(kmeans_context *Context, int ClusterCount)
-{
-    Context->ClusterCount = ClusterCount;
-    Context->Clusters = (cluster *)malloc(sizeof(cluster)*ClusterCount);
-}
+    f32 ScaleFactor = MaxResizedDim / (f32)Maximum(SourceWidth, SourceHeight);
+    int ScaledWidth = RoundToInt(SourceWidth*ScaleFactor);
+    int ScaledHeight = RoundToInt(SourceHeight*ScaleFactor);
 
-static u32
-AssignObservation(kmeans_context *Context, v3 Observation)
-{
-    f32 ClosestDistSquared = F32Max;
-    cluster *ClosestCluster = 0;
+    Result.Width = ScaledWidth;
+    Result.Height = ScaledHeight;
+    Result.Pitch = ScaledWidth*sizeof(u32);
+    Result.Memory = malloc((size_t)Result.Pitch*ScaledHeight);
 
-    for(int ClusterIndex = 0;
-        ClusterIndex < Context->ClusterCount;
-        ClusterIndex++)
+    *SampleXs = (u32 *)malloc(sizeof(u32)*ScaledWidth);
+    if(Result.Memory && *SampleXs)
     {
-        cluster *Cluster = Context->Clusters + ClusterIndex;
-
-        f32 d = LengthSquared(Cluster->Centroid - Observation);
-        if(d < ClosestDistSquared)
+        for(int X = 0;
+            X < ScaledWidth;
+            X++)
         {
-            ClosestDistSquared = d;
-            ClosestCluster = Cluster;
+            (*SampleXs)[X] = (u32)GetNearestSample(X, ScaledWidth, SourceWidth);
         }
     }
+    else
+    {
+        free(Result.Memory);
+        Result.Memory = 0;
+    }
 
-    Assert(ClosestCluster);
-
-    ClosestCluster->ObservationSum += Observation;
-    ClosestCluster->ObservationCount++;
-    
-    // Returning the index of the closest cluster for our early out in the loop
-    // where this function is called
-    u32 Result = (u32)(ClosestCluster - Context->Clusters);
-    Assert(Result < (u32)Context->ClusterCount);
-    
     return(Result);
 }
 
-static void
-RecalculateCentroids(kmeans_context *Context)
+// NOTE: Nearest-neighbor copy of Source whose largest dimension is
+// MaxResizedDim, allocated with malloc
+static bitmap
+ScaleBitmap(bitmap Source, f32 MaxResizedDim)
 {
-    for(int ClusterIndex = 0;
-        ClusterIndex < Context->ClusterCount;
-        ClusterIndex++)
+    u32 *SampleXs;
+    bitmap Result = BeginScaledBitmap(Source.Width, Source.Height, MaxResizedDim, &SampleXs);
+    if(Result.Memory)
     {
-        cluster *Cluster = Context->Clusters + ClusterIndex;
-
-        // Assert(Cluster->ObservationCount);
-        if(Cluster->ObservationCount)
+        u8 *Row = (u8 *)Result.Memory;
+        for(int Y = 0;
+            Y < Result.Height;
+            Y++)
         {
-            Cluster->Centroid = Cluster->ObservationSum*(1.0f / Cluster->ObservationCount);
+            int SampleY = GetNearestSample(Y, Result.Height, Source.Height);
+            u32 *SourceRow = (u32 *)GetBitmapPtr(Source, 0, SampleY);
+            Kernels.DownsampleRow(SourceRow, SampleXs, Result.Width, (u32 *)Row);
+
+            Row += Result.Pitch;
         }
-        ClearObservations(Cluster);
     }
+
+    free(SampleXs);
+
+    return(Result);
 }
 
-static void
-SortClustersByCentroid(kmeans_context *Context, sort_type SortType)
+// NOTE: The same copy ScaleBitmap would make of the decoded image, built from
+// the stream one source row at a time. Every row also goes to Colors, if
+// given, and Indexed says whether it still fits.
+static bitmap
+StreamScaledBitmap(image_stream *Stream, f32 MaxResizedDim, indexed_colors *Colors, b32 *Indexed)
 {
-    v3 FocalColor = V3i(0, 0, 0);
-    switch(SortType)
+    u32 *SampleXs;
+    bitmap Result = BeginScaledBitmap(Stream->Width, Stream->Height, MaxResizedDim, &SampleXs);
+    u32 *SourceRow = (u32 *)malloc(sizeof(u32)*Stream->Width);
+
+    *Indexed = (Colors != 0);
+    if(Colors)
     {
-        case SortType_Red:
-        {
-            FocalColor = {53.23288178584245f,
-                          80.10930952982204f,
-                          67.22006831026425f};
-        } break;
-        
-        case SortType_Green:
-        {
-            FocalColor = {87.73703347354422f,
-                          -86.18463649762525f,
-                          83.18116474777854};
-        } break;
-        
-        case SortType_Blue:
-        {
-            FocalColor = {32.302586667249486,
-                          79.19666178930935,
-                          -107.86368104495168};
-        } break;
+        BeginIndexedColors(Colors);
     }
 
-    for(int Outer = 0;
-        Outer < Context->ClusterCount;
-        Outer++)
+    if(Result.Memory && SourceRow)
     {
-        b32 Swapped = false;
-        
-        for(int Inner = 0;
-            Inner < (Context->ClusterCount - 1);
+        // NOTE: The rows the copy samples only ever go down, and when it's
+        // bigger than the source one source row is sampled several times
+        b32 Complete = true;
+        int Y = 0;
+        int SampleY = GetNearestSample(Y, Result.Height, Stream->Height);
+        while(Complete && (Stream->NextY < Stream->Height))
+        {
+            int SourceY = Stream->NextY;
+            Complete = ReadImageStreamRow(Stream, SourceRow);
+            if(Complete)
+            {
+                if(*Indexed)
+                {
+                    *Indexed = AddIndexedColorRow(Colors, SourceRow, Stream->Width);
+                }
+
+                while((Y < Result.Height) && (SampleY == SourceY))
+                {
+                    Kernels.DownsampleRow(SourceRow, SampleXs, Result.Width,
+                                          (u32 *)GetBitmapPtr(Result, 0, Y));
+                    if(++Y < Result.Height)
+                    {
+                        SampleY = GetNearestSample(Y, Result.Height, Stream->Height);
+                    }
+                }
+            }
+        }
+
+        if(!Complete)
+        {
+            free(Result.Memory);
+            Result.Memory = 0;
+        }
+    }
+    else
+    {
+        free(Result.Memory);
+        Result.Memory = 0;
+    }
+
+    free(SourceRow);
+    free(SampleXs);
+
+    return(Result);
+}
+
+// NOTE: The frames of an animated GIF are scaled one by one and stay
+// stacked the same way. Source is left alone.
+static bitmap
+ScaleFrames(bitmap Source, int FrameCount, f32 MaxResizedDim)
+{
+    bitmap Result = {};
+
+    if(FrameCount == 1)
+    {
+        Result = ScaleBitmap(Source, MaxResizedDim);
+    }
+    else
+    {
+        int FrameHeight = Source.Height / FrameCount;
+        for(int FrameIndex = 0;
+            FrameIndex < FrameCount;
+            FrameIndex++)
+        {
+            bitmap Frame = Source;
+            Frame.Memory = GetBitmapPtr(Source, 0, FrameIndex*FrameHeight);
+            Frame.Height = FrameHeight;
+
+            bitmap Scaled = ScaleBitmap(Frame, MaxResizedDim);
+            if(FrameIndex == 0)
+            {
+                Result = Scaled;
+                Result.Height = Scaled.Height*FrameCount;
+                Result.Memory = malloc((size_t)Result.Pitch*Result.Height);
+            }
+
+            if(Result.Memory && Scaled.Memory)
+            {
+                u8 *Dest = (u8 *)GetBitmapPtr(Result, 0, FrameIndex*Scaled.Height);
+                u8 *SourceTexels = (u8 *)Scaled.Memory;
+                s64 ByteCount = (s64)Scaled.Pitch*Scaled.Height;
+                for(s64 Byte = 0;
+                    Byte < ByteCount;
+                    Byte++)
+                {
+                    Dest[Byte] = SourceTexels[Byte];
+                }
+            }
+            else
+            {
+                free(Result.Memory);
+                Result.Memory = 0;
+            }
+            free(Scaled.Memory);
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Moves the texels with an alpha of at least AlphaThreshold to the
+// front of the bitmap, in place, one frame after another, and reshapes the
+// bitmap into a single block about as wide as it is tall. FrameTexelCounts
+// gets how many texels each frame kept, so each one weighs in with exactly
+// its own opaque texels. A frame with nothing opaque in it is kept whole.
+// The block's last row is filled out with copies of earlier texels, spread
+// evenly so no texel gets more than one, which is less than a row in all.
+// Returns false, leaving the bitmap alone, if no frame had anything to leave
+// out.
+static b32
+CompactOpaqueTexels(bitmap *Bitmap, int FrameCount, int AlphaThreshold, int *FrameTexelCounts)
+{
+    b32 Result = false;
+
+    int FrameHeight = Bitmap->Height / FrameCount;
+    int FrameTexelCount = Bitmap->Width*FrameHeight;
+    s64 TexelCount = (s64)FrameTexelCount*FrameCount;
+    u32 Threshold = (u32)AlphaThreshold << 24;
+    Assert(Bitmap->Pitch == (int)sizeof(u32)*Bitmap->Width);
+
+    s64 OpaqueCount = 0;
+    for(int FrameIndex = 0;
+        FrameIndex < FrameCount;
+        FrameIndex++)
+    {
+        u32 *Texels = (u32 *)Bitmap->Memory + (s64)FrameIndex*FrameTexelCount;
+        int FrameOpaqueCount = 0;
+        for(int Index = 0;
+            Index < FrameTexelCount;
+            Index++)
+        {
+            FrameOpaqueCount += ((Texels[Index] & 0xFF000000) >= Threshold);
+        }
+
+        if(FrameOpaqueCount == 0)
+        {
+            FrameOpaqueCount = FrameTexelCount;
+        }
+        FrameTexelCounts[FrameIndex] = FrameOpaqueCount;
+        OpaqueCount += FrameOpaqueCount;
+    }
+
+    if(OpaqueCount < TexelCount)
+    {
+        // NOTE: Seeding samples below Width - 1 and Height - 1, so the block
+        // needs at least two of each. Rounding the side up can make a block
+        // that's nearly all opaque bigger than the bitmap, it keeps the
+        // bitmap's width then.
+        int CompactWidth = Maximum(2, (int)SquareRoot((f32)OpaqueCount) + 1);
+        int CompactHeight = Maximum(2, (int)((OpaqueCount + CompactWidth - 1) / CompactWidth));
+        if(((s64)CompactWidth*CompactHeight) > TexelCount)
+        {
+            CompactWidth = Bitmap->Width;
+            CompactHeight = Clampi(Minimum(2, Bitmap->Height),
+                                   (int)((OpaqueCount + CompactWidth - 1) / CompactWidth),
+                                   Bitmap->Height);
+        }
+        s64 CompactTexelCount = (s64)CompactWidth*CompactHeight;
+
+        // NOTE: Every frame is written at or before where it was read from,
+        // so nothing is overwritten before it's been read
+        u32 *Dest = (u32 *)Bitmap->Memory;
+        for(int FrameIndex = 0;
+            FrameIndex < FrameCount;
+            FrameIndex++)
+        {
+            u32 *Source = (u32 *)Bitmap->Memory + (s64)FrameIndex*FrameTexelCount;
+            b32 Whole = (FrameTexelCounts[FrameIndex] == FrameTexelCount);
+            for(int Index = 0;
+                Index < FrameTexelCount;
+                Index++)
+            {
+                u32 Texel = Source[Index];
+                if(Whole || ((Texel & 0xFF000000) >= Threshold))
+                {
+                    *Dest++ = Texel;
+                }
+            }
+        }
+
+        u32 *Texels = (u32 *)Bitmap->Memory;
+        s64 PadCount = CompactTexelCount - OpaqueCount;
+        for(s64 PadIndex = 0;
+            PadIndex < PadCount;
+            PadIndex++)
+        {
+            Texels[OpaqueCount + PadIndex] = Texels[(PadIndex*OpaqueCount) / PadCount];
+        }
+
+        Bitmap->Width = CompactWidth;
+        Bitmap->Height = CompactHeight;
+        Bitmap->Pitch = CompactWidth*sizeof(u32);
+        Result = true;
+    }
+
+    return(Result);
+}
+
+// NOTE: Redoes FrameTexelCounts for Scaled, the copy ScaleBitmap made of a
+// block from CompactOpaqueTexels. Nearest samples keep the texels in order,
+// so every frame is still one run of the copy, and whatever came from the
+// block's padding is left over at the end.
+static void
+ScaleFrameTexelCounts(bitmap Source, bitmap Scaled, int FrameCount, int *FrameTexelCounts)
+{
+    int FrameIndex = 0;
+    s64 OnePastFrame = FrameTexelCounts[0];
+    FrameTexelCounts[0] = 0;
+    for(int Y = 0;
+        Y < Scaled.Height;
+        Y++)
+    {
+        s64 SampleY = GetNearestSample(Y, Scaled.Height, Source.Height);
+        for(int X = 0;
+            X < Scaled.Width;
+            X++)
+        {
+            s64 SourceIndex = SampleY*Source.Width + GetNearestSample(X, Scaled.Width, Source.Width);
+            while((FrameIndex < FrameCount) && (SourceIndex >= OnePastFrame))
+            {
+                FrameIndex++;
+                if(FrameIndex < FrameCount)
+                {
+                    OnePastFrame += FrameTexelCounts[FrameIndex];
+                    FrameTexelCounts[FrameIndex] = 0;
+                }
+            }
+
+            if(FrameIndex < FrameCount)
+            {
+                FrameTexelCounts[FrameIndex]++;
+            }
+        }
+    }
+
+    for(int Index = FrameIndex + 1;
+        Index < FrameCount;
+        Index++)
+    {
+        FrameTexelCounts[Index] = 0;
+    }
+}
+
+static bitmap
+AllocateBitmap(int Width, int Height)
+{
+    bitmap Result;
+    Result.Memory = malloc(sizeof(u32)*Width*Height);
+    Result.Width = Width;
+    Result.Height = Height;
+    Result.Pitch = sizeof(u32)*Width;
+    
+    return(Result);
+}
+
+static void
+SortClustersByCentroid(kmeans_context *Context, sort_type SortType, color_space ColorSpace)
+{
+    // The focal colors are pure sRGB red, green and blue, expressed in the
+    // same color space as the centroids
+    v3 FocalColor = V3i(0, 0, 0);
+    switch(SortType)
+    {
+        case SortType_Red:
+        {
+            FocalColor = UnpackRGBAToColor(ColorSpace, 0xFF0000FF);
+        } break;
+        
+        case SortType_Green:
+        {
+            FocalColor = UnpackRGBAToColor(ColorSpace, 0xFF00FF00);
+        } break;
+        
+        case SortType_Blue:
+        {
+            FocalColor = UnpackRGBAToColor(ColorSpace, 0xFFFF0000);
+        } break;
+    }
+
+    for(int Outer = 0;
+        Outer < Context->ClusterCount;
+        Outer++)
+    {
+        b32 Swapped = false;
+        
+        for(int Inner = 0;
+            Inner < (Context->ClusterCount - 1);
             Inner++)
         {
             cluster *ClusterA = Context->Clusters + Inner;
@@ -279,22 +923,6 @@ SortClustersByCentroid(kmeans_context *Context, sort_type SortType)
     }
 }
 
-static int
-ComputeTotalObservationCount(kmeans_context *Context)
-{
-    int Result = 0;
-
-    for(int ClusterIndex = 0;
-        ClusterIndex < Context->ClusterCount;
-        ClusterIndex++)
-    {
-        cluster *Cluster = Context->Clusters + ClusterIndex;
-        Result += Cluster->ObservationCount;
-    }
-
-    return(Result);
-}
-
 static void
 ExportBMP(bitmap Bitmap, char *Path)
 {
@@ -344,152 +972,759 @@ ExportBMP(bitmap Bitmap, char *Path)
     }
 }
 
+// Undoes the channel weighting so the centroids are plain colors in the
+// configured color space again
+static void
+UnweightCentroids(kmeans_context *Context, v3 DistanceScale)
+{
+    v3 InvDistanceScale = V3(1.0f / DistanceScale.x,
+                             1.0f / DistanceScale.y,
+                             1.0f / DistanceScale.z);
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        Cluster->Centroid = Hadamard(Cluster->Centroid, InvDistanceScale);
+    }
+}
+
+// Fills rows [FirstY, FirstY + Height) of the palette with one band per
+// cluster, each as wide as its share of the observations
+static void
+RenderPalette(kmeans_context *Context, color_space ColorSpace, bitmap Palette, int FirstY, int Height)
+{
+    u32 *ScanLine = (u32 *)GetBitmapPtr(Palette, 0, FirstY);
+
+    s64 TotalObservationCount = ComputeTotalObservationCount(Context);
+    u32 *Row = ScanLine;
+    u32 *RowEnd = Row + Palette.Width;
+    u32 CentroidColor = 0;
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+
+        f32 Weight = SafeRatio0((f32)Cluster->ObservationCount,
+                                (f32)TotalObservationCount);
+        int ClusterPixelWidth = RoundToInt(Weight*Palette.Width);
+
+        // NOTE: Each width is rounded on its own, so together they can come
+        // out a pixel or two over or under the scanline
+        CentroidColor = PackColorToRGBA(ColorSpace, Cluster->Centroid);
+        while(ClusterPixelWidth-- && (Row < RowEnd))
+        {
+            *Row++ = CentroidColor;
+        }
+    }
+    while(Row < RowEnd)
+    {
+        *Row++ = CentroidColor;
+    }
+
+    for(int Y = FirstY + 1;
+        Y < (FirstY + Height);
+        Y++)
+    {
+        u32 *SourceTexelPtr = ScanLine;
+        u32 *DestTexelPtr = (u32 *)GetBitmapPtr(Palette, 0, Y);
+        for(int X = 0;
+            X < Palette.Width;
+            X++)
+        {
+            *DestTexelPtr++ = *SourceTexelPtr++;
+        }
+    }
+}
+
+// Exports every palette size the tree holds as one band of rows, from a
+// single color at the top to the largest palette at the bottom
+static void
+ExportPaletteTree(palette_tree *Tree, color_space ColorSpace, sort_type SortType,
+                  v3 DistanceScale, char *Path)
+{
+    int PaletteWidth = 512;
+    int RowHeight = 16;
+    bitmap Palettes = AllocateBitmap(PaletteWidth, RowHeight*Tree->Size);
+
+    kmeans_context Context;
+    InitializeKMeansContext(&Context, Tree->Size);
+    if(Palettes.Memory && Context.Clusters)
+    {
+        for(int Size = 1;
+            Size <= Tree->Size;
+            Size++)
+        {
+            GetPaletteTreeClusters(Tree, Size, &Context);
+            UnweightCentroids(&Context, DistanceScale);
+            SortClustersByCentroid(&Context, SortType, ColorSpace);
+
+            // NOTE: BMP rows go bottom up
+            RenderPalette(&Context, ColorSpace, Palettes, (Tree->Size - Size)*RowHeight, RowHeight);
+        }
+
+        ExportBMP(Palettes, Path);
+    }
+    else
+    {
+        fprintf(stderr, "Error: malloc failed while exporting the palette tree\n");
+    }
+
+    free(Palettes.Memory);
+    FreeKMeansContext(&Context);
+}
+
+struct frame_palette_job
+{
+    kmeans_context Context;
+    observation_buffer Observations;
+    int Width;
+    int Height;
+    u32 *ClusterIndices;
+};
+
+static
+WORK_QUEUE_CALLBACK(RunFramePaletteJob)
+{
+    frame_palette_job *Job = (frame_palette_job *)Data;
+
+    RunLloydKMeans(&Job->Context, &Job->Observations, Job->Width, Job->Height,
+                   Job->ClusterIndices);
+}
+
+// NOTE: Gives every frame of the stacked bitmap its own palette, refined from
+// the global one with Lloyd so each frame starts close to convergence. All
+// the frames are converted in one go and each job gets a view of its part of
+// the buffer, so the conversion tables are built once and every texel is
+// converted once no matter how many frames there are. Global still holds the
+// weighted centroids here. FrameTexelCounts is 0 for a stack of whole frames,
+// or says how long each frame's run is in a block from CompactOpaqueTexels.
+// Exported like the palette tree, one band per frame with the first one at
+// the top.
+static void
+ExportFramePalettes(kmeans_context *Global, bitmap Bitmap, int FrameCount, int *FrameTexelCounts,
+                    color_space ColorSpace, sort_type SortType, v3 DistanceScale,
+                    work_queue *Queue, char *Path)
+{
+    int PaletteWidth = 512;
+    int RowHeight = 16;
+    bitmap Palettes = AllocateBitmap(PaletteWidth, RowHeight*FrameCount);
+
+    int FrameHeight = Bitmap.Height / FrameCount;
+    observation_buffer Observations = ConvertBitmapToObservations(Bitmap, DistanceScale);
+    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations.Count);
+    frame_palette_job *Jobs = (frame_palette_job *)calloc(FrameCount, sizeof(frame_palette_job));
+
+    b32 Allocated = (Palettes.Memory && Observations.X && Observations.Y && Observations.Z &&
+                     ClusterIndices && Jobs);
+    s64 First = 0;
+    for(int FrameIndex = 0;
+        Allocated && (FrameIndex < FrameCount);
+        FrameIndex++)
+    {
+        frame_palette_job *Job = Jobs + FrameIndex;
+
+        InitializeKMeansContext(&Job->Context, Global->ClusterCount);
+        if(Job->Context.Clusters)
+        {
+            for(int ClusterIndex = 0;
+                ClusterIndex < Global->ClusterCount;
+                ClusterIndex++)
+            {
+                Job->Context.Clusters[ClusterIndex] = Global->Clusters[ClusterIndex];
+                ClearObservations(Job->Context.Clusters + ClusterIndex);
+            }
+        }
+        else
+        {
+            Allocated = false;
+        }
+
+        // NOTE: A run is a single row as far as Lloyd is concerned
+        Job->Width = Bitmap.Width;
+        Job->Height = FrameHeight;
+        if(FrameTexelCounts)
+        {
+            Job->Width = FrameTexelCounts[FrameIndex];
+            Job->Height = 1;
+        }
+        Job->Observations.Count = Job->Width*Job->Height;
+        Job->Observations.X = Observations.X + First;
+        Job->Observations.Y = Observations.Y + First;
+        Job->Observations.Z = Observations.Z + First;
+        Job->ClusterIndices = ClusterIndices + First;
+        First += Job->Observations.Count;
+    }
+
+    if(Allocated)
+    {
+        // NOTE: The ring keeps one entry free, so long animations go in batches
+        int BatchSize = MAX_WORK_QUEUE_ENTRY_COUNT - 1;
+        for(int FirstFrame = 0;
+            FirstFrame < FrameCount;
+            FirstFrame += BatchSize)
+        {
+            int OnePastLastFrame = Minimum(FirstFrame + BatchSize, FrameCount);
+            for(int FrameIndex = FirstFrame;
+                FrameIndex < OnePastLastFrame;
+                FrameIndex++)
+            {
+                AddEntry(Queue, RunFramePaletteJob, Jobs + FrameIndex);
+            }
+            CompleteAllWork(Queue);
+        }
+
+        for(int FrameIndex = 0;
+            FrameIndex < FrameCount;
+            FrameIndex++)
+        {
+            kmeans_context *Context = &Jobs[FrameIndex].Context;
+            UnweightCentroids(Context, DistanceScale);
+            SortClustersByCentroid(Context, SortType, ColorSpace);
+
+            // NOTE: BMP rows go bottom up
+            RenderPalette(Context, ColorSpace, Palettes, (FrameCount - 1 - FrameIndex)*RowHeight, RowHeight);
+        }
+
+        ExportBMP(Palettes, Path);
+    }
+    else
+    {
+        fprintf(stderr, "Error: malloc failed while exporting the frame palettes\n");
+    }
+
+    if(Jobs)
+    {
+        for(int FrameIndex = 0;
+            FrameIndex < FrameCount;
+            FrameIndex++)
+        {
+            FreeKMeansContext(&Jobs[FrameIndex].Context);
+        }
+    }
+    free(Jobs);
+    free(ClusterIndices);
+    free(Observations.X);
+    free(Observations.Y);
+    free(Observations.Z);
+    free(Palettes.Memory);
+}
+
+// NOTE: One line per frame: its index, then every color as RRGGBB hex
+static void
+WritePaletteRecord(FILE *File, int FrameIndex, kmeans_context *Context, color_space ColorSpace)
+{
+    fprintf(File, "%d", FrameIndex);
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        u32 Color = PackColorToRGBA(ColorSpace, Context->Clusters[ClusterIndex].Centroid);
+        fprintf(File, " %02X%02X%02X",
+                (Color >> 0) & 0xFF,
+                (Color >> 8) & 0xFF,
+                (Color >> 16) & 0xFF);
+    }
+    fprintf(File, "\n");
+}
+
+// Palettizes every frame of a stream. The frames are scaled down like the
+// Lloyd engine's single images, the first one is clustered from scratch and
+// every one after that only updates the palettizer with the rectangle that
+// changed since the last clustered frame, starting from its centroids. Frames
+// whose coarse histogram barely moved don't even do that and repeat the last
+// palette, which also keeps it from flickering on noise. The alpha threshold
+// doesn't apply here: the palettizer is updated a rectangle at a time, and
+// leaving texels out would break the frames up, so raw RGBA frames are
+// clustered with whatever alpha they have.
+static b32
+RunSequence(palettize_config *Config)
+{
+    b32 Result = false;
+
+    v3 DistanceScale = V3(SquareRoot(Config->ChannelWeights.x),
+                          SquareRoot(Config->ChannelWeights.y),
+                          SquareRoot(Config->ChannelWeights.z));
+    f32 MaxResizedDim = 100.0f*SquareRoot(Maximum(1.0f, (f32)Config->ClusterCount / 64.0f));
+
+    frame_reader Reader;
+    if(OpenFrameReader(&Reader, Config->SourcePath, Config->SequenceFormat,
+                       Config->SequenceWidth, Config->SequenceHeight))
+    {
+        FILE *Dest = (StringsMatch(Config->DestPath, "-") ?
+                      stdout : fopen(Config->DestPath, "w"));
+
+        bitmap Frame = AllocateBitmap(Reader.Width, Reader.Height);
+        bitmap Clustered = {};
+        frame_histogram *Histogram = (frame_histogram *)malloc(sizeof(frame_histogram));
+        frame_histogram *ClusteredHistogram = (frame_histogram *)malloc(sizeof(frame_histogram));
+        kmeans_context Palette;
+        InitializeKMeansContext(&Palette, Config->ClusterCount);
+
+        if(Dest && Frame.Memory && Histogram && ClusteredHistogram && Palette.Clusters)
+        {
+            Result = true;
+
+            incremental_palettizer Palettizer = {};
+            int FrameIndex = 0;
+            int ClusteredCount = 0;
+            while(Result && ReadFrame(&Reader, Frame))
+            {
+                bitmap Scaled = ScaleBitmap(Frame, MaxResizedDim);
+                if(Scaled.Memory)
+                {
+                    ComputeFrameHistogram(Scaled, Histogram);
+
+                    b32 Recluster = true;
+                    if(FrameIndex == 0)
+                    {
+                        Result = BeginIncrementalPalettizer(&Palettizer, Scaled, Config->ClusterCount,
+                                                            DistanceScale, Config->Seed);
+                    }
+                    else if(ComputeHistogramChange(Histogram, ClusteredHistogram) >= Config->SkipThreshold)
+                    {
+                        int MinX, MinY, MaxX, MaxY;
+                        FindChangedRect(Scaled, Clustered, &MinX, &MinY, &MaxX, &MaxY);
+                        UpdateIncrementalPalettizer(&Palettizer, Scaled, MinX, MinY, MaxX, MaxY);
+                    }
+                    else
+                    {
+                        Recluster = false;
+                    }
+
+                    if(Result && Recluster)
+                    {
+                        free(Clustered.Memory);
+                        Clustered = Scaled;
+                        Scaled.Memory = 0;
+
+                        frame_histogram *Swap = ClusteredHistogram;
+                        ClusteredHistogram = Histogram;
+                        Histogram = Swap;
+
+                        for(int ClusterIndex = 0;
+                            ClusterIndex < Palette.ClusterCount;
+                            ClusterIndex++)
+                        {
+                            Palette.Clusters[ClusterIndex] = Palettizer.Context.Clusters[ClusterIndex];
+                        }
+                        UnweightCentroids(&Palette, DistanceScale);
+                        SortClustersByCentroid(&Palette, Config->SortType, Config->ColorSpace);
+
+                        ClusteredCount++;
+                    }
+                    free(Scaled.Memory);
+
+                    if(Result)
+                    {
+                        WritePaletteRecord(Dest, FrameIndex, &Palette, Config->ColorSpace);
+                        FrameIndex++;
+                    }
+                }
+                else
+                {
+                    Result = false;
+                }
+            }
+
+            if(Result)
+            {
+                // NOTE: The palettes may be going to stdout
+                fprintf(stderr, "%d frames, %d clustered\n", FrameIndex, ClusteredCount);
+            }
+            else
+            {
+                fprintf(stderr, "Error: malloc failed at frame %d\n", FrameIndex);
+            }
+
+            EndIncrementalPalettizer(&Palettizer);
+        }
+        else if(!Dest)
+        {
+            fprintf(stderr, "Error: couldn't open %s\n", Config->DestPath);
+        }
+        else
+        {
+            fprintf(stderr, "Error: malloc failed at startup\n");
+        }
+
+        if(Dest && (Dest != stdout))
+        {
+            fclose(Dest);
+        }
+        free(Frame.Memory);
+        free(Clustered.Memory);
+        free(Histogram);
+        free(ClusteredHistogram);
+        FreeKMeansContext(&Palette);
+        CloseFrameReader(&Reader);
+    }
+
+    return(Result);
+}
+
 int
 main(int ArgCount, char **Args)
 {
-    if(ArgCount > 1)
+    if((ArgCount == 2) && StringsMatch(Args[1], "--selftest"))
+    {
+        // NOTE: Only for the lookup tables, the self-test picks its own kernels
+        InitializeKernels(ISALevel_Scalar, ColorSpace_CIELAB);
+        if(!RunSelfTest())
+        {
+            return(1);
+        }
+    }
+    else if(ArgCount > 1)
     {
         palettize_config Config = ParseCommandLine(ArgCount, Args);
 
+        InitializeKernels(SelectISALevel(), Config.ColorSpace);
+
+        if(Config.SequenceFormat != SequenceFormat_None)
+        {
+            return(RunSequence(&Config) ? 0 : 1);
+        }
+
         kmeans_context Context_;
         kmeans_context *Context = &Context_;
         InitializeKMeansContext(Context, Config.ClusterCount);
 
-        // To improve performance, the source image is scaled such that its
-        // largest dimension has a value of 100 pixels
-        // @Refactor: Decouple scaling from loading so that small images are
-        // not resized to be bigger
-        bitmap Bitmap = LoadAndScaleBitmap(Config.SourcePath, 100.0f);
-        
-        bitmap PrevClusterIndexBuffer = AllocateBitmap(Bitmap.Width, Bitmap.Height);
+        // Every texel is converted to the configured color space before it's
+        // clustered, with the channel weights folded in
+        v3 DistanceScale = V3(SquareRoot(Config.ChannelWeights.x),
+                              SquareRoot(Config.ChannelWeights.y),
+                              SquareRoot(Config.ChannelWeights.z));
+
+        // NOTE: The main thread works too, so one fewer worker than processors
+        int ThreadCount = (((Config.Engine == KMeansEngine_Histogram) ||
+                            (Config.Engine == KMeansEngine_Tiled) || Config.FramesPath) ?
+                           GetLogicalProcessorCount() :
+                           Minimum(Config.RestartCount, GetLogicalProcessorCount()));
+        work_queue Queue;
+        InitializeWorkQueue(&Queue, ThreadCount - 1);
+
+        // To improve performance, Lloyd clusters a copy of the source image
+        // scaled such that its largest dimension has a value of 100 pixels.
+        // Past 64 clusters that side grows with the square root of the count,
+        // so every cluster still has about as many texels to average.
+        // The mini-batch engine only ever looks at a bounded number of texels
+        // and the octree and histogram engines only keep a bounded summary of
+        // them, so they get the native resolution. So does the tiled engine,
+        // since clustering every texel is all it's for.
+        // @Refactor: Small images are still resized to be bigger
+        b32 Scaled = ((Config.Engine != KMeansEngine_MiniBatch) &&
+                      (Config.Engine != KMeansEngine_Octree) &&
+                      (Config.Engine != KMeansEngine_Histogram) &&
+                      (Config.Engine != KMeansEngine_Tiled));
+        f32 MaxResizedDim = 100.0f*SquareRoot(Maximum(1.0f, (f32)Config.ClusterCount / 64.0f));
+
+        // NOTE: A source with at most 256 distinct colors, which every
+        // paletted PNG or GIF is, gets clustered as those colors weighted by
+        // how many texels use them. Only the engines that are plain Lloyd
+        // underneath take it, since they'd come to the same kind of result.
+        // The colors are counted at the native resolution, so one only a few
+        // texels use isn't lost to the 100px copy.
+        b32 CountColors = (((Config.Engine == KMeansEngine_Lloyd) ||
+                            (Config.Engine == KMeansEngine_Histogram)) &&
+                           (Config.Init == KMeansInit_Random) &&
+                           !Config.AutoClusterCount);
+        b32 Indexed = false;
+        indexed_colors IndexedColors;
+
+        // NOTE: When the source can be read a row at a time, the engines that
+        // only want the 100px copy or a histogram get them straight from the
+        // file, and so does the octree, which only looks at each row once.
+        // The decoded image never exists then. The rest need all of it, and
+        // the tiled engine reads it from the file too, since stb_image won't
+        // decode anything past 2GB.
+        int FrameCount = 0;
+        int *FrameTexelCounts = 0;
+        bitmap Bitmap = {};
+        color_histogram *Histogram = 0;
+        b32 StreamedOctree = false;
+        image_stream Stream;
+        if((Scaled ||
+            (Config.Engine == KMeansEngine_Histogram) ||
+            (Config.Engine == KMeansEngine_Octree) ||
+            (Config.Engine == KMeansEngine_Tiled)) &&
+           OpenImageStream(&Stream, Config.SourcePath))
+        {
+            FrameCount = 1;
+            if(Scaled)
+            {
+                Bitmap = StreamScaledBitmap(&Stream, MaxResizedDim,
+                                            CountColors ? &IndexedColors : 0, &Indexed);
+            }
+            else if(Config.Engine == KMeansEngine_Tiled)
+            {
+                Bitmap = ReadStreamedBitmap(&Stream);
+            }
+            else if(Config.Engine == KMeansEngine_Octree)
+            {
+                StreamedOctree = (Context->Clusters &&
+                                  (StreamOctreeQuantizer(Context, &Stream, Config.ColorSpace,
+                                                         DistanceScale) > 0));
+            }
+            else
+            {
+                Histogram = StreamColorHistogram(&Stream, ThreadCount, &Queue,
+                                                 CountColors ? &IndexedColors : 0, &Indexed);
+            }
+            CloseImageStream(&Stream);
+        }
+        else
+        {
+            Bitmap = LoadBitmap(Config.SourcePath, &FrameCount);
+            if(Bitmap.Memory && Config.AlphaThreshold)
+            {
+                FrameTexelCounts = (int *)malloc(sizeof(int)*FrameCount);
+                if(FrameTexelCounts &&
+                   CompactOpaqueTexels(&Bitmap, FrameCount, Config.AlphaThreshold, FrameTexelCounts))
+                {
+                    // NOTE: The frames are one square block now, and its
+                    // copy is as big as all of theirs would be if they were
+                    // square too
+                    MaxResizedDim *= SquareRoot((f32)FrameCount);
+                }
+                else
+                {
+                    free(FrameTexelCounts);
+                    FrameTexelCounts = 0;
+                }
+            }
+
+            if(Bitmap.Memory && CountColors)
+            {
+                Indexed = CountIndexedColors(Bitmap, &IndexedColors);
+            }
+
+            if(Bitmap.Memory && Scaled)
+            {
+                bitmap ScaledBitmap = ScaleFrames(Bitmap, FrameTexelCounts ? 1 : FrameCount, MaxResizedDim);
+                if(ScaledBitmap.Memory && FrameTexelCounts)
+                {
+                    ScaleFrameTexelCounts(Bitmap, ScaledBitmap, FrameCount, FrameTexelCounts);
+                }
+                stbi_image_free(Bitmap.Memory);
+                Bitmap = ScaledBitmap;
+            }
+        }
+        b32 Loaded = (Bitmap.Memory || Histogram || StreamedOctree);
+
+        // NOTE: The frames of an animated GIF come stacked in one bitmap, so
+        // every engine clusters all of them together into the global palette
+        if(Config.FramesPath && (FrameCount < 2))
+        {
+            if(Loaded)
+            {
+                fprintf(stderr, "Warning: frames only applies to an animated GIF source\n");
+            }
+            Config.FramesPath = 0;
+        }
 
         int PaletteWidth = 512;
         int PaletteHeight = 64;
         bitmap Palette = AllocateBitmap(PaletteWidth, PaletteHeight);
 
+        b32 Clustered = false;
         if(Context->Clusters &&
-           Bitmap.Memory &&
-           PrevClusterIndexBuffer.Memory &&
-           Palette.Memory)
+           Loaded &&
+           Palette.Memory &&
+           Indexed)
         {
-            random_series Entropy = SeedSeries(Config.Seed);
-            for(int ClusterIndex = 0;
-                ClusterIndex < Context->ClusterCount;
-                ClusterIndex++)
+            histogram_points Points = ConvertIndexedColorsToPoints(&IndexedColors, DistanceScale);
+            if(Points.Observations.X && Points.Observations.Y && Points.Observations.Z &&
+               Points.Weights)
             {
-                cluster *Cluster = Context->Clusters + ClusterIndex;
-                
-                ClearObservations(Cluster);
-
-                u32 SampleX = RandomU32Between(&Entropy, 0, (u32)(Bitmap.Width - 1));
-                u32 SampleY = RandomU32Between(&Entropy, 0, (u32)(Bitmap.Height - 1));
-                u32 Sample = *(u32 *)GetBitmapPtr(Bitmap, SampleX, SampleY);
-    
-                Cluster->Centroid = UnpackRGBAToCIELAB(Sample);
-            }                
-
-            int MinX = 0;
-            int MinY = 0;
-            int MaxX = Bitmap.Width;
-            int MaxY = Bitmap.Height;
-
-            b32 IteratedOnce = false;
-            for(int Iteration = 0;
-                ;
-                Iteration++)
-            {   
-                b32 Changed = false;
-
-                u8 *Row = (u8 *)GetBitmapPtr(Bitmap, MinX, MinY);
-                u8 *PrevClusterIndexRow = (u8 *)GetBitmapPtr(PrevClusterIndexBuffer, MinX, MinY);
-                for(int Y = MinY;
-                    Y < MaxY;
-                    Y++)
+                // NOTE: Gray levels have an exact solution, so no restarts
+                if(IndexedColors.Grayscale && (Points.Observations.Count > Context->ClusterCount))
+                {
+                    Clustered = RunGrayscaleKMeans(Context, &Points);
+                }
+                else
+                {
+                    Clustered = RunIndexedKMeans(Context, &Points, Config.Seed,
+                                                 ((Config.Engine == KMeansEngine_Lloyd) ?
+                                                  Config.RestartCount : 1));
+                }
+            }
+            free(Points.Observations.X);
+            free(Points.Observations.Y);
+            free(Points.Observations.Z);
+            free(Points.Weights);
+        }
+        else if(Context->Clusters &&
+                Loaded &&
+                Palette.Memory)
+        {
+            switch(Config.Engine)
+            {
+                case KMeansEngine_Lloyd:
                 {
-                    u32 *TexelPtr = (u32 *)Row;
-                    u32 *PrevClusterIndexPtr = (u32 *)PrevClusterIndexRow;
-                    for(int X = MinX;
-                        X < MaxX;
-                        X++)
+                    // The conversion happens once here instead of on every
+                    // iteration, and all restarts share it
+                    observation_buffer Observations = ConvertBitmapToObservations(Bitmap, DistanceScale);
+                    if(Observations.X && Observations.Y && Observations.Z)
                     {
-                        v3 TexelV3 = UnpackRGBAToCIELAB(*TexelPtr);
-                        u32 ClusterIndex = AssignObservation(Context, TexelV3);
+                        b32 Seeded = false;
+                        if(Config.Init != KMeansInit_Random)
+                        {
+                            // NOTE: The sweep only seeds its smallest count
+                            Context->ClusterCount = (Config.AutoClusterCount ?
+                                                     Config.MinClusterCount : Config.ClusterCount);
+                            random_series Entropy = SeedSeries(Config.Seed);
+                            switch(Config.Init)
+                            {
+                                case KMeansInit_Octree:
+                                {
+                                    Seeded = SeedClustersFromOctree(Context, Bitmap, &Observations,
+                                                                    Config.ColorSpace, DistanceScale,
+                                                                    &Entropy);
+                                } break;
+
+                                case KMeansInit_MedianCut:
+                                {
+                                    Seeded = SeedClustersByMedianCut(Context, &Observations,
+                                                                     Bitmap.Width, Bitmap.Height,
+                                                                     &Entropy);
+                                } break;
 
-                        if(Iteration > 0)
+                                InvalidDefaultCase;
+                            }
+                        }
+
+                        if(Config.AutoClusterCount)
                         {
-                            u32 PrevClusterIndex = *PrevClusterIndexPtr;
-                            if(ClusterIndex != PrevClusterIndex)
+                            int ClusterCount = RunClusterCountSweep(Context, &Observations,
+                                                                    Bitmap.Width, Bitmap.Height,
+                                                                    Config.Seed, Config.RestartCount,
+                                                                    Config.MinClusterCount,
+                                                                    Config.MaxClusterCount,
+                                                                    Config.ClusterCountCriterion,
+                                                                    Seeded, &Queue);
+                            if(ClusterCount)
                             {
-                                Changed = true;
+                                printf("Picked %d clusters\n", ClusterCount);
+                                Clustered = true;
                             }
                         }
-                        *PrevClusterIndexPtr = ClusterIndex;
+                        else
+                        {
+                            Clustered = RunLloydKMeansWithRestarts(Context, &Observations,
+                                                                   Bitmap.Width, Bitmap.Height,
+                                                                   Config.Seed, Config.RestartCount,
+                                                                   Seeded, &Queue);
+                        }
+                    }
+                } break;
 
-                        TexelPtr++;
-                        PrevClusterIndexPtr++;
+                case KMeansEngine_Bisecting:
+                {
+                    observation_buffer Observations = ConvertBitmapToObservations(Bitmap, DistanceScale);
+                    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations.Count);
+                    palette_tree Tree = AllocatePaletteTree(Context->ClusterCount);
+                    if(Observations.X && Observations.Y && Observations.Z &&
+                       ClusterIndices && Tree.Nodes)
+                    {
+                        BuildPaletteTree(&Tree, &Observations, ClusterIndices);
+                        GetPaletteTreeClusters(&Tree, Tree.Size, Context);
+                        if(Config.TreePath)
+                        {
+                            ExportPaletteTree(&Tree, Config.ColorSpace, Config.SortType,
+                                              DistanceScale, Config.TreePath);
+                        }
+                        Clustered = true;
                     }
+                } break;
 
-                    Row += Bitmap.Pitch;
-                    PrevClusterIndexRow += PrevClusterIndexBuffer.Pitch;
-                }
+                case KMeansEngine_Wu:
+                {
+                    observation_buffer Observations = ConvertBitmapToObservations(Bitmap, DistanceScale);
+                    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations.Count);
+                    if(Observations.X && Observations.Y && Observations.Z &&
+                       ClusterIndices)
+                    {
+                        Clustered = (RunWuQuantizer(Context, Bitmap, &Observations,
+                                                    Config.RefinementPassCount, ClusterIndices) > 0);
+                    }
+                } break;
 
-                if(Iteration == 0)
-                {   
-                    RecalculateCentroids(Context);
-                }             
-                else
-                {    
-                    if(Changed)
+                case KMeansEngine_Octree:
+                {
+                    // NOTE: Already done if the source was streamed
+                    Clustered = StreamedOctree;
+                    if(!Clustered)
                     {
-                        RecalculateCentroids(Context);
+                        Clustered = (RunOctreeQuantizer(Context, Bitmap, Config.ColorSpace,
+                                                        DistanceScale) > 0);
                     }
-                    else
+                } break;
+
+                case KMeansEngine_Histogram:
+                {
+                    if(!Histogram)
                     {
-                        break;
+                        Histogram = BuildColorHistogram(Bitmap, ThreadCount, &Queue);
                     }
-                }
-            }
-      
-            SortClustersByCentroid(Context, Config.SortType);
-            
-            u8 *ScanLine = (u8 *)malloc(sizeof(u32)*PaletteWidth);
-            
-            int TotalObservationCount = ComputeTotalObservationCount(Context);
-            u32 *Row = (u32 *)ScanLine;
-            for(int ClusterIndex = 0;
-                ClusterIndex < Context->ClusterCount;
-                ClusterIndex++)
-            {
-                cluster *Cluster = Context->Clusters + ClusterIndex;
+                    if(Histogram)
+                    {
+                        histogram_points Points = ConvertHistogramToPoints(Histogram, Config.ColorSpace,
+                                                                           DistanceScale);
+                        if(Points.Observations.X && Points.Observations.Y && Points.Observations.Z &&
+                           Points.Weights)
+                        {
+                            random_series Entropy = SeedSeries(Config.Seed);
+                            Clustered = RunHistogramKMeans(Context, &Points, &Entropy);
+                        }
+                    }
+                } break;
 
-                f32 Weight = SafeRatio0((f32)Cluster->ObservationCount,
-                                        (f32)TotalObservationCount);
-                int ClusterPixelWidth = RoundToInt(Weight*PaletteWidth);
+                case KMeansEngine_MiniBatch:
+                {
+                    random_series Entropy = SeedSeries(Config.Seed);
+                    Clustered = (RunMiniBatchKMeans(Context, Bitmap, DistanceScale,
+                                                    Config.BatchSize, &Entropy) > 0);
+                } break;
 
-                u32 CentroidColor = PackCIELABToRGBA(Cluster->Centroid);
-                while(ClusterPixelWidth--)
+                case KMeansEngine_Tiled:
                 {
-                    *Row++ = CentroidColor;
-                }
+                    // NOTE: Lloyd on the 100px copy first, seeded like any
+                    // single run, so the passes over every texel only refine
+                    bitmap Coarse = ScaleFrames(Bitmap, FrameTexelCounts ? 1 : FrameCount, MaxResizedDim);
+                    observation_buffer Observations = ConvertBitmapToObservations(Coarse, DistanceScale);
+                    if(Coarse.Memory &&
+                       Observations.X && Observations.Y && Observations.Z &&
+                       RunLloydKMeansWithRestarts(Context, &Observations,
+                                                  Coarse.Width, Coarse.Height,
+                                                  Config.Seed, 1, false, &Queue))
+                    {
+                        Clustered = (RunTiledKMeans(Context, Bitmap, DistanceScale, &Queue) > 0);
+                    }
+                    free(Coarse.Memory);
+                    free(Observations.X);
+                    free(Observations.Y);
+                    free(Observations.Z);
+                } break;
+
+                InvalidDefaultCase;
             }
-            
-            u8 *DestRow = (u8 *)Palette.Memory;
-            for(int Y = 0;
-                Y < PaletteHeight;
-                Y++)
-            {
-                u32 *SourceTexelPtr = (u32 *)ScanLine;
-                u32 *DestTexelPtr = (u32 *)DestRow;
-                for(int X = 0;
-                    X < PaletteWidth;
-                    X++)
-                {
-                    *DestTexelPtr++ = *SourceTexelPtr++;
-                }
-                
-                DestRow += Palette.Pitch;
+        }
+        free(Histogram);
+
+        if(Clustered)
+        {
+            if(Config.FramesPath)
+            {
+                ExportFramePalettes(Context, Bitmap, FrameCount, FrameTexelCounts, Config.ColorSpace,
+                                    Config.SortType, DistanceScale, &Queue, Config.FramesPath);
             }
-            
+
+            UnweightCentroids(Context, DistanceScale);
+            SortClustersByCentroid(Context, Config.SortType, Config.ColorSpace);
+            RenderPalette(Context, Config.ColorSpace, Palette, 0, PaletteHeight);
+
             ExportBMP(Palette, Config.DestPath);
         }
         else
@@ -499,7 +1734,28 @@ main(int ArgCount, char **Args)
     }
     else
     {
-        fprintf(stderr, "Usage: %s [source path] [cluster count] [seed] [sort type] [dest path]\n", Args[0]);
+        fprintf(stderr, "Usage: %s [source path] [cluster count] [seed] [sort type] [dest path] [options]\n", Args[0]);
+        fprintf(stderr, "Options:\n");
+        fprintf(stderr, "  space=cielab|oklab|linear|ycbcr  color space to cluster in (default cielab)\n");
+        fprintf(stderr, "  weights=X,Y,Z                    per-channel distance weights (default 1,1,1)\n");
+        fprintf(stderr, "  alpha=N                          leave out texels with an alpha below N, 0-255, except\n");
+        fprintf(stderr, "                                   in sequence mode (default %d)\n", DEFAULT_ALPHA_THRESHOLD);
+        fprintf(stderr, "  engine=lloyd|minibatch|bisecting|wu|octree|histogram|tiled\n");
+        fprintf(stderr, "                                   clustering engine (default lloyd)\n");
+        fprintf(stderr, "  tree=PATH                        bisecting only, also export the palette for every size\n");
+        fprintf(stderr, "  frames=PATH                      animated GIF only, also export a palette for every frame\n");
+        fprintf(stderr, "  refine=N                         wu only, Lloyd passes after the box cuts (default 0)\n");
+        fprintf(stderr, "  batch=N                          mini-batch size (default %d)\n", DEFAULT_MINI_BATCH_SIZE);
+        fprintf(stderr, "  init=random|octree|mediancut     lloyd only, how the first run is seeded (default random)\n");
+        fprintf(stderr, "  restarts=N                       parallel Lloyd runs, lowest inertia wins (default 1)\n");
+        fprintf(stderr, "  kmin=N kmax=N                    cluster counts tried when [cluster count] is auto (default 2-16)\n");
+        fprintf(stderr, "  criterion=elbow|silhouette       how auto picks the cluster count (default elbow)\n");
+        fprintf(stderr, "  sequence=y4m|rgba                read frames from [source path] (- for stdin) and write\n");
+        fprintf(stderr, "                                   one palette per line to [dest path] (default palettes.txt)\n");
+        fprintf(stderr, "  size=WxH                         rgba sequences only, the frame size\n");
+        fprintf(stderr, "  skip=F                           keep the last palette while less than this fraction of\n");
+        fprintf(stderr, "                                   texels changed color (default 0.01)\n");
+        fprintf(stderr, "Run %s --selftest to check the SIMD kernels against the scalar reference\n", Args[0]);
     }
     
     return(0);
@@ -17,20 +17,26 @@
 #define Minimum(A, B) ((A) < (B) ? (A) : (B))
 
 typedef int32_t s32;
+typedef int64_t s64;
 typedef s32 b32;
 
 typedef uint8_t u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
+typedef uint64_t u64;
 
 typedef uintptr_t umm;
 
 typedef float f32;
+typedef double f64;
 
 #include "palettize_math.h"
 #include "palettize_random.h"
 #include "palettize_string.h"
 #include "palettize_time.h"
+#include "palettize_file.h"
+#include "palettize_cpu.h"
+#include "palettize_threads.h"
 
 enum sort_type
 {
@@ -40,16 +46,104 @@ enum sort_type
     SortType_Blue,
 };
 
+enum color_space
+{
+    ColorSpace_CIELAB,
+    ColorSpace_Oklab,
+    ColorSpace_LinearRGB,
+    ColorSpace_YCbCr,
+
+    ColorSpace_Count,
+};
+
+enum cluster_count_criterion
+{
+    ClusterCountCriterion_Elbow,
+    ClusterCountCriterion_Silhouette,
+};
+
+enum kmeans_engine
+{
+    KMeansEngine_Lloyd,
+    KMeansEngine_MiniBatch,
+    KMeansEngine_Bisecting,
+    KMeansEngine_Wu,
+    KMeansEngine_Octree,
+    KMeansEngine_Histogram,
+    KMeansEngine_Tiled,
+};
+
+// NOTE: Where the Lloyd loop's first centroids come from
+enum kmeans_init
+{
+    KMeansInit_Random,
+    KMeansInit_Octree,
+    KMeansInit_MedianCut,
+};
+
+// NOTE: Frame sequences are read from a stream instead of a single image
+enum sequence_format
+{
+    SequenceFormat_None,
+    SequenceFormat_Y4M,
+    SequenceFormat_RGBA,
+};
+
+#define MAX_CLUSTER_COUNT 4096
+#define DEFAULT_ALPHA_THRESHOLD 128
 struct palettize_config
 {
     char *SourcePath;
     int ClusterCount;
+    // NOTE: With AutoClusterCount set, every count from MinClusterCount to
+    // MaxClusterCount is tried and ClusterCount is just the largest of them
+    b32 AutoClusterCount;
+    int MinClusterCount;
+    int MaxClusterCount;
+    cluster_count_criterion ClusterCountCriterion;
     u32 Seed;
     sort_type SortType;
     char *DestPath;
+
+    color_space ColorSpace;
+    // NOTE: Per-channel weights of the squared distance. They're applied by
+    // scaling each observation by their square root up front, so the
+    // assignment kernels stay plain squared Euclidean.
+    v3 ChannelWeights;
+    // NOTE: Texels with an alpha below this (out of 255) are left out before
+    // any engine sees them, 0 keeps everything
+    int AlphaThreshold;
+
+    kmeans_engine Engine;
+    // NOTE: Only used by the Lloyd engine. With anything but random seeding,
+    // the first restart starts from those centroids and the others are still
+    // seeded randomly.
+    kmeans_init Init;
+    // NOTE: Only used by the mini-batch engine
+    int BatchSize;
+    // NOTE: Number of independently seeded Lloyd runs, the one with the
+    // lowest inertia wins
+    int RestartCount;
+    // NOTE: Only used by the bisecting engine
+    char *TreePath;
+    // NOTE: Only used by the Wu engine
+    int RefinementPassCount;
+    // NOTE: Only used with an animated GIF source, which always gets one
+    // palette over all of its frames. This also exports one per frame.
+    char *FramesPath;
+
+    // NOTE: With a sequence format, SourcePath is a stream of frames ("-" for
+    // stdin) and DestPath gets one palette record per frame. Raw RGBA has no
+    // header, so its frame size has to be given.
+    sequence_format SequenceFormat;
+    int SequenceWidth;
+    int SequenceHeight;
+    // NOTE: A frame whose color histogram differs from the last clustered
+    // one by less than this fraction of its texels keeps that palette
+    f32 SkipThreshold;
 };
 
-#define GetBitmapPtr(Bitmap, X, Y) ((u8 *)(Bitmap).Memory + (sizeof(u32)*(X)) + ((Y)*(Bitmap).Pitch))
+#define GetBitmapPtr(Bitmap, X, Y) ((u8 *)(Bitmap).Memory + (sizeof(u32)*(X)) + ((s64)(Y)*(Bitmap).Pitch))
 struct bitmap
 {
     void *Memory;
@@ -65,12 +159,103 @@ struct cluster
     v3 Centroid;
     
     v3 ObservationSum;
-    int ObservationCount;
+    s64 ObservationCount;
 };
+struct centroid_kd_tree;
 struct kmeans_context
 {
     int ClusterCount;
     cluster *Clusters;
+
+    // NOTE: Built by the k-d tree assignment kernel the first time it sees
+    // this context, 0 until then (see FreeKMeansContext)
+    centroid_kd_tree *KDTree;
+};
+
+// NOTE: Observations are converted to the configured color space once up front
+// and stored as separate X/Y/Z arrays so the kernels can load a full lane of
+// each component
+struct observation_buffer
+{
+    int Count;
+
+    f32 *X;
+    f32 *Y;
+    f32 *Z;
+};
+
+inline v3
+GetObservation(observation_buffer *Observations, int Index)
+{
+    Assert((0 <= Index) && (Index < Observations->Count));
+    v3 Result = V3(Observations->X[Index],
+                   Observations->Y[Index],
+                   Observations->Z[Index]);
+
+    return(Result);
+}
+
+#define CONVERT_TEXELS(name) void name(u32 *Texels, int Count, f32 *X, f32 *Y, f32 *Z)
+typedef CONVERT_TEXELS(convert_texels);
+
+// NOTE: Assigns observations [First, First + Count) to their closest cluster,
+// accumulating them into that cluster's sums and storing the cluster index
+// at the same position in ClusterIndices. Returns whether any index differs
+// from what was stored there before (only checked if DetectChanges is set).
+#define ASSIGN_OBSERVATIONS(name) b32 name(kmeans_context *Context, observation_buffer *Observations, int First, int Count, u32 *ClusterIndices, b32 DetectChanges)
+typedef ASSIGN_OBSERVATIONS(assign_observations);
+
+#define DOWNSAMPLE_ROW(name) void name(u32 *SourceRow, u32 *SampleXs, int Count, u32 *DestRow)
+typedef DOWNSAMPLE_ROW(downsample_row);
+
+// NOTE: Texels binned by the top 5 bits of each sRGB channel. The sums are of
+// linear RGB in 16-bit fixed point, kept as integers so they come out exact
+// no matter how many texels or in which order they're added.
+#define HISTOGRAM_BIN_COUNT (1 << 15)
+#define HISTOGRAM_LINEAR_ONE 65535
+struct color_histogram
+{
+    u64 Counts[HISTOGRAM_BIN_COUNT];
+    u64 LinearSums[HISTOGRAM_BIN_COUNT][3];
+};
+
+inline u32
+GetHistogramBin(u32 Texel)
+{
+    // NOTE: Red in the low bits, then green, then blue
+    u32 Result = (((Texel >> 3) & 0x001F) |
+                  ((Texel >> 6) & 0x03E0) |
+                  ((Texel >> 9) & 0x7C00));
+
+    return(Result);
+}
+
+#define ACCUMULATE_HISTOGRAM(name) void name(u32 *Texels, int Count, color_histogram *Histogram)
+typedef ACCUMULATE_HISTOGRAM(accumulate_histogram);
+
+enum transfer_function
+{
+    TransferFunction_Ft,
+    TransferFunction_InvFt,
+    TransferFunction_sRGBToLinearRGB,
+    TransferFunction_LinearRGBTosRGB,
+
+    TransferFunction_Count,
+};
+
+#define EVALUATE_TRANSFER_FUNCTION(name) void name(transfer_function Function, f32 *Values, int Count)
+typedef EVALUATE_TRANSFER_FUNCTION(evaluate_transfer_function);
+
+struct kernel_table
+{
+    isa_level ISALevel;
+    // NOTE: Observations the assignment kernel handles at once
+    int LaneWidth;
+
+    convert_texels *ConvertTexels;
+    assign_observations *AssignObservations;
+    downsample_row *DownsampleRow;
+    accumulate_histogram *AccumulateHistogram;
 };
 
 #pragma pack(push, 1)
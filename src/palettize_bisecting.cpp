@@ -0,0 +1,282 @@
+// NOTE: Bisecting k-means. Starting from one cluster holding every
+// observation, the cluster with the largest squared error is repeatedly split
+// in two by running 2-means on just its observations, seeded either side of
+// its mean along its principal axis. Each split only compares its
+// observations against 2 centroids, so a full run costs about
+// O(N log K) distance computations instead of Lloyd's O(N K) per iteration.
+//
+// Every intermediate set of clusters is kept in a tree, and the palette with
+// K colors is the set of nodes that exist after K - 1 splits, so one run
+// serves every palette size up to its maximum.
+
+// NOTE: A Gaussian's two halves have their means 0.8 standard deviations
+// either side of the center
+#define BISECT_SEED_OFFSET 0.8f
+#define MAX_BISECT_ITERATION_COUNT 32
+
+// NOTE: Nodes live in the order they were created. The root exists from a
+// palette size of 1, and the two children of the Nth split exist from N + 1,
+// which is also the size at which their parent stops being a palette entry.
+struct palette_tree_node
+{
+    cluster Cluster;
+    f32 SquaredError;
+    v3 PrincipalAxis;
+    f32 PrincipalVariance;
+
+    // NOTE: Range of the node's observations, which are kept contiguous by
+    // partitioning the buffer on every split
+    int First;
+    int Count;
+
+    int CreatedAtSize;
+    int SplitAtSize;
+};
+
+struct palette_tree
+{
+    int MaxSize;
+    int Size;
+
+    int NodeCount;
+    palette_tree_node *Nodes;
+};
+
+static palette_tree
+AllocatePaletteTree(int MaxSize)
+{
+    palette_tree Result = {};
+    Result.MaxSize = MaxSize;
+    Result.Nodes = (palette_tree_node *)malloc(sizeof(palette_tree_node)*(2*MaxSize - 1));
+
+    return(Result);
+}
+
+// NOTE: One pass over the node's observations for its mean, its squared
+// error and the principal axis of its covariance (by power iteration)
+static void
+MeasurePaletteTreeNode(palette_tree_node *Node, observation_buffer *Observations)
+{
+    f64 Sum[3] = {};
+    f64 Products[6] = {};
+    for(int Index = Node->First;
+        Index < (Node->First + Node->Count);
+        Index++)
+    {
+        f64 X = Observations->X[Index];
+        f64 Y = Observations->Y[Index];
+        f64 Z = Observations->Z[Index];
+        Sum[0] += X;
+        Sum[1] += Y;
+        Sum[2] += Z;
+        Products[0] += X*X;
+        Products[1] += X*Y;
+        Products[2] += X*Z;
+        Products[3] += Y*Y;
+        Products[4] += Y*Z;
+        Products[5] += Z*Z;
+    }
+
+    f64 InvCount = 1.0 / (f64)Maximum(Node->Count, 1);
+    f64 Mean[3] = {Sum[0]*InvCount, Sum[1]*InvCount, Sum[2]*InvCount};
+    f32 XX = (f32)(Products[0]*InvCount - Mean[0]*Mean[0]);
+    f32 XY = (f32)(Products[1]*InvCount - Mean[0]*Mean[1]);
+    f32 XZ = (f32)(Products[2]*InvCount - Mean[0]*Mean[2]);
+    f32 YY = (f32)(Products[3]*InvCount - Mean[1]*Mean[1]);
+    f32 YZ = (f32)(Products[4]*InvCount - Mean[1]*Mean[2]);
+    f32 ZZ = (f32)(Products[5]*InvCount - Mean[2]*Mean[2]);
+
+    Node->Cluster.Centroid = V3((f32)Mean[0], (f32)Mean[1], (f32)Mean[2]);
+    Node->Cluster.ObservationSum = V3((f32)Sum[0], (f32)Sum[1], (f32)Sum[2]);
+    Node->Cluster.ObservationCount = Node->Count;
+    Node->SquaredError = Maximum(XX + YY + ZZ, 0.0f)*(f32)Node->Count;
+
+    // NOTE: Starting from the widest channel keeps the iteration away from
+    // being orthogonal to the principal axis
+    m3x3 Covariance;
+    Covariance.XAxis = V3(XX, XY, XZ);
+    Covariance.YAxis = V3(XY, YY, YZ);
+    Covariance.ZAxis = V3(XZ, YZ, ZZ);
+    v3 Axis = ((XX >= YY) && (XX >= ZZ)) ? V3(1.0f, 0.0f, 0.0f) :
+        ((YY >= ZZ) ? V3(0.0f, 1.0f, 0.0f) : V3(0.0f, 0.0f, 1.0f));
+    f32 Variance = 0.0f;
+    for(int Iteration = 0;
+        Iteration < 16;
+        Iteration++)
+    {
+        v3 Next = Covariance*Axis;
+        Variance = SquareRoot(LengthSquared(Next));
+        if(Variance <= 0.0f)
+        {
+            break;
+        }
+        Axis = Next*(1.0f / Variance);
+    }
+
+    Node->PrincipalAxis = Axis;
+    Node->PrincipalVariance = Variance;
+}
+
+// NOTE: Runs 2-means over the node's observations and partitions them so the
+// two halves are contiguous. Returns false (and leaves the node alone) if
+// every observation ended up on the same side.
+static b32
+BisectPaletteTreeNode(palette_tree_node *Node, observation_buffer *Observations,
+                      u32 *ClusterIndices, palette_tree_node *Children)
+{
+    b32 Result = false;
+
+    v3 Offset = Node->PrincipalAxis*(BISECT_SEED_OFFSET*SquareRoot(Node->PrincipalVariance));
+
+    cluster Halves[2];
+    kmeans_context Context;
+    Context.ClusterCount = 2;
+    Context.Clusters = Halves;
+    Context.KDTree = 0;
+    Halves[0].Centroid = Node->Cluster.Centroid - Offset;
+    Halves[1].Centroid = Node->Cluster.Centroid + Offset;
+    ClearObservations(Halves + 0);
+    ClearObservations(Halves + 1);
+
+    for(int Iteration = 0;
+        ;
+        Iteration++)
+    {
+        b32 Changed = Kernels.AssignObservations(&Context, Observations, Node->First, Node->Count,
+                                                 ClusterIndices, (Iteration > 0));
+        if(((Iteration > 0) && !Changed) ||
+           (Iteration == (MAX_BISECT_ITERATION_COUNT - 1)))
+        {
+            break;
+        }
+
+        RecalculateCentroids(&Context);
+    }
+
+    if(Halves[0].ObservationCount && Halves[1].ObservationCount)
+    {
+        // NOTE: Everything assigned to the first half goes to the front
+        int Left = Node->First;
+        int Right = Node->First + Node->Count - 1;
+        for(;;)
+        {
+            while((Left <= Right) && (ClusterIndices[Left] == 0))
+            {
+                Left++;
+            }
+            while((Left <= Right) && (ClusterIndices[Right] == 1))
+            {
+                Right--;
+            }
+            if(Left >= Right)
+            {
+                break;
+            }
+
+            f32 SwapX = Observations->X[Left];
+            f32 SwapY = Observations->Y[Left];
+            f32 SwapZ = Observations->Z[Left];
+            Observations->X[Left] = Observations->X[Right];
+            Observations->Y[Left] = Observations->Y[Right];
+            Observations->Z[Left] = Observations->Z[Right];
+            Observations->X[Right] = SwapX;
+            Observations->Y[Right] = SwapY;
+            Observations->Z[Right] = SwapZ;
+            ClusterIndices[Left] = 0;
+            ClusterIndices[Right] = 1;
+        }
+
+        Children[0].First = Node->First;
+        Children[0].Count = (int)Halves[0].ObservationCount;
+        Children[1].First = Node->First + Children[0].Count;
+        Children[1].Count = (int)Halves[1].ObservationCount;
+        Assert(Left == Children[1].First);
+
+        for(int ChildIndex = 0;
+            ChildIndex < 2;
+            ChildIndex++)
+        {
+            MeasurePaletteTreeNode(Children + ChildIndex, Observations);
+        }
+
+        Result = true;
+    }
+
+    return(Result);
+}
+
+// NOTE: Reorders Observations. Stops early if no node can be split any
+// further, so Tree->Size can come out below Tree->MaxSize.
+static void
+BuildPaletteTree(palette_tree *Tree, observation_buffer *Observations, u32 *ClusterIndices)
+{
+    palette_tree_node *Root = Tree->Nodes;
+    Root->First = 0;
+    Root->Count = Observations->Count;
+    Root->CreatedAtSize = 1;
+    Root->SplitAtSize = 0;
+    MeasurePaletteTreeNode(Root, Observations);
+
+    Tree->NodeCount = 1;
+    Tree->Size = 1;
+    while(Tree->Size < Tree->MaxSize)
+    {
+        palette_tree_node *Widest = 0;
+        for(int NodeIndex = 0;
+            NodeIndex < Tree->NodeCount;
+            NodeIndex++)
+        {
+            palette_tree_node *Node = Tree->Nodes + NodeIndex;
+            if(!Node->SplitAtSize &&
+               (Node->Count > 1) &&
+               (Node->SquaredError > 0.0f) &&
+               (!Widest || (Node->SquaredError > Widest->SquaredError)))
+            {
+                Widest = Node;
+            }
+        }
+
+        if(!Widest)
+        {
+            break;
+        }
+
+        palette_tree_node *Children = Tree->Nodes + Tree->NodeCount;
+        if(BisectPaletteTreeNode(Widest, Observations, ClusterIndices, Children))
+        {
+            Tree->Size++;
+            Tree->NodeCount += 2;
+
+            Widest->SplitAtSize = Tree->Size;
+            Children[0].CreatedAtSize = Children[1].CreatedAtSize = Tree->Size;
+            Children[0].SplitAtSize = Children[1].SplitAtSize = 0;
+        }
+        else
+        {
+            // NOTE: Never picked again
+            Widest->SquaredError = 0.0f;
+        }
+    }
+}
+
+// NOTE: Copies the clusters of the palette with Size colors into Context,
+// which needs room for at least that many
+static void
+GetPaletteTreeClusters(palette_tree *Tree, int Size, kmeans_context *Context)
+{
+    Assert((1 <= Size) && (Size <= Tree->Size));
+
+    Context->ClusterCount = 0;
+    for(int NodeIndex = 0;
+        NodeIndex < Tree->NodeCount;
+        NodeIndex++)
+    {
+        palette_tree_node *Node = Tree->Nodes + NodeIndex;
+        if((Node->CreatedAtSize <= Size) &&
+           (!Node->SplitAtSize || (Node->SplitAtSize > Size)))
+        {
+            Context->Clusters[Context->ClusterCount++] = Node->Cluster;
+        }
+    }
+    Assert(Context->ClusterCount == Size);
+}
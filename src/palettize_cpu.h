@@ -0,0 +1,175 @@
+#if !defined(PALETTIZE_CPU_H)
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define PALETTIZE_X86 1
+#else
+#define PALETTIZE_X86 0
+#endif
+
+#if PALETTIZE_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+// NOTE: MSVC lets any function use any intrinsic, so only GCC and Clang need
+// to be told which instruction sets a block of kernel code is allowed to use
+#define PALETTIZE_PRAGMA(X) _Pragma(#X)
+#if defined(__clang__)
+#define BEGIN_TARGET(Target) PALETTIZE_PRAGMA(clang attribute push(__attribute__((target(Target))), apply_to = function))
+#define END_TARGET PALETTIZE_PRAGMA(clang attribute pop)
+#elif defined(__GNUC__)
+#define BEGIN_TARGET(Target) PALETTIZE_PRAGMA(GCC push_options) PALETTIZE_PRAGMA(GCC target(Target))
+#define END_TARGET PALETTIZE_PRAGMA(GCC pop_options)
+#else
+#define BEGIN_TARGET(Target)
+#define END_TARGET
+#endif
+
+enum isa_level
+{
+    ISALevel_Scalar,
+    ISALevel_SSE41,
+    ISALevel_AVX2,
+    ISALevel_AVX512,
+
+    ISALevel_Count,
+};
+
+static char *ISALevelNames[] =
+{
+    "scalar",
+    "sse41",
+    "avx2",
+    "avx512",
+};
+
+#if PALETTIZE_X86
+inline void
+CPUID(u32 Leaf, u32 SubLeaf, u32 *Registers)
+{
+#if defined(_MSC_VER)
+    __cpuidex((int *)Registers, (int)Leaf, (int)SubLeaf);
+#else
+    __cpuid_count(Leaf, SubLeaf, Registers[0], Registers[1], Registers[2], Registers[3]);
+#endif
+}
+
+inline u32
+GetEnabledXSaveFeatures(void)
+{
+#if defined(_MSC_VER)
+    u32 Result = (u32)_xgetbv(0);
+#else
+    u32 EAX;
+    u32 EDX;
+    __asm__ volatile("xgetbv" : "=a"(EAX), "=d"(EDX) : "c"(0));
+    u32 Result = EAX;
+#endif
+
+    return(Result);
+}
+#endif
+
+inline isa_level
+DetectISALevel(void)
+{
+    isa_level Result = ISALevel_Scalar;
+
+#if PALETTIZE_X86
+    u32 Leaf0[4];
+    CPUID(0, 0, Leaf0);
+    u32 MaxLeaf = Leaf0[0];
+
+    u32 Leaf1[4];
+    CPUID(1, 0, Leaf1);
+    u32 Leaf7[4] = {};
+    if(MaxLeaf >= 7)
+    {
+        CPUID(7, 0, Leaf7);
+    }
+
+    b32 HasSSE41 = (Leaf1[2] >> 19) & 1;
+    b32 HasFMA = (Leaf1[2] >> 12) & 1;
+    b32 HasOSXSave = (Leaf1[2] >> 27) & 1;
+    b32 HasAVX = (Leaf1[2] >> 28) & 1;
+    b32 HasAVX2 = (Leaf7[1] >> 5) & 1;
+    b32 HasAVX512F = (Leaf7[1] >> 16) & 1;
+    b32 HasAVX512DQ = (Leaf7[1] >> 17) & 1;
+    b32 HasAVX512CD = (Leaf7[1] >> 28) & 1;
+    b32 HasAVX512BW = (Leaf7[1] >> 30) & 1;
+    b32 HasAVX512VL = (Leaf7[1] >> 31) & 1;
+
+    // The CPU supporting AVX is not enough, the OS also has to save the
+    // wider registers on context switches
+    u32 XSaveFeatures = HasOSXSave ? GetEnabledXSaveFeatures() : 0;
+    b32 OSSavesYMM = ((XSaveFeatures & 0x06) == 0x06);
+    b32 OSSavesZMM = ((XSaveFeatures & 0xE6) == 0xE6);
+
+    if(HasSSE41)
+    {
+        Result = ISALevel_SSE41;
+    }
+    if(HasSSE41 && HasAVX && HasAVX2 && HasFMA && OSSavesYMM)
+    {
+        Result = ISALevel_AVX2;
+    }
+    if((Result == ISALevel_AVX2) &&
+       HasAVX512F && HasAVX512DQ && HasAVX512CD && HasAVX512BW && HasAVX512VL &&
+       OSSavesZMM)
+    {
+        Result = ISALevel_AVX512;
+    }
+#endif
+
+    return(Result);
+}
+
+// NOTE: PALETTIZE_ISA=scalar|sse41|avx2|avx512 forces a specific kernel path
+// for testing. Requests above what the CPU supports are clamped down to the
+// detected level rather than crashing on an illegal instruction.
+inline isa_level
+SelectISALevel(void)
+{
+    isa_level Detected = DetectISALevel();
+    isa_level Result = Detected;
+
+    char *Override = getenv("PALETTIZE_ISA");
+    if(Override)
+    {
+        b32 Found = false;
+        for(int LevelIndex = 0;
+            LevelIndex < ISALevel_Count;
+            LevelIndex++)
+        {
+            if(StringsMatch(Override, ISALevelNames[LevelIndex], false))
+            {
+                Found = true;
+                Result = (isa_level)LevelIndex;
+            }
+        }
+
+        if(!Found)
+        {
+            fprintf(stderr, "Warning: unknown PALETTIZE_ISA \"%s\", using %s\n",
+                    Override, ISALevelNames[Detected]);
+        }
+        else if(Result > Detected)
+        {
+            fprintf(stderr, "Warning: CPU does not support %s, using %s\n",
+                    ISALevelNames[Result], ISALevelNames[Detected]);
+            Result = Detected;
+        }
+    }
+
+    return(Result);
+}
+
+#define PALETTIZE_CPU_H
+#endif
@@ -0,0 +1,35 @@
+#if !defined(PALETTIZE_FILE_H)
+
+#include <stdio.h>
+
+// NOTE: fseek and ftell take a long, which is 32 bits on Windows even in a
+// 64-bit build, so they can't reach past 2GB there. These go through the
+// 64-bit versions instead.
+
+inline b32
+SeekFile(FILE *File, s64 Offset, int Origin)
+{
+#if defined(_WIN32)
+    b32 Result = (_fseeki64(File, Offset, Origin) == 0);
+#else
+    b32 Result = (fseeko(File, (off_t)Offset, Origin) == 0);
+#endif
+
+    return(Result);
+}
+
+// NOTE: Returns -1 on failure, like ftell
+inline s64
+TellFile(FILE *File)
+{
+#if defined(_WIN32)
+    s64 Result = _ftelli64(File);
+#else
+    s64 Result = (s64)ftello(File);
+#endif
+
+    return(Result);
+}
+
+#define PALETTIZE_FILE_H
+#endif
@@ -0,0 +1,208 @@
+// NOTE: Exact k-means for grayscale sources. Every gray lands on one straight
+// line in all of the supported color spaces (the L axis of CIELAB and Oklab,
+// the Y axis of YCbCr, the diagonal of linear RGB), and the channel weights
+// only stretch that line, so the gray levels are really one-dimensional.
+// The optimal clustering of points on a line always splits it into runs of
+// neighbors, which dynamic programming over the at most 256 weighted levels
+// finds exactly. It's the global optimum Lloyd can only hope to land on.
+//
+// The table is filled one cluster count at a time. Where the last cluster
+// starts only ever moves right as the run it ends at does, so each row is
+// filled by divide and conquer over the runs, O(n log n) per cluster instead
+// of O(n^2).
+
+struct grayscale_dp
+{
+    int LevelCount;
+    f64 *WeightSums;
+    f64 *TSums;
+    f64 *TSquaredSums;
+
+    f64 *Previous;
+    f64 *Current;
+    u16 *Starts;
+};
+
+// NOTE: Weighted squared distance of the levels [First, Last] to their mean
+inline f64
+ComputeRunCost(grayscale_dp *DP, int First, int Last)
+{
+    f64 Weight = DP->WeightSums[Last + 1] - DP->WeightSums[First];
+    f64 T = DP->TSums[Last + 1] - DP->TSums[First];
+    f64 TSquared = DP->TSquaredSums[Last + 1] - DP->TSquaredSums[First];
+
+    f64 Result = TSquared - ((Weight > 0.0) ? (T*T / Weight) : 0.0);
+    if(Result < 0.0)
+    {
+        Result = 0.0;
+    }
+
+    return(Result);
+}
+
+// NOTE: Fills Current[Last] and Starts[Last] for every Last in
+// [FirstLast, LastLast], knowing their best starts lie in [MinStart, MaxStart]
+static void
+FillGrayscaleRow(grayscale_dp *DP, int ClusterIndex, int FirstLast, int LastLast,
+                 int MinStart, int MaxStart)
+{
+    if(FirstLast <= LastLast)
+    {
+        int Last = (FirstLast + LastLast) / 2;
+
+        // NOTE: The clusters before this one need a level each
+        int FirstStart = Maximum(MinStart, ClusterIndex);
+        int LastStart = Minimum(MaxStart, Last);
+
+        f64 BestCost = -1.0;
+        int BestStart = FirstStart;
+        for(int Start = FirstStart;
+            Start <= LastStart;
+            Start++)
+        {
+            f64 Cost = DP->Previous[Start - 1] + ComputeRunCost(DP, Start, Last);
+            if((BestCost < 0.0) || (Cost < BestCost))
+            {
+                BestCost = Cost;
+                BestStart = Start;
+            }
+        }
+
+        DP->Current[Last] = BestCost;
+        DP->Starts[ClusterIndex*DP->LevelCount + Last] = (u16)BestStart;
+
+        FillGrayscaleRow(DP, ClusterIndex, FirstLast, Last - 1, MinStart, BestStart);
+        FillGrayscaleRow(DP, ClusterIndex, Last + 1, LastLast, BestStart, MaxStart);
+    }
+}
+
+// NOTE: Points are the gray levels from ConvertIndexedColorsToPoints. There
+// have to be more of them than clusters, RunIndexedKMeans already covers
+// the rest. Returns false if it couldn't allocate.
+static b32
+RunGrayscaleKMeans(kmeans_context *Context, histogram_points *Points)
+{
+    b32 Result = false;
+
+    observation_buffer *Observations = &Points->Observations;
+    int LevelCount = Observations->Count;
+    int ClusterCount = Context->ClusterCount;
+    Assert((ClusterCount < LevelCount) && (LevelCount <= MAX_INDEXED_COLOR_COUNT));
+
+    // NOTE: The line runs from any level through the one farthest from it,
+    // and every level is placed on it by its projection. Direction isn't
+    // normalized, that scales every cost the same and moves no split.
+    v3 Origin = GetObservation(Observations, 0);
+    v3 Direction = V3i(0, 0, 0);
+    for(int Index = 1;
+        Index < LevelCount;
+        Index++)
+    {
+        v3 Offset = GetObservation(Observations, Index) - Origin;
+        if(LengthSquared(Offset) > LengthSquared(Direction))
+        {
+            Direction = Offset;
+        }
+    }
+
+    f64 Ts[MAX_INDEXED_COLOR_COUNT];
+    int Order[MAX_INDEXED_COLOR_COUNT];
+    for(int Index = 0;
+        Index < LevelCount;
+        Index++)
+    {
+        Ts[Index] = Dot(GetObservation(Observations, Index) - Origin, Direction);
+
+        // NOTE: Insertion sort, there are at most 256
+        int Position = Index;
+        while((Position > 0) && (Ts[Order[Position - 1]] > Ts[Index]))
+        {
+            Order[Position] = Order[Position - 1];
+            Position--;
+        }
+        Order[Position] = Index;
+    }
+
+    grayscale_dp DP = {};
+    DP.LevelCount = LevelCount;
+    DP.WeightSums = (f64 *)malloc(sizeof(f64)*(LevelCount + 1));
+    DP.TSums = (f64 *)malloc(sizeof(f64)*(LevelCount + 1));
+    DP.TSquaredSums = (f64 *)malloc(sizeof(f64)*(LevelCount + 1));
+    DP.Previous = (f64 *)malloc(sizeof(f64)*LevelCount);
+    DP.Current = (f64 *)malloc(sizeof(f64)*LevelCount);
+    DP.Starts = (u16 *)malloc(sizeof(u16)*ClusterCount*LevelCount);
+    if(DP.WeightSums && DP.TSums && DP.TSquaredSums &&
+       DP.Previous && DP.Current && DP.Starts)
+    {
+        DP.WeightSums[0] = 0.0;
+        DP.TSums[0] = 0.0;
+        DP.TSquaredSums[0] = 0.0;
+        for(int Level = 0;
+            Level < LevelCount;
+            Level++)
+        {
+            f64 Weight = (f64)Points->Weights[Order[Level]];
+            f64 T = Ts[Order[Level]];
+            DP.WeightSums[Level + 1] = DP.WeightSums[Level] + Weight;
+            DP.TSums[Level + 1] = DP.TSums[Level] + Weight*T;
+            DP.TSquaredSums[Level + 1] = DP.TSquaredSums[Level] + Weight*T*T;
+        }
+
+        for(int Last = 0;
+            Last < LevelCount;
+            Last++)
+        {
+            DP.Current[Last] = ComputeRunCost(&DP, 0, Last);
+            DP.Starts[Last] = 0;
+        }
+
+        for(int ClusterIndex = 1;
+            ClusterIndex < ClusterCount;
+            ClusterIndex++)
+        {
+            f64 *Swap = DP.Previous;
+            DP.Previous = DP.Current;
+            DP.Current = Swap;
+
+            FillGrayscaleRow(&DP, ClusterIndex, ClusterIndex, LevelCount - 1,
+                             ClusterIndex, LevelCount - 1);
+        }
+
+        // NOTE: Walks the runs back from the last level, and each cluster
+        // gets the plain weighted mean of its levels
+        int Last = LevelCount - 1;
+        for(int ClusterIndex = ClusterCount - 1;
+            ClusterIndex >= 0;
+            ClusterIndex--)
+        {
+            int Start = DP.Starts[ClusterIndex*LevelCount + Last];
+
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+            ClearObservations(Cluster);
+            for(int Level = Start;
+                Level <= Last;
+                Level++)
+            {
+                int Index = Order[Level];
+                s64 Weight = Points->Weights[Index];
+                Cluster->ObservationSum += GetObservation(Observations, Index)*(f32)Weight;
+                Cluster->ObservationCount += Weight;
+            }
+            Cluster->Centroid = Cluster->ObservationSum*(1.0f / (f32)Cluster->ObservationCount);
+
+            Last = Start - 1;
+        }
+        Assert(Last == -1);
+
+        Result = true;
+    }
+
+    free(DP.WeightSums);
+    free(DP.TSums);
+    free(DP.TSquaredSums);
+    free(DP.Previous);
+    free(DP.Current);
+    free(DP.Starts);
+
+    return(Result);
+}
@@ -0,0 +1,554 @@
+// NOTE: Histogram clustering. One pass over the texels bins them by the top 5
+// bits of each sRGB channel, then Lloyd runs on the mean color of every
+// occupied bin, weighted by how many texels fell into it. An iteration never
+// looks at more than HISTOGRAM_BIN_COUNT points, however big the image is, so
+// this engine gets the native resolution instead of the 100px copy.
+
+#define MAX_HISTOGRAM_SLICE_COUNT 64
+
+struct histogram_slice
+{
+    bitmap Bitmap;
+    int FirstY;
+    int OnePastLastY;
+
+    color_histogram *Histogram;
+};
+
+static
+WORK_QUEUE_CALLBACK(AccumulateHistogramSlice)
+{
+    histogram_slice *Slice = (histogram_slice *)Data;
+
+    for(int Y = Slice->FirstY;
+        Y < Slice->OnePastLastY;
+        Y++)
+    {
+        Kernels.AccumulateHistogram((u32 *)GetBitmapPtr(Slice->Bitmap, 0, Y), Slice->Bitmap.Width,
+                                    Slice->Histogram);
+    }
+}
+
+// NOTE: Sums the histograms of all slices into the first one and hands it
+// over, the caller frees it
+static color_histogram *
+MergeHistogramSlices(histogram_slice *Slices, int SliceCount)
+{
+    color_histogram *Result = Slices[0].Histogram;
+    Slices[0].Histogram = 0;
+    for(int SliceIndex = 1;
+        SliceIndex < SliceCount;
+        SliceIndex++)
+    {
+        color_histogram *Histogram = Slices[SliceIndex].Histogram;
+        for(int Bin = 0;
+            Bin < HISTOGRAM_BIN_COUNT;
+            Bin++)
+        {
+            Result->Counts[Bin] += Histogram->Counts[Bin];
+            Result->LinearSums[Bin][0] += Histogram->LinearSums[Bin][0];
+            Result->LinearSums[Bin][1] += Histogram->LinearSums[Bin][1];
+            Result->LinearSums[Bin][2] += Histogram->LinearSums[Bin][2];
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Every slice of rows goes into its own histogram so no two threads
+// ever touch the same bin, and they're summed at the end. Returns 0 if it
+// couldn't allocate the histograms, free the result otherwise.
+static color_histogram *
+BuildColorHistogram(bitmap Bitmap, int SliceCount, work_queue *Queue)
+{
+    SliceCount = Clampi(1, Minimum(SliceCount, Bitmap.Height), MAX_HISTOGRAM_SLICE_COUNT);
+
+    histogram_slice Slices[MAX_HISTOGRAM_SLICE_COUNT] = {};
+    b32 Allocated = true;
+    for(int SliceIndex = 0;
+        SliceIndex < SliceCount;
+        SliceIndex++)
+    {
+        histogram_slice *Slice = Slices + SliceIndex;
+        Slice->Bitmap = Bitmap;
+        Slice->FirstY = (int)(((s64)Bitmap.Height*SliceIndex) / SliceCount);
+        Slice->OnePastLastY = (int)(((s64)Bitmap.Height*(SliceIndex + 1)) / SliceCount);
+        Slice->Histogram = (color_histogram *)calloc(1, sizeof(color_histogram));
+        if(!Slice->Histogram)
+        {
+            Allocated = false;
+        }
+    }
+
+    color_histogram *Result = 0;
+    if(Allocated)
+    {
+        for(int SliceIndex = 0;
+            SliceIndex < SliceCount;
+            SliceIndex++)
+        {
+            AddEntry(Queue, AccumulateHistogramSlice, Slices + SliceIndex);
+        }
+        CompleteAllWork(Queue);
+
+        Result = MergeHistogramSlices(Slices, SliceCount);
+    }
+
+    for(int SliceIndex = 0;
+        SliceIndex < SliceCount;
+        SliceIndex++)
+    {
+        free(Slices[SliceIndex].Histogram);
+    }
+
+    return(Result);
+}
+
+// NOTE: One observation per occupied bin, in the configured color space and
+// weighted like the texel observations, plus how many texels it stands for
+struct histogram_points
+{
+    observation_buffer Observations;
+    s64 *Weights;
+    s64 TotalWeight;
+};
+
+static histogram_points
+ConvertHistogramToPoints(color_histogram *Histogram, color_space ColorSpace, v3 Scale)
+{
+    histogram_points Result = {};
+
+    int OccupiedCount = 0;
+    for(int Bin = 0;
+        Bin < HISTOGRAM_BIN_COUNT;
+        Bin++)
+    {
+        if(Histogram->Counts[Bin])
+        {
+            OccupiedCount++;
+        }
+    }
+
+    Result.Observations = AllocateObservationBuffer(OccupiedCount);
+    Result.Weights = (s64 *)malloc(sizeof(s64)*OccupiedCount);
+    if(Result.Observations.X && Result.Observations.Y && Result.Observations.Z &&
+       Result.Weights)
+    {
+        int Index = 0;
+        for(int Bin = 0;
+            Bin < HISTOGRAM_BIN_COUNT;
+            Bin++)
+        {
+            s64 Count = (s64)Histogram->Counts[Bin];
+            if(Count)
+            {
+                f64 InvSum = 1.0 / ((f64)Count*HISTOGRAM_LINEAR_ONE);
+                v3 LinearRGB = V3((f32)(Histogram->LinearSums[Bin][0]*InvSum),
+                                  (f32)(Histogram->LinearSums[Bin][1]*InvSum),
+                                  (f32)(Histogram->LinearSums[Bin][2]*InvSum));
+                v3 Color = Hadamard(LinearRGBToColor(ColorSpace, LinearRGB), Scale);
+
+                Result.Observations.X[Index] = Color.x;
+                Result.Observations.Y[Index] = Color.y;
+                Result.Observations.Z[Index] = Color.z;
+                Result.Weights[Index] = Count;
+                Result.TotalWeight += Count;
+                Index++;
+            }
+        }
+        Assert(Index == OccupiedCount);
+    }
+
+    return(Result);
+}
+
+// NOTE: The assignment kernels add every observation once, this redoes the
+// sums with each point counted as many times as it has texels
+static void
+ReweightClusters(kmeans_context *Context, histogram_points *Points, u32 *ClusterIndices)
+{
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        ClearObservations(Context->Clusters + ClusterIndex);
+    }
+
+    for(int Index = 0;
+        Index < Points->Observations.Count;
+        Index++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndices[Index];
+        s64 Weight = Points->Weights[Index];
+        Cluster->ObservationSum += GetObservation(&Points->Observations, Index)*(f32)Weight;
+        Cluster->ObservationCount += Weight;
+    }
+}
+
+// NOTE: Lloyd over the weighted points. Seeds are drawn with probability
+// proportional to weight, which is the same as sampling random texels.
+// Returns false if it couldn't allocate its buffers.
+static b32
+RunHistogramKMeans(kmeans_context *Context, histogram_points *Points, random_series *Entropy)
+{
+    observation_buffer *Observations = &Points->Observations;
+    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations->Count);
+    b32 Result = (ClusterIndices && Points->TotalWeight);
+    if(Result)
+    {
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+
+            ClearObservations(Cluster);
+
+            s64 Target = (s64)RandomU64Between(Entropy, 0, (u64)Points->TotalWeight);
+            int Index = 0;
+            while(Target >= Points->Weights[Index])
+            {
+                Target -= Points->Weights[Index++];
+            }
+
+            Cluster->Centroid = GetObservation(Observations, Index);
+        }
+
+        for(int Iteration = 0;
+            ;
+            Iteration++)
+        {
+            b32 Changed = Kernels.AssignObservations(Context, Observations, 0, Observations->Count,
+                                                     ClusterIndices, (Iteration > 0));
+            ReweightClusters(Context, Points, ClusterIndices);
+            if(((Iteration > 0) && !Changed) ||
+               ((Iteration + 1) >= MAX_LLOYD_ITERATION_COUNT))
+            {
+                break;
+            }
+
+            RecalculateCentroids(Context);
+        }
+    }
+
+    free(ClusterIndices);
+
+    return(Result);
+}
+
+// NOTE: Indexed sources. stb_image expands a paletted PNG or GIF to RGBA, so
+// rather than parse the color table, the distinct colors of the decoded texels
+// are counted directly, giving up as soon as there are more than a color table
+// can hold. That's the same as counting the indices, works for any truecolor
+// image that happens to use few colors, and costs a photo only the few texels
+// it takes to find 257 colors.
+
+#define MAX_INDEXED_COLOR_COUNT 256
+#define INDEXED_COLOR_SLOT_COUNT 1024
+
+struct indexed_colors
+{
+    int Count;
+    // NOTE: Every color has R = G = B
+    b32 Grayscale;
+    u32 Colors[MAX_INDEXED_COLOR_COUNT];
+    s64 Counts[MAX_INDEXED_COLOR_COUNT];
+
+    // NOTE: Open addressing, a slot holds its color's index plus one
+    u16 Slots[INDEXED_COLOR_SLOT_COUNT];
+};
+
+static void
+BeginIndexedColors(indexed_colors *Colors)
+{
+    Colors->Count = 0;
+    Colors->Grayscale = true;
+    for(int Slot = 0;
+        Slot < INDEXED_COLOR_SLOT_COUNT;
+        Slot++)
+    {
+        Colors->Slots[Slot] = 0;
+    }
+}
+
+// NOTE: Returns false once there are more than MAX_INDEXED_COLOR_COUNT
+// colors, after which Colors is no use and shouldn't get any more rows.
+// Alpha is ignored like everywhere else, every color is stored opaque.
+static b32
+AddIndexedColorRow(indexed_colors *Colors, u32 *Texels, int Count)
+{
+    b32 Result = true;
+
+    // NOTE: Runs of one color are the norm for this kind of image, so the
+    // last color found skips the lookup
+    u32 LastColor = 0;
+    int LastIndex = -1;
+    for(int X = 0;
+        X < Count;
+        X++)
+    {
+        u32 Color = Texels[X] | 0xFF000000;
+        if((LastIndex < 0) || (Color != LastColor))
+        {
+            u32 Slot = (Color*2654435761u) >> 22;
+            while(Colors->Slots[Slot] && (Colors->Colors[Colors->Slots[Slot] - 1] != Color))
+            {
+                Slot = (Slot + 1) & (INDEXED_COLOR_SLOT_COUNT - 1);
+            }
+
+            if(!Colors->Slots[Slot])
+            {
+                if(Colors->Count == MAX_INDEXED_COLOR_COUNT)
+                {
+                    Result = false;
+                    break;
+                }
+
+                u32 Red = Color & 0xFF;
+                u32 Green = (Color >> 8) & 0xFF;
+                u32 Blue = (Color >> 16) & 0xFF;
+                if((Red != Green) || (Red != Blue))
+                {
+                    Colors->Grayscale = false;
+                }
+
+                Colors->Colors[Colors->Count] = Color;
+                Colors->Counts[Colors->Count] = 0;
+                Colors->Slots[Slot] = (u16)(++Colors->Count);
+            }
+
+            LastColor = Color;
+            LastIndex = Colors->Slots[Slot] - 1;
+        }
+
+        Colors->Counts[LastIndex]++;
+    }
+
+    return(Result);
+}
+
+// NOTE: Returns false if the bitmap has more than MAX_INDEXED_COLOR_COUNT
+// colors
+static b32
+CountIndexedColors(bitmap Bitmap, indexed_colors *Result)
+{
+    b32 Indexed = true;
+
+    BeginIndexedColors(Result);
+    for(int Y = 0;
+        Indexed && (Y < Bitmap.Height);
+        Y++)
+    {
+        Indexed = AddIndexedColorRow(Result, (u32 *)GetBitmapPtr(Bitmap, 0, Y), Bitmap.Width);
+    }
+
+    return(Indexed);
+}
+
+// NOTE: Rows read from the stream go into a band, and every band is split
+// between the slices like a whole bitmap would be. Each slice keeps its
+// histogram from band to band, so the result is the same as building it
+// from the decoded image, with only the band in memory. Colors, if given,
+// gets every row too, and Indexed says whether it still fits.
+#define HISTOGRAM_STREAM_BAND_HEIGHT 32
+
+static color_histogram *
+StreamColorHistogram(image_stream *Stream, int SliceCount, work_queue *Queue,
+                     indexed_colors *Colors, b32 *Indexed)
+{
+    SliceCount = Clampi(1, SliceCount, MAX_HISTOGRAM_SLICE_COUNT);
+
+    bitmap Band = {};
+    Band.Width = Stream->Width;
+    Band.Height = HISTOGRAM_STREAM_BAND_HEIGHT;
+    Band.Pitch = Stream->Width*sizeof(u32);
+    Band.Memory = malloc(Band.Pitch*Band.Height);
+
+    histogram_slice Slices[MAX_HISTOGRAM_SLICE_COUNT] = {};
+    b32 Allocated = (Band.Memory != 0);
+    for(int SliceIndex = 0;
+        SliceIndex < SliceCount;
+        SliceIndex++)
+    {
+        Slices[SliceIndex].Histogram = (color_histogram *)calloc(1, sizeof(color_histogram));
+        if(!Slices[SliceIndex].Histogram)
+        {
+            Allocated = false;
+        }
+    }
+
+    *Indexed = (Colors != 0);
+    if(Colors)
+    {
+        BeginIndexedColors(Colors);
+    }
+
+    color_histogram *Result = 0;
+    if(Allocated)
+    {
+        b32 Complete = true;
+        while(Complete && (Stream->NextY < Stream->Height))
+        {
+            int BandHeight = Minimum(HISTOGRAM_STREAM_BAND_HEIGHT, Stream->Height - Stream->NextY);
+            for(int Y = 0;
+                Complete && (Y < BandHeight);
+                Y++)
+            {
+                u32 *Row = (u32 *)GetBitmapPtr(Band, 0, Y);
+                Complete = ReadImageStreamRow(Stream, Row);
+                if(Complete && *Indexed)
+                {
+                    *Indexed = AddIndexedColorRow(Colors, Row, Stream->Width);
+                }
+            }
+
+            if(Complete)
+            {
+                int BandSliceCount = Minimum(SliceCount, BandHeight);
+                for(int SliceIndex = 0;
+                    SliceIndex < BandSliceCount;
+                    SliceIndex++)
+                {
+                    histogram_slice *Slice = Slices + SliceIndex;
+                    Slice->Bitmap = Band;
+                    Slice->FirstY = (BandHeight*SliceIndex) / BandSliceCount;
+                    Slice->OnePastLastY = (BandHeight*(SliceIndex + 1)) / BandSliceCount;
+                    AddEntry(Queue, AccumulateHistogramSlice, Slice);
+                }
+                CompleteAllWork(Queue);
+            }
+        }
+
+        if(Complete)
+        {
+            Result = MergeHistogramSlices(Slices, SliceCount);
+        }
+    }
+
+    for(int SliceIndex = 0;
+        SliceIndex < SliceCount;
+        SliceIndex++)
+    {
+        free(Slices[SliceIndex].Histogram);
+    }
+    free(Band.Memory);
+
+    return(Result);
+}
+
+static histogram_points
+ConvertIndexedColorsToPoints(indexed_colors *Colors, v3 Scale)
+{
+    histogram_points Result = {};
+
+    Result.Observations = AllocateObservationBuffer(Colors->Count);
+    Result.Weights = (s64 *)malloc(sizeof(s64)*Colors->Count);
+    if(Result.Observations.X && Result.Observations.Y && Result.Observations.Z &&
+       Result.Weights)
+    {
+        Kernels.ConvertTexels(Colors->Colors, Colors->Count,
+                              Result.Observations.X, Result.Observations.Y, Result.Observations.Z);
+        if(!EqualsApproximately(Scale, V3(1.0f, 1.0f, 1.0f)))
+        {
+            ScaleObservations(&Result.Observations, Scale);
+        }
+
+        for(int Index = 0;
+            Index < Colors->Count;
+            Index++)
+        {
+            Result.Weights[Index] = Colors->Counts[Index];
+            Result.TotalWeight += Colors->Counts[Index];
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Squared distance of every point to its closest centroid, times its
+// weight
+static f64
+ComputeWeightedInertia(kmeans_context *Context, histogram_points *Points)
+{
+    f64 Result = 0.0;
+
+    observation_buffer *Observations = &Points->Observations;
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        v3 Observation = GetObservation(Observations, Index);
+        f32 ClosestLengthSquared = F32Max;
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            ClosestLengthSquared = Minimum(ClosestLengthSquared,
+                                           LengthSquared(Observation - Context->Clusters[ClusterIndex].Centroid));
+        }
+        Result += (f64)ClosestLengthSquared*Points->Weights[Index];
+    }
+
+    return(Result);
+}
+
+// NOTE: With no more colors than clusters every color is its own cluster,
+// and Context->ClusterCount drops to the number of colors. Otherwise it's
+// RestartCount runs of RunHistogramKMeans, one after the other since a run
+// over at most 256 points is over before a thread would have woken up, and
+// the lowest weighted inertia wins. Returns false if it couldn't allocate.
+static b32
+RunIndexedKMeans(kmeans_context *Context, histogram_points *Points, u32 Seed, int RestartCount)
+{
+    b32 Result = false;
+
+    observation_buffer *Observations = &Points->Observations;
+    if(Observations->Count <= Context->ClusterCount)
+    {
+        Context->ClusterCount = Observations->Count;
+        for(int Index = 0;
+            Index < Observations->Count;
+            Index++)
+        {
+            cluster *Cluster = Context->Clusters + Index;
+            Cluster->Centroid = GetObservation(Observations, Index);
+            Cluster->ObservationSum = Cluster->Centroid*(f32)Points->Weights[Index];
+            Cluster->ObservationCount = Points->Weights[Index];
+        }
+
+        Result = true;
+    }
+    else
+    {
+        kmeans_context Restart;
+        InitializeKMeansContext(&Restart, Context->ClusterCount);
+        if(Restart.Clusters)
+        {
+            f64 BestInertia = 0.0;
+            for(int RestartIndex = 0;
+                RestartIndex < RestartCount;
+                RestartIndex++)
+            {
+                random_series Entropy = SeedSeries(Seed, (u32)RestartIndex);
+                if(RunHistogramKMeans(&Restart, Points, &Entropy))
+                {
+                    f64 Inertia = ComputeWeightedInertia(&Restart, Points);
+                    if(!Result || (Inertia < BestInertia))
+                    {
+                        BestInertia = Inertia;
+                        for(int ClusterIndex = 0;
+                            ClusterIndex < Context->ClusterCount;
+                            ClusterIndex++)
+                        {
+                            Context->Clusters[ClusterIndex] = Restart.Clusters[ClusterIndex];
+                        }
+                        Result = true;
+                    }
+                }
+            }
+        }
+        FreeKMeansContext(&Restart);
+    }
+
+    return(Result);
+}
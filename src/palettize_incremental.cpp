@@ -0,0 +1,149 @@
+// NOTE: Incremental re-palettization, for an image that's being edited and
+// needs a new palette after every change. The context, the image in the
+// clustering color space and which cluster every texel is in all stay alive
+// between updates. An update takes the rectangle that changed, takes its old
+// texels out of the cluster sums, converts the new ones and puts them back
+// in, then runs a few Lloyd passes from where the centroids already were. The
+// first of them only goes over the rectangle and the rest over the active set
+// of RunLloydKMeansInRect, so an update takes milliseconds where clustering
+// the image from scratch takes seconds.
+//
+// Unlike the CLI's Lloyd engine this works on the native resolution, since
+// the rectangles come in texels of the image being edited.
+
+// NOTE: The pass over the rectangle and two more. After an edit Lloyd keeps
+// nudging most centroids by a hair for a long time, so an update doesn't
+// wait for that. Whatever it didn't get to is picked up by the next one.
+#define INCREMENTAL_ITERATION_COUNT 3
+
+struct incremental_palettizer
+{
+    int Width;
+    int Height;
+    v3 DistanceScale;
+
+    kmeans_context Context;
+    observation_buffer Observations;
+    u32 *ClusterIndices;
+
+    // NOTE: The SIMD conversions round a texel differently depending on
+    // where it falls in a lane, so updated rows are converted whole into
+    // this and only the rectangle is copied out, the same as they were
+    // converted the first time
+    observation_buffer Row;
+};
+
+static void
+EndIncrementalPalettizer(incremental_palettizer *Palettizer)
+{
+    FreeKMeansContext(&Palettizer->Context);
+    free(Palettizer->Observations.X);
+    free(Palettizer->Observations.Y);
+    free(Palettizer->Observations.Z);
+    free(Palettizer->ClusterIndices);
+    free(Palettizer->Row.X);
+    free(Palettizer->Row.Y);
+    free(Palettizer->Row.Z);
+
+    Palettizer->Observations.X = 0;
+    Palettizer->Observations.Y = 0;
+    Palettizer->Observations.Z = 0;
+    Palettizer->ClusterIndices = 0;
+    Palettizer->Row.X = 0;
+    Palettizer->Row.Y = 0;
+    Palettizer->Row.Z = 0;
+}
+
+// NOTE: Clusters the whole bitmap to convergence, seeded like the first Lloyd
+// restart. Returns false (with nothing left to end) if it couldn't allocate.
+static b32
+BeginIncrementalPalettizer(incremental_palettizer *Palettizer, bitmap Bitmap,
+                           int ClusterCount, v3 DistanceScale, u32 Seed)
+{
+    Palettizer->Width = Bitmap.Width;
+    Palettizer->Height = Bitmap.Height;
+    Palettizer->DistanceScale = DistanceScale;
+
+    InitializeKMeansContext(&Palettizer->Context, ClusterCount);
+    Palettizer->Observations = ConvertBitmapToObservations(Bitmap, DistanceScale);
+    Palettizer->ClusterIndices = (u32 *)malloc(sizeof(u32)*Bitmap.Width*Bitmap.Height);
+    Palettizer->Row = AllocateObservationBuffer(Bitmap.Width);
+
+    b32 Result = (Palettizer->Context.Clusters &&
+                  Palettizer->Observations.X &&
+                  Palettizer->Observations.Y &&
+                  Palettizer->Observations.Z &&
+                  Palettizer->ClusterIndices &&
+                  Palettizer->Row.X &&
+                  Palettizer->Row.Y &&
+                  Palettizer->Row.Z);
+    if(Result)
+    {
+        random_series Entropy = SeedSeries(Seed, 0);
+        SeedClustersFromObservations(&Palettizer->Context, &Palettizer->Observations,
+                                     Bitmap.Width, Bitmap.Height, &Entropy);
+        RunLloydKMeans(&Palettizer->Context, &Palettizer->Observations,
+                       Bitmap.Width, Bitmap.Height, Palettizer->ClusterIndices);
+    }
+    else
+    {
+        EndIncrementalPalettizer(Palettizer);
+    }
+
+    return(Result);
+}
+
+// NOTE: Bitmap is the whole edited image, the same size as the one the
+// palettizer began with, and only [MinX, MaxX) x [MinY, MaxY) of it is read.
+// The rectangle is clipped to the image.
+static void
+UpdateIncrementalPalettizer(incremental_palettizer *Palettizer, bitmap Bitmap,
+                            int MinX, int MinY, int MaxX, int MaxY)
+{
+    Assert((Bitmap.Width == Palettizer->Width) && (Bitmap.Height == Palettizer->Height));
+
+    MinX = Maximum(MinX, 0);
+    MinY = Maximum(MinY, 0);
+    MaxX = Minimum(MaxX, Palettizer->Width);
+    MaxY = Minimum(MaxY, Palettizer->Height);
+
+    if((MinX < MaxX) && (MinY < MaxY))
+    {
+        kmeans_context *Context = &Palettizer->Context;
+        observation_buffer *Observations = &Palettizer->Observations;
+
+        observation_buffer *Row = &Palettizer->Row;
+        v3 Scale = Palettizer->DistanceScale;
+        if(EqualsApproximately(Scale, V3(1.0f, 1.0f, 1.0f)))
+        {
+            // NOTE: Like ConvertBitmapToObservations
+            Scale = V3(1.0f, 1.0f, 1.0f);
+        }
+        for(int Y = MinY;
+            Y < MaxY;
+            Y++)
+        {
+            Kernels.ConvertTexels((u32 *)GetBitmapPtr(Bitmap, 0, Y), Bitmap.Width,
+                                  Row->X, Row->Y, Row->Z);
+
+            int First = Y*Palettizer->Width;
+            for(int X = MinX;
+                X < MaxX;
+                X++)
+            {
+                int Index = First + X;
+                cluster *Cluster = Context->Clusters + Palettizer->ClusterIndices[Index];
+                Cluster->ObservationSum -= GetObservation(Observations, Index);
+                Cluster->ObservationCount--;
+
+                Observations->X[Index] = Row->X[X]*Scale.x;
+                Observations->Y[Index] = Row->Y[X]*Scale.y;
+                Observations->Z[Index] = Row->Z[X]*Scale.z;
+            }
+        }
+
+        RunLloydKMeansInRect(Context, Observations, Palettizer->Width, Palettizer->Height,
+                             Palettizer->ClusterIndices, MinX, MinY, MaxX, MaxY,
+                             INCREMENTAL_ITERATION_COUNT);
+    }
+}
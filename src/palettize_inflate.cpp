@@ -0,0 +1,568 @@
+// NOTE: A streaming inflater for the zlib data in a PNG's IDAT chunks.
+// stb_image's zlib decoder only inflates a whole buffer into one allocation
+// as big as the decoded image, so this one keeps just the 32KB window that
+// deflate can refer back into and hands out exactly as many bytes as it's
+// asked for at a time, which for a PNG is one row. The compressed bytes are
+// read from the file a buffer at a time, across as many IDAT chunks as the
+// image was split into. Like stb_image, it checks neither the chunk CRCs nor
+// the zlib checksum.
+#define INFLATE_WINDOW_SIZE 32768
+#define INFLATE_INPUT_SIZE 65536
+#define INFLATE_FAST_BITS 9
+#define MAX_INFLATE_SYMBOL_COUNT 288
+
+// NOTE: Fast holds the symbol and code size of every code of up to
+// INFLATE_FAST_BITS bits, indexed by the next bits of the stream. Longer
+// codes are found from the canonical code ranges of each size, like in
+// stb_image.
+struct inflate_huffman
+{
+    u16 Fast[1 << INFLATE_FAST_BITS];
+    u16 FirstCode[16];
+    int MaxCode[17];
+    u16 FirstSymbol[16];
+    u8 Sizes[MAX_INFLATE_SYMBOL_COUNT];
+    u16 Symbols[MAX_INFLATE_SYMBOL_COUNT];
+};
+
+enum inflate_block_type
+{
+    InflateBlock_None,
+    InflateBlock_Stored,
+    InflateBlock_Huffman,
+};
+
+struct inflater
+{
+    FILE *File;
+
+    // NOTE: Bytes left in the IDAT chunk being read, and whether there are
+    // any more IDAT chunks after it
+    u32 ChunkRemaining;
+    b32 LastChunk;
+
+    u8 *Input;
+    int InputCount;
+    int InputPosition;
+
+    // NOTE: Past the end of the data the bit buffer is filled with zeros,
+    // like stb_image does, and running into them means it was cut short
+    u32 BitBuffer;
+    int BitCount;
+    int PaddingBitCount;
+
+    inflate_block_type BlockType;
+    b32 FinalBlock;
+    int StoredRemaining;
+    int MatchRemaining;
+    int MatchDistance;
+    b32 Failed;
+
+    u8 *Window;
+    u32 WindowPosition;
+    u32 WindowFill;
+
+    inflate_huffman LiteralCodes;
+    inflate_huffman DistanceCodes;
+};
+
+static int InflateLengthBases[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+static int InflateLengthExtraBits[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+static int InflateDistanceBases[30] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577,
+};
+static int InflateDistanceExtraBits[30] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+inline u32
+ReadU32BE(u8 *Bytes)
+{
+    u32 Result = (((u32)Bytes[0] << 24) | ((u32)Bytes[1] << 16) |
+                  ((u32)Bytes[2] << 8) | ((u32)Bytes[3] << 0));
+
+    return(Result);
+}
+
+// NOTE: Deflate sends Huffman codes starting from their most significant bit
+inline int
+ReverseInflateBits(int Value, int BitCount)
+{
+    Value = ((Value & 0xAAAA) >> 1) | ((Value & 0x5555) << 1);
+    Value = ((Value & 0xCCCC) >> 2) | ((Value & 0x3333) << 2);
+    Value = ((Value & 0xF0F0) >> 4) | ((Value & 0x0F0F) << 4);
+    Value = ((Value & 0xFF00) >> 8) | ((Value & 0x00FF) << 8);
+    int Result = Value >> (16 - BitCount);
+
+    return(Result);
+}
+
+// NOTE: Returns false if the code sizes don't make a valid prefix code
+static b32
+BuildInflateHuffman(inflate_huffman *Huffman, u8 *CodeSizes, int SymbolCount)
+{
+    Assert(SymbolCount <= MAX_INFLATE_SYMBOL_COUNT);
+
+    int SizeCounts[16] = {};
+    for(int Symbol = 0;
+        Symbol < SymbolCount;
+        Symbol++)
+    {
+        SizeCounts[CodeSizes[Symbol]]++;
+    }
+    SizeCounts[0] = 0;
+
+    for(int Index = 0;
+        Index < (1 << INFLATE_FAST_BITS);
+        Index++)
+    {
+        Huffman->Fast[Index] = 0;
+    }
+
+    b32 Result = true;
+    int NextCode[16];
+    int Code = 0;
+    int FirstSymbol = 0;
+    for(int Size = 1;
+        Size < 16;
+        Size++)
+    {
+        NextCode[Size] = Code;
+        Huffman->FirstCode[Size] = (u16)Code;
+        Huffman->FirstSymbol[Size] = (u16)FirstSymbol;
+        Code += SizeCounts[Size];
+        if(SizeCounts[Size] && ((Code - 1) >= (1 << Size)))
+        {
+            Result = false;
+        }
+        Huffman->MaxCode[Size] = Code << (16 - Size);
+        Code <<= 1;
+        FirstSymbol += SizeCounts[Size];
+    }
+    Huffman->MaxCode[16] = 0x10000;
+
+    for(int Symbol = 0;
+        Result && (Symbol < SymbolCount);
+        Symbol++)
+    {
+        int Size = CodeSizes[Symbol];
+        if(Size)
+        {
+            int Index = NextCode[Size] - Huffman->FirstCode[Size] + Huffman->FirstSymbol[Size];
+            Huffman->Sizes[Index] = (u8)Size;
+            Huffman->Symbols[Index] = (u16)Symbol;
+            if(Size <= INFLATE_FAST_BITS)
+            {
+                u16 Fast = (u16)((Size << 9) | Symbol);
+                for(int Bits = ReverseInflateBits(NextCode[Size], Size);
+                    Bits < (1 << INFLATE_FAST_BITS);
+                    Bits += (1 << Size))
+                {
+                    Huffman->Fast[Bits] = Fast;
+                }
+            }
+            NextCode[Size]++;
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Returns -1 once the last IDAT chunk has run out
+static int
+GetInflateByte(inflater *Inflater)
+{
+    if(Inflater->InputPosition == Inflater->InputCount)
+    {
+        Inflater->InputPosition = 0;
+        Inflater->InputCount = 0;
+
+        // NOTE: Chunks can be empty, and each one is followed by its CRC and
+        // then the next one's length and type
+        while(!Inflater->LastChunk && (Inflater->ChunkRemaining == 0))
+        {
+            u8 Header[12];
+            if((fread(Header, 1, sizeof(Header), Inflater->File) == sizeof(Header)) &&
+               (Header[8] == 'I') && (Header[9] == 'D') && (Header[10] == 'A') && (Header[11] == 'T'))
+            {
+                Inflater->ChunkRemaining = ReadU32BE(Header + 4);
+            }
+            else
+            {
+                Inflater->LastChunk = true;
+            }
+        }
+
+        if(Inflater->ChunkRemaining)
+        {
+            int ReadCount = (int)Minimum((u32)INFLATE_INPUT_SIZE, Inflater->ChunkRemaining);
+            Inflater->InputCount = (int)fread(Inflater->Input, 1, ReadCount, Inflater->File);
+            Inflater->ChunkRemaining -= (u32)ReadCount;
+            if(Inflater->InputCount < ReadCount)
+            {
+                Inflater->ChunkRemaining = 0;
+                Inflater->LastChunk = true;
+            }
+        }
+    }
+
+    int Result = -1;
+    if(Inflater->InputPosition < Inflater->InputCount)
+    {
+        Result = Inflater->Input[Inflater->InputPosition++];
+    }
+
+    return(Result);
+}
+
+static void
+FillInflateBits(inflater *Inflater)
+{
+    while(Inflater->BitCount <= 24)
+    {
+        int Byte = GetInflateByte(Inflater);
+        if(Byte < 0)
+        {
+            Byte = 0;
+            Inflater->PaddingBitCount += 8;
+        }
+        Inflater->BitBuffer |= (u32)Byte << Inflater->BitCount;
+        Inflater->BitCount += 8;
+    }
+}
+
+inline void
+ConsumeInflateBits(inflater *Inflater, int BitCount)
+{
+    Inflater->BitBuffer >>= BitCount;
+    Inflater->BitCount -= BitCount;
+    if(Inflater->BitCount < Inflater->PaddingBitCount)
+    {
+        Inflater->Failed = true;
+    }
+}
+
+inline u32
+GetInflateBits(inflater *Inflater, int BitCount)
+{
+    if(Inflater->BitCount < BitCount)
+    {
+        FillInflateBits(Inflater);
+    }
+    u32 Result = Inflater->BitBuffer & ((1u << BitCount) - 1);
+    ConsumeInflateBits(Inflater, BitCount);
+
+    return(Result);
+}
+
+// NOTE: Returns -1, and fails the inflater, if the bits aren't a code
+static int
+DecodeInflateSymbol(inflater *Inflater, inflate_huffman *Huffman)
+{
+    if(Inflater->BitCount < 16)
+    {
+        FillInflateBits(Inflater);
+    }
+
+    int Result = -1;
+    int Fast = Huffman->Fast[Inflater->BitBuffer & ((1 << INFLATE_FAST_BITS) - 1)];
+    if(Fast)
+    {
+        ConsumeInflateBits(Inflater, Fast >> 9);
+        Result = Fast & 0x1FF;
+    }
+    else
+    {
+        int Code = ReverseInflateBits((int)(Inflater->BitBuffer & 0xFFFF), 16);
+        int Size = INFLATE_FAST_BITS + 1;
+        while(Code >= Huffman->MaxCode[Size])
+        {
+            Size++;
+        }
+
+        if(Size < 16)
+        {
+            int Index = (Code >> (16 - Size)) - Huffman->FirstCode[Size] + Huffman->FirstSymbol[Size];
+            if((Index < MAX_INFLATE_SYMBOL_COUNT) && (Huffman->Sizes[Index] == Size))
+            {
+                ConsumeInflateBits(Inflater, Size);
+                Result = Huffman->Symbols[Index];
+            }
+        }
+    }
+
+    if(Result < 0)
+    {
+        Inflater->Failed = true;
+    }
+
+    return(Result);
+}
+
+static b32
+ReadInflateDynamicCodes(inflater *Inflater)
+{
+    static u8 CodeSizeOrder[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    int LiteralCount = (int)GetInflateBits(Inflater, 5) + 257;
+    int DistanceCount = (int)GetInflateBits(Inflater, 5) + 1;
+    int CodeSizeCount = (int)GetInflateBits(Inflater, 4) + 4;
+
+    u8 CodeSizeSizes[19] = {};
+    for(int Index = 0;
+        Index < CodeSizeCount;
+        Index++)
+    {
+        CodeSizeSizes[CodeSizeOrder[Index]] = (u8)GetInflateBits(Inflater, 3);
+    }
+
+    // NOTE: The literal and distance code sizes are sent as one run, so a
+    // repeat can cross from one into the other
+    inflate_huffman CodeSizeCodes;
+    u8 CodeSizes[286 + 32];
+    int TotalCount = LiteralCount + DistanceCount;
+    b32 Result = ((LiteralCount <= 286) && (DistanceCount <= 30) &&
+                  BuildInflateHuffman(&CodeSizeCodes, CodeSizeSizes, 19));
+    int Count = 0;
+    while(Result && !Inflater->Failed && (Count < TotalCount))
+    {
+        int Symbol = DecodeInflateSymbol(Inflater, &CodeSizeCodes);
+        if((Symbol >= 0) && (Symbol < 16))
+        {
+            CodeSizes[Count++] = (u8)Symbol;
+        }
+        else if(Symbol >= 16)
+        {
+            u8 Size = 0;
+            int RepeatCount = 0;
+            if(Symbol == 16)
+            {
+                Result = (Count > 0);
+                Size = Result ? CodeSizes[Count - 1] : 0;
+                RepeatCount = (int)GetInflateBits(Inflater, 2) + 3;
+            }
+            else if(Symbol == 17)
+            {
+                RepeatCount = (int)GetInflateBits(Inflater, 3) + 3;
+            }
+            else
+            {
+                RepeatCount = (int)GetInflateBits(Inflater, 7) + 11;
+            }
+
+            Result = (Result && ((Count + RepeatCount) <= TotalCount));
+            while(Result && RepeatCount--)
+            {
+                CodeSizes[Count++] = Size;
+            }
+        }
+    }
+
+    Result = (Result && !Inflater->Failed &&
+              BuildInflateHuffman(&Inflater->LiteralCodes, CodeSizes, LiteralCount) &&
+              BuildInflateHuffman(&Inflater->DistanceCodes, CodeSizes + LiteralCount, DistanceCount));
+
+    return(Result);
+}
+
+static b32
+ReadInflateBlockHeader(inflater *Inflater)
+{
+    Inflater->FinalBlock = GetInflateBits(Inflater, 1);
+    u32 Type = GetInflateBits(Inflater, 2);
+
+    b32 Result = true;
+    switch(Type)
+    {
+        case 0:
+        {
+            // NOTE: Stored blocks start on a byte boundary
+            ConsumeInflateBits(Inflater, Inflater->BitCount & 7);
+            u32 Length = GetInflateBits(Inflater, 16);
+            u32 InvLength = GetInflateBits(Inflater, 16);
+            Result = (Length == (InvLength ^ 0xFFFF));
+            Inflater->StoredRemaining = (int)Length;
+            Inflater->BlockType = InflateBlock_Stored;
+        } break;
+
+        case 1:
+        {
+            u8 CodeSizes[MAX_INFLATE_SYMBOL_COUNT + 32];
+            for(int Symbol = 0;
+                Symbol < MAX_INFLATE_SYMBOL_COUNT;
+                Symbol++)
+            {
+                CodeSizes[Symbol] = ((Symbol < 144) ? 8 :
+                                     (Symbol < 256) ? 9 :
+                                     (Symbol < 280) ? 7 : 8);
+            }
+            for(int Symbol = 0;
+                Symbol < 32;
+                Symbol++)
+            {
+                CodeSizes[MAX_INFLATE_SYMBOL_COUNT + Symbol] = 5;
+            }
+
+            BuildInflateHuffman(&Inflater->LiteralCodes, CodeSizes, MAX_INFLATE_SYMBOL_COUNT);
+            BuildInflateHuffman(&Inflater->DistanceCodes, CodeSizes + MAX_INFLATE_SYMBOL_COUNT, 32);
+            Inflater->BlockType = InflateBlock_Huffman;
+        } break;
+
+        case 2:
+        {
+            Result = ReadInflateDynamicCodes(Inflater);
+            Inflater->BlockType = InflateBlock_Huffman;
+        } break;
+
+        default:
+        {
+            Result = false;
+        } break;
+    }
+
+    return(Result);
+}
+
+inline void
+EmitInflateByte(inflater *Inflater, u8 Byte, u8 *Dest)
+{
+    *Dest = Byte;
+    Inflater->Window[Inflater->WindowPosition] = Byte;
+    Inflater->WindowPosition = (Inflater->WindowPosition + 1) & (INFLATE_WINDOW_SIZE - 1);
+    if(Inflater->WindowFill < INFLATE_WINDOW_SIZE)
+    {
+        Inflater->WindowFill++;
+    }
+}
+
+// NOTE: Inflater->Window and Inflater->Input have to be allocated, and the
+// file has to be at the start of the first IDAT chunk's data, ChunkRemaining
+// bytes long. Returns false if the zlib header isn't one PNG allows.
+static b32
+BeginInflater(inflater *Inflater)
+{
+    Inflater->LastChunk = false;
+    Inflater->InputCount = 0;
+    Inflater->InputPosition = 0;
+    Inflater->BitBuffer = 0;
+    Inflater->BitCount = 0;
+    Inflater->PaddingBitCount = 0;
+    Inflater->BlockType = InflateBlock_None;
+    Inflater->FinalBlock = false;
+    Inflater->StoredRemaining = 0;
+    Inflater->MatchRemaining = 0;
+    Inflater->MatchDistance = 0;
+    Inflater->Failed = false;
+    Inflater->WindowPosition = 0;
+    Inflater->WindowFill = 0;
+
+    // NOTE: Deflate, no preset dictionary
+    u32 Method = GetInflateBits(Inflater, 8);
+    u32 Flags = GetInflateBits(Inflater, 8);
+    b32 Result = (!Inflater->Failed &&
+                  ((Method & 15) == 8) &&
+                  ((((Method << 8) | Flags) % 31) == 0) &&
+                  !(Flags & 32));
+
+    return(Result);
+}
+
+// NOTE: Returns false if the data ends, or turns out to be corrupt, before
+// Count bytes come out of it
+static b32
+InflateBytes(inflater *Inflater, u8 *Dest, int Count)
+{
+    int Written = 0;
+    while(!Inflater->Failed && (Written < Count))
+    {
+        if(Inflater->MatchRemaining)
+        {
+            int CopyCount = Minimum(Inflater->MatchRemaining, Count - Written);
+            for(int Index = 0;
+                Index < CopyCount;
+                Index++)
+            {
+                u32 From = (Inflater->WindowPosition - (u32)Inflater->MatchDistance) & (INFLATE_WINDOW_SIZE - 1);
+                EmitInflateByte(Inflater, Inflater->Window[From], Dest + Written++);
+            }
+            Inflater->MatchRemaining -= CopyCount;
+        }
+        else if(Inflater->BlockType == InflateBlock_None)
+        {
+            if(Inflater->FinalBlock || !ReadInflateBlockHeader(Inflater))
+            {
+                Inflater->Failed = true;
+            }
+        }
+        else if(Inflater->BlockType == InflateBlock_Stored)
+        {
+            if(Inflater->StoredRemaining)
+            {
+                EmitInflateByte(Inflater, (u8)GetInflateBits(Inflater, 8), Dest + Written++);
+                Inflater->StoredRemaining--;
+            }
+            else
+            {
+                Inflater->BlockType = InflateBlock_None;
+            }
+        }
+        else
+        {
+            int Symbol = DecodeInflateSymbol(Inflater, &Inflater->LiteralCodes);
+            if((Symbol >= 0) && (Symbol < 256))
+            {
+                EmitInflateByte(Inflater, (u8)Symbol, Dest + Written++);
+            }
+            else if(Symbol == 256)
+            {
+                Inflater->BlockType = InflateBlock_None;
+            }
+            else if((Symbol > 256) && (Symbol < (257 + 29)))
+            {
+                int LengthIndex = Symbol - 257;
+                int Length = (InflateLengthBases[LengthIndex] +
+                              (int)GetInflateBits(Inflater, InflateLengthExtraBits[LengthIndex]));
+
+                int DistanceIndex = DecodeInflateSymbol(Inflater, &Inflater->DistanceCodes);
+                if((DistanceIndex >= 0) && (DistanceIndex < 30))
+                {
+                    int Distance = (InflateDistanceBases[DistanceIndex] +
+                                    (int)GetInflateBits(Inflater, InflateDistanceExtraBits[DistanceIndex]));
+                    if((u32)Distance <= Inflater->WindowFill)
+                    {
+                        Inflater->MatchRemaining = Length;
+                        Inflater->MatchDistance = Distance;
+                    }
+                    else
+                    {
+                        Inflater->Failed = true;
+                    }
+                }
+                else
+                {
+                    Inflater->Failed = true;
+                }
+            }
+            else
+            {
+                Inflater->Failed = true;
+            }
+        }
+    }
+
+    b32 Result = (Written == Count) && !Inflater->Failed;
+
+    return(Result);
+}
@@ -0,0 +1,753 @@
+// NOTE: The hot loops are compiled once per instruction set and the widest one
+// the CPU supports is picked at startup, so the binary itself only assumes
+// the x64 baseline (see build.bat)
+
+static f32 sRGBToLinearTable[256];
+static f32 sRGBTable[256];
+static u32 sRGBToLinear16Table[256];
+
+// NOTE: Cluster counts from 2 to 16, plus 24, 32, 48 and 64, get their own
+// unrolled assignment kernels (see palettize_kernels_lane.cpp)
+#define MAX_UNROLLED_CLUSTER_COUNT 64
+
+// 
+// Color space policies
+// 
+
+// NOTE: Each color space is an empty tag type, so the conversion kernels can
+// be templated on it and resolve every call at compile time. Spaces other
+// than CIELAB are scaled so that lightness spans roughly 0 to 100 too, which
+// keeps any tolerance expressed in CIELAB units meaningful in all of them.
+struct color_space_cielab {};
+struct color_space_oklab {};
+struct color_space_linear_rgb {};
+struct color_space_ycbcr {};
+
+inline f32 *
+GetChannelTable(color_space_cielab)
+{
+    return(sRGBToLinearTable);
+}
+
+inline v3
+UnpackRGBAToColor(color_space_cielab, u32 Texel)
+{
+    v3 Result = UnpackRGBAToCIELAB(Texel);
+
+    return(Result);
+}
+
+inline u32
+PackColorToRGBA(color_space_cielab, v3 Color)
+{
+    u32 Result = PackCIELABToRGBA(Color);
+
+    return(Result);
+}
+
+inline f32 *
+GetChannelTable(color_space_oklab)
+{
+    return(sRGBToLinearTable);
+}
+
+inline v3
+UnpackRGBAToColor(color_space_oklab, u32 Texel)
+{
+    v3 LinearRGB = sRGBToLinearRGB(UnpackRGBA(Texel));
+    v3 Result = LinearRGBToOklab(LinearRGB)*100.0f;
+
+    return(Result);
+}
+
+inline u32
+PackColorToRGBA(color_space_oklab, v3 Color)
+{
+    v3 LinearRGB = OklabToLinearRGB(Color*0.01f);
+    u32 Result = PackRGBA(LinearRGBTosRGB(LinearRGB));
+
+    return(Result);
+}
+
+inline f32 *
+GetChannelTable(color_space_linear_rgb)
+{
+    return(sRGBToLinearTable);
+}
+
+inline v3
+UnpackRGBAToColor(color_space_linear_rgb, u32 Texel)
+{
+    v3 Result = sRGBToLinearRGB(UnpackRGBA(Texel))*100.0f;
+
+    return(Result);
+}
+
+inline u32
+PackColorToRGBA(color_space_linear_rgb, v3 Color)
+{
+    u32 Result = PackRGBA(LinearRGBTosRGB(Color*0.01f));
+
+    return(Result);
+}
+
+inline f32 *
+GetChannelTable(color_space_ycbcr)
+{
+    return(sRGBTable);
+}
+
+inline v3
+UnpackRGBAToColor(color_space_ycbcr, u32 Texel)
+{
+    v3 Result = sRGBToYCbCr(UnpackRGBA(Texel))*100.0f;
+
+    return(Result);
+}
+
+inline u32
+PackColorToRGBA(color_space_ycbcr, v3 Color)
+{
+    v3 sRGB = YCbCrTosRGB(Color*0.01f);
+    u32 Result = PackRGBA(V3(Clamp01(sRGB.x), Clamp01(sRGB.y), Clamp01(sRGB.z)));
+
+    return(Result);
+}
+
+// NOTE: Runtime versions for code outside the kernels, where the color space
+// is only known from the config
+inline v3
+UnpackRGBAToColor(color_space ColorSpace, u32 Texel)
+{
+    v3 Result = {};
+    switch(ColorSpace)
+    {
+        case ColorSpace_CIELAB: {Result = UnpackRGBAToColor(color_space_cielab(), Texel);} break;
+        case ColorSpace_Oklab: {Result = UnpackRGBAToColor(color_space_oklab(), Texel);} break;
+        case ColorSpace_LinearRGB: {Result = UnpackRGBAToColor(color_space_linear_rgb(), Texel);} break;
+        case ColorSpace_YCbCr: {Result = UnpackRGBAToColor(color_space_ycbcr(), Texel);} break;
+        InvalidDefaultCase;
+    }
+
+    return(Result);
+}
+
+// NOTE: For colors that are already linear, like the means of histogram bins
+inline v3
+LinearRGBToColor(color_space ColorSpace, v3 LinearRGB)
+{
+    v3 Result = {};
+    switch(ColorSpace)
+    {
+        case ColorSpace_CIELAB: {Result = CIEXYZToCIELAB(LinearRGBToCIEXYZ(LinearRGB));} break;
+        case ColorSpace_Oklab: {Result = LinearRGBToOklab(LinearRGB)*100.0f;} break;
+        case ColorSpace_LinearRGB: {Result = LinearRGB*100.0f;} break;
+        case ColorSpace_YCbCr: {Result = sRGBToYCbCr(LinearRGBTosRGB(LinearRGB))*100.0f;} break;
+        InvalidDefaultCase;
+    }
+
+    return(Result);
+}
+
+inline u32
+PackColorToRGBA(color_space ColorSpace, v3 Color)
+{
+    u32 Result = 0;
+    switch(ColorSpace)
+    {
+        case ColorSpace_CIELAB: {Result = PackColorToRGBA(color_space_cielab(), Color);} break;
+        case ColorSpace_Oklab: {Result = PackColorToRGBA(color_space_oklab(), Color);} break;
+        case ColorSpace_LinearRGB: {Result = PackColorToRGBA(color_space_linear_rgb(), Color);} break;
+        case ColorSpace_YCbCr: {Result = PackColorToRGBA(color_space_ycbcr(), Color);} break;
+        InvalidDefaultCase;
+    }
+
+    return(Result);
+}
+
+// 
+// Kernels
+// 
+
+static
+EVALUATE_TRANSFER_FUNCTION(EvaluateTransferFunction_Scalar)
+{
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        f32 S = Values[Index];
+        switch(Function)
+        {
+            case TransferFunction_Ft: {Values[Index] = FastFt(S);} break;
+            case TransferFunction_InvFt: {Values[Index] = FastInvFt(S);} break;
+            case TransferFunction_sRGBToLinearRGB: {Values[Index] = FastsRGBToLinearRGB(S);} break;
+            case TransferFunction_LinearRGBTosRGB: {Values[Index] = FastLinearRGBTosRGB(S);} break;
+            InvalidDefaultCase;
+        }
+    }
+}
+
+template<typename color_space_policy>
+static
+CONVERT_TEXELS(ConvertTexels_Scalar)
+{
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        v3 Color = UnpackRGBAToColor(color_space_policy(), Texels[Index]);
+        X[Index] = Color.x;
+        Y[Index] = Color.y;
+        Z[Index] = Color.z;
+    }
+}
+
+static convert_texels *ConvertTexelsTable_Scalar[ColorSpace_Count] =
+{
+    ConvertTexels_Scalar<color_space_cielab>,
+    ConvertTexels_Scalar<color_space_oklab>,
+    ConvertTexels_Scalar<color_space_linear_rgb>,
+    ConvertTexels_Scalar<color_space_ycbcr>,
+};
+
+static u32
+AssignObservation(kmeans_context *Context, v3 Observation)
+{
+    f32 ClosestDistSquared = F32Max;
+    cluster *ClosestCluster = 0;
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+
+        f32 d = LengthSquared(Cluster->Centroid - Observation);
+        if(d < ClosestDistSquared)
+        {
+            ClosestDistSquared = d;
+            ClosestCluster = Cluster;
+        }
+    }
+
+    Assert(ClosestCluster);
+
+    ClosestCluster->ObservationSum += Observation;
+    ClosestCluster->ObservationCount++;
+    
+    // Returning the index of the closest cluster for our early out in the loop
+    // where this function is called
+    u32 Result = (u32)(ClosestCluster - Context->Clusters);
+    Assert(Result < (u32)Context->ClusterCount);
+    
+    return(Result);
+}
+
+static
+ASSIGN_OBSERVATIONS(AssignObservations_Scalar)
+{
+    b32 Changed = false;
+
+    for(int Index = First;
+        Index < (First + Count);
+        Index++)
+    {
+        u32 ClusterIndex = AssignObservation(Context, GetObservation(Observations, Index));
+        if(DetectChanges && (ClusterIndices[Index] != ClusterIndex))
+        {
+            Changed = true;
+        }
+        ClusterIndices[Index] = ClusterIndex;
+    }
+
+    return(Changed);
+}
+
+// NOTE: k-d tree assignment for large palettes. The centroids are indexed in
+// a 3D k-d tree, split at the median of their widest channel down to small
+// buckets, and every observation does an exact nearest neighbor query
+// against it. The previous iteration's cluster (or the one the observation
+// before went to) seeds the best distance, so most subtrees are pruned from
+// the start. A query costs roughly O(log K) instead of O(K).
+//
+// It isn't vectorized, so it only beats checking every centroid a lane at a
+// time once there are about 64 of them per lane (see the dispatchers).
+#define MIN_KD_TREE_CLUSTERS_PER_LANE 64
+#define KD_TREE_BUCKET_SIZE 8
+#define MAX_KD_TREE_DEPTH 64
+
+struct kd_tree_node
+{
+    // NOTE: 3 for a bucket. Otherwise every centroid in the left child (the
+    // node right after this one) is at or below Split along Axis and every
+    // centroid in the right child is at or above it.
+    u32 Axis;
+    f32 Split;
+
+    // NOTE: For a split, the index of the right child. For a bucket, its
+    // range of the reordered centroids.
+    u32 Right;
+    u32 First;
+    u32 Count;
+};
+
+struct centroid_kd_tree
+{
+    // NOTE: The centroids the tree was built for, in cluster order. If the
+    // context's differ in any way it's rebuilt.
+    int Capacity;
+    int ClusterCount;
+    v3 *Centroids;
+
+    // NOTE: The centroids reordered so every bucket is contiguous, along
+    // with the cluster each one came from
+    f32 *X;
+    f32 *Y;
+    f32 *Z;
+    u32 *ClusterIndices;
+
+    int NodeCount;
+    kd_tree_node *Nodes;
+};
+
+inline f32 *
+GetKDTreeChannel(centroid_kd_tree *Tree, u32 Axis)
+{
+    f32 *Result = ((Axis == 0) ? Tree->X : ((Axis == 1) ? Tree->Y : Tree->Z));
+
+    return(Result);
+}
+
+// NOTE: Quickselect over the reordered centroids, same as the median cut's
+static void
+SelectNthCentroid(centroid_kd_tree *Tree, int First, int Count, u32 Axis, int Nth)
+{
+    f32 *Channel = GetKDTreeChannel(Tree, Axis);
+
+    int Target = First + Nth;
+    int Left = First;
+    int Right = First + Count - 1;
+    while(Left < Right)
+    {
+        f32 Pivot = Channel[(Left + Right) / 2];
+
+        int I = Left;
+        int J = Right;
+        while(I <= J)
+        {
+            while(Channel[I] < Pivot)
+            {
+                I++;
+            }
+            while(Channel[J] > Pivot)
+            {
+                J--;
+            }
+            if(I <= J)
+            {
+                f32 SwapX = Tree->X[I];
+                f32 SwapY = Tree->Y[I];
+                f32 SwapZ = Tree->Z[I];
+                u32 SwapIndex = Tree->ClusterIndices[I];
+                Tree->X[I] = Tree->X[J];
+                Tree->Y[I] = Tree->Y[J];
+                Tree->Z[I] = Tree->Z[J];
+                Tree->ClusterIndices[I] = Tree->ClusterIndices[J];
+                Tree->X[J] = SwapX;
+                Tree->Y[J] = SwapY;
+                Tree->Z[J] = SwapZ;
+                Tree->ClusterIndices[J] = SwapIndex;
+                I++;
+                J--;
+            }
+        }
+
+        if(Target <= J)
+        {
+            Right = J;
+        }
+        else if(Target >= I)
+        {
+            Left = I;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+static void
+BuildKDTreeNode(centroid_kd_tree *Tree, int First, int Count)
+{
+    kd_tree_node *Node = Tree->Nodes + Tree->NodeCount++;
+
+    v3 Min = V3(F32Max, F32Max, F32Max);
+    v3 Max = V3(-F32Max, -F32Max, -F32Max);
+    for(int Index = First;
+        Index < (First + Count);
+        Index++)
+    {
+        Min = V3(Minimum(Min.x, Tree->X[Index]), Minimum(Min.y, Tree->Y[Index]), Minimum(Min.z, Tree->Z[Index]));
+        Max = V3(Maximum(Max.x, Tree->X[Index]), Maximum(Max.y, Tree->Y[Index]), Maximum(Max.z, Tree->Z[Index]));
+    }
+    v3 Extent = Max - Min;
+
+    if((Count <= KD_TREE_BUCKET_SIZE) ||
+       ((Extent.x <= 0.0f) && (Extent.y <= 0.0f) && (Extent.z <= 0.0f)))
+    {
+        Node->Axis = 3;
+        Node->First = (u32)First;
+        Node->Count = (u32)Count;
+    }
+    else
+    {
+        Node->Axis = ((Extent.x >= Extent.y) && (Extent.x >= Extent.z)) ? 0 :
+            ((Extent.y >= Extent.z) ? 1 : 2);
+
+        int Half = Count / 2;
+        SelectNthCentroid(Tree, First, Count, Node->Axis, Half);
+        Node->Split = GetKDTreeChannel(Tree, Node->Axis)[First + Half];
+
+        BuildKDTreeNode(Tree, First, Half);
+        Node->Right = (u32)Tree->NodeCount;
+        BuildKDTreeNode(Tree, First + Half, Count - Half);
+    }
+}
+
+// NOTE: Returns false if it couldn't allocate the tree
+static b32
+UpdateCentroidKDTree(kmeans_context *Context)
+{
+    centroid_kd_tree *Tree = Context->KDTree;
+    if(!Tree)
+    {
+        Tree = Context->KDTree = (centroid_kd_tree *)calloc(1, sizeof(centroid_kd_tree));
+    }
+
+    b32 Result = (Tree != 0);
+    if(Result && (Tree->Capacity < Context->ClusterCount))
+    {
+        free(Tree->Centroids);
+        free(Tree->X);
+        free(Tree->Y);
+        free(Tree->Z);
+        free(Tree->ClusterIndices);
+        free(Tree->Nodes);
+
+        int Capacity = Context->ClusterCount;
+        Tree->Capacity = Capacity;
+        Tree->ClusterCount = 0;
+        Tree->Centroids = (v3 *)malloc(sizeof(v3)*Capacity);
+        Tree->X = (f32 *)malloc(sizeof(f32)*Capacity);
+        Tree->Y = (f32 *)malloc(sizeof(f32)*Capacity);
+        Tree->Z = (f32 *)malloc(sizeof(f32)*Capacity);
+        Tree->ClusterIndices = (u32 *)malloc(sizeof(u32)*Capacity);
+        // NOTE: Median splits make a full binary tree with fewer leaves than
+        // centroids
+        Tree->Nodes = (kd_tree_node *)malloc(sizeof(kd_tree_node)*2*Capacity);
+
+        Result = (Tree->Centroids && Tree->X && Tree->Y && Tree->Z &&
+                  Tree->ClusterIndices && Tree->Nodes);
+        if(!Result)
+        {
+            // NOTE: Tried again on the next call
+            Tree->Capacity = 0;
+        }
+    }
+
+    if(Result)
+    {
+        b32 Stale = (Tree->ClusterCount != Context->ClusterCount);
+        for(int ClusterIndex = 0;
+            !Stale && (ClusterIndex < Context->ClusterCount);
+            ClusterIndex++)
+        {
+            v3 A = Tree->Centroids[ClusterIndex];
+            v3 B = Context->Clusters[ClusterIndex].Centroid;
+            Stale = ((A.x != B.x) || (A.y != B.y) || (A.z != B.z));
+        }
+
+        if(Stale)
+        {
+            Tree->ClusterCount = Context->ClusterCount;
+            for(int ClusterIndex = 0;
+                ClusterIndex < Context->ClusterCount;
+                ClusterIndex++)
+            {
+                v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+                Tree->Centroids[ClusterIndex] = Centroid;
+                Tree->X[ClusterIndex] = Centroid.x;
+                Tree->Y[ClusterIndex] = Centroid.y;
+                Tree->Z[ClusterIndex] = Centroid.z;
+                Tree->ClusterIndices[ClusterIndex] = (u32)ClusterIndex;
+            }
+
+            Tree->NodeCount = 0;
+            BuildKDTreeNode(Tree, 0, Context->ClusterCount);
+            Assert(Tree->NodeCount <= 2*Tree->Capacity);
+        }
+    }
+
+    return(Result);
+}
+
+static void
+FreeCentroidKDTree(centroid_kd_tree *Tree)
+{
+    if(Tree)
+    {
+        free(Tree->Centroids);
+        free(Tree->X);
+        free(Tree->Y);
+        free(Tree->Z);
+        free(Tree->ClusterIndices);
+        free(Tree->Nodes);
+        free(Tree);
+    }
+}
+
+static
+ASSIGN_OBSERVATIONS(AssignObservationsKDTree_Scalar)
+{
+    if(!UpdateCentroidKDTree(Context))
+    {
+        b32 Result = AssignObservations_Scalar(Context, Observations, First, Count,
+                                               ClusterIndices, DetectChanges);
+        return(Result);
+    }
+
+    centroid_kd_tree *Tree = Context->KDTree;
+
+    b32 Changed = false;
+
+    for(int Index = First;
+        Index < (First + Count);
+        Index++)
+    {
+        f32 X = Observations->X[Index];
+        f32 Y = Observations->Y[Index];
+        f32 Z = Observations->Z[Index];
+        f32 Position[3] = {X, Y, Z};
+
+        u32 ClosestIndex = 0;
+        if(DetectChanges)
+        {
+            ClosestIndex = ClusterIndices[Index];
+        }
+        else if(Index > First)
+        {
+            ClosestIndex = ClusterIndices[Index - 1];
+        }
+        if(ClosestIndex >= (u32)Context->ClusterCount)
+        {
+            ClosestIndex = 0;
+        }
+        f32 ClosestDistSquared = LengthSquared(Tree->Centroids[ClosestIndex] - V3(X, Y, Z));
+
+        // NOTE: Each entry is a node, how far the query is outside that
+        // node's cell along each axis, and the squared length of that offset,
+        // which bounds the distance to anything in the cell from below. Ties
+        // aren't pruned, so equally distant centroids still go to the lowest
+        // index like the plain scan.
+        u32 StackNodes[MAX_KD_TREE_DEPTH];
+        f32 StackOffsets[MAX_KD_TREE_DEPTH][3];
+        f32 StackBounds[MAX_KD_TREE_DEPTH];
+        int StackCount = 0;
+        StackNodes[StackCount] = 0;
+        StackOffsets[StackCount][0] = 0.0f;
+        StackOffsets[StackCount][1] = 0.0f;
+        StackOffsets[StackCount][2] = 0.0f;
+        StackBounds[StackCount] = 0.0f;
+        StackCount++;
+        while(StackCount)
+        {
+            StackCount--;
+            f32 Bound = StackBounds[StackCount];
+            if(Bound > ClosestDistSquared)
+            {
+                continue;
+            }
+            f32 Offset[3] = {StackOffsets[StackCount][0],
+                             StackOffsets[StackCount][1],
+                             StackOffsets[StackCount][2]};
+
+            kd_tree_node *Node = Tree->Nodes + StackNodes[StackCount];
+            while(Node->Axis != 3)
+            {
+                f32 Delta = Position[Node->Axis] - Node->Split;
+                u32 LeftIndex = (u32)(Node - Tree->Nodes) + 1;
+                u32 Near = (Delta < 0.0f) ? LeftIndex : Node->Right;
+                u32 Far = (Delta < 0.0f) ? Node->Right : LeftIndex;
+
+                f32 FarBound = Bound - Square(Offset[Node->Axis]) + Square(Delta);
+                if(FarBound <= ClosestDistSquared)
+                {
+                    Assert(StackCount < MAX_KD_TREE_DEPTH);
+                    StackNodes[StackCount] = Far;
+                    StackOffsets[StackCount][0] = Offset[0];
+                    StackOffsets[StackCount][1] = Offset[1];
+                    StackOffsets[StackCount][2] = Offset[2];
+                    StackOffsets[StackCount][Node->Axis] = Delta;
+                    StackBounds[StackCount] = FarBound;
+                    StackCount++;
+                }
+
+                Node = Tree->Nodes + Near;
+            }
+
+            for(u32 Entry = Node->First;
+                Entry < (Node->First + Node->Count);
+                Entry++)
+            {
+                f32 dX = Tree->X[Entry] - X;
+                f32 dY = Tree->Y[Entry] - Y;
+                f32 dZ = Tree->Z[Entry] - Z;
+                f32 d = dX*dX + dY*dY + dZ*dZ;
+                u32 ClusterIndex = Tree->ClusterIndices[Entry];
+                if((d < ClosestDistSquared) ||
+                   ((d == ClosestDistSquared) && (ClusterIndex < ClosestIndex)))
+                {
+                    ClosestIndex = ClusterIndex;
+                    ClosestDistSquared = d;
+                }
+            }
+        }
+
+        cluster *Cluster = Context->Clusters + ClosestIndex;
+        Cluster->ObservationSum += V3(X, Y, Z);
+        Cluster->ObservationCount++;
+
+        if(DetectChanges && (ClusterIndices[Index] != ClosestIndex))
+        {
+            Changed = true;
+        }
+        ClusterIndices[Index] = ClosestIndex;
+    }
+
+    return(Changed);
+}
+
+// NOTE: With one observation per lane, the k-d tree takes over at 64 clusters
+// just like it does per lane in the SIMD dispatchers
+static
+ASSIGN_OBSERVATIONS(AssignObservationsSpecialized_Scalar)
+{
+    assign_observations *Kernel = AssignObservations_Scalar;
+    if(Context->ClusterCount >= MIN_KD_TREE_CLUSTERS_PER_LANE)
+    {
+        Kernel = AssignObservationsKDTree_Scalar;
+    }
+
+    b32 Result = Kernel(Context, Observations, First, Count, ClusterIndices, DetectChanges);
+
+    return(Result);
+}
+
+static
+DOWNSAMPLE_ROW(DownsampleRow_Scalar)
+{
+    for(int X = 0;
+        X < Count;
+        X++)
+    {
+        DestRow[X] = SourceRow[SampleXs[X]];
+    }
+}
+
+static
+ACCUMULATE_HISTOGRAM(AccumulateHistogram_Scalar)
+{
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        u32 Texel = Texels[Index];
+        u32 Bin = GetHistogramBin(Texel);
+
+        Histogram->Counts[Bin]++;
+        u64 *LinearSum = Histogram->LinearSums[Bin];
+        LinearSum[0] += sRGBToLinear16Table[(Texel >> 0) & 0xFF];
+        LinearSum[1] += sRGBToLinear16Table[(Texel >> 8) & 0xFF];
+        LinearSum[2] += sRGBToLinear16Table[(Texel >> 16) & 0xFF];
+    }
+}
+
+#if PALETTIZE_X86
+BEGIN_TARGET("sse4.1")
+#include "palettize_lane_sse41.h"
+#include "palettize_kernels_lane.cpp"
+END_TARGET
+
+BEGIN_TARGET("avx2,fma")
+#include "palettize_lane_avx2.h"
+#include "palettize_kernels_lane.cpp"
+END_TARGET
+
+BEGIN_TARGET("avx512f,avx512dq,avx512cd,avx512bw,avx512vl,avx2,fma")
+#include "palettize_lane_avx512.h"
+#include "palettize_kernels_lane.cpp"
+#include "palettize_kernels_avx512.cpp"
+END_TARGET
+#endif
+
+static kernel_table Kernels;
+
+static void
+InitializeKernels(isa_level ISALevel, color_space ColorSpace)
+{
+    for(u32 Value = 0;
+        Value < ArrayCount(sRGBToLinearTable);
+        Value++)
+    {
+        sRGBTable[Value] = (f32)Value / 255.0f;
+        sRGBToLinearTable[Value] = sRGBToLinearRGB((f32)Value / 255.0f);
+        sRGBToLinear16Table[Value] = RoundToU32(sRGBToLinearTable[Value]*HISTOGRAM_LINEAR_ONE);
+    }
+
+    Kernels.ISALevel = ISALevel;
+    Kernels.LaneWidth = 1;
+    Kernels.ConvertTexels = ConvertTexelsTable_Scalar[ColorSpace];
+    Kernels.AssignObservations = AssignObservationsSpecialized_Scalar;
+    Kernels.DownsampleRow = DownsampleRow_Scalar;
+    Kernels.AccumulateHistogram = AccumulateHistogram_Scalar;
+
+    switch(ISALevel)
+    {
+        case ISALevel_Scalar:
+        {
+        } break;
+
+#if PALETTIZE_X86
+        case ISALevel_SSE41:
+        {
+            Kernels.LaneWidth = 4;
+            Kernels.ConvertTexels = ConvertTexelsTable_SSE41[ColorSpace];
+            Kernels.AssignObservations = AssignObservationsSpecialized_SSE41;
+            Kernels.DownsampleRow = DownsampleRow_SSE41;
+            Kernels.AccumulateHistogram = AccumulateHistogram_SSE41;
+        } break;
+
+        case ISALevel_AVX2:
+        {
+            Kernels.LaneWidth = 8;
+            Kernels.ConvertTexels = ConvertTexelsTable_AVX2[ColorSpace];
+            Kernels.AssignObservations = AssignObservationsSpecialized_AVX2;
+            Kernels.DownsampleRow = DownsampleRow_AVX2;
+            Kernels.AccumulateHistogram = AccumulateHistogram_AVX2;
+        } break;
+
+        case ISALevel_AVX512:
+        {
+            Kernels.LaneWidth = 16;
+            Kernels.ConvertTexels = ConvertTexelsTable_AVX512[ColorSpace];
+            Kernels.AssignObservations = AssignObservationsByClusterCount_AVX512;
+            Kernels.DownsampleRow = DownsampleRow_AVX512;
+            Kernels.AccumulateHistogram = AccumulateHistogram_AVX512;
+        } break;
+#endif
+
+        InvalidDefaultCase;
+    }
+}
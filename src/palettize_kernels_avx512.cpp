@@ -0,0 +1,157 @@
+// NOTE: AVX-512 only kernels that don't fit the lane-per-observation layout of
+// palettize_kernels_lane.cpp. Included by palettize_kernels.cpp inside the
+// AVX-512 BEGIN_TARGET block.
+
+// NOTE: Rather than comparing 16 observations against one centroid at a time,
+// this compares one observation against 16 centroids at a time. With up to 64
+// clusters every centroid fits in 4 groups of 12 registers total, so the
+// inner loop is just 3 subtractions and 3 FMAs per group.
+#define MAX_CENTROID_GROUP_COUNT 4
+#define CENTROID_INDEX_MASK 0x3F
+
+static
+ASSIGN_OBSERVATIONS(AssignObservationsAcrossCentroids_AVX512)
+{
+    int ClusterCount = Context->ClusterCount;
+    Assert(ClusterCount <= 16*MAX_CENTROID_GROUP_COUNT);
+
+    int GroupCount = (ClusterCount + 15) / 16;
+
+    __m512 CentroidX[MAX_CENTROID_GROUP_COUNT];
+    __m512 CentroidY[MAX_CENTROID_GROUP_COUNT];
+    __m512 CentroidZ[MAX_CENTROID_GROUP_COUNT];
+    __m512i GroupIndices[MAX_CENTROID_GROUP_COUNT];
+    __mmask16 GroupMasks[MAX_CENTROID_GROUP_COUNT];
+    for(int GroupIndex = 0;
+        GroupIndex < GroupCount;
+        GroupIndex++)
+    {
+        f32 X[16] = {};
+        f32 Y[16] = {};
+        f32 Z[16] = {};
+        for(int Lane = 0;
+            Lane < 16;
+            Lane++)
+        {
+            int ClusterIndex = 16*GroupIndex + Lane;
+            if(ClusterIndex < ClusterCount)
+            {
+                v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+                X[Lane] = Centroid.x;
+                Y[Lane] = Centroid.y;
+                Z[Lane] = Centroid.z;
+            }
+        }
+
+        CentroidX[GroupIndex] = _mm512_loadu_ps(X);
+        CentroidY[GroupIndex] = _mm512_loadu_ps(Y);
+        CentroidZ[GroupIndex] = _mm512_loadu_ps(Z);
+        GroupIndices[GroupIndex] = _mm512_add_epi32(_mm512_set1_epi32(16*GroupIndex),
+                                                    _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                                      8, 9, 10, 11, 12, 13, 14, 15));
+
+        // NOTE: Lanes past the last cluster are masked out of every min
+        int ValidLaneCount = Minimum(ClusterCount - 16*GroupIndex, 16);
+        GroupMasks[GroupIndex] = (__mmask16)((1u << ValidLaneCount) - 1);
+    }
+
+    // NOTE: Each cluster only ever accumulates into its own slot, so these
+    // per-lane sums need no conflict detection. They're folded into the
+    // clusters once at the end instead of once per observation.
+    f32 SumX[16*MAX_CENTROID_GROUP_COUNT] = {};
+    f32 SumY[16*MAX_CENTROID_GROUP_COUNT] = {};
+    f32 SumZ[16*MAX_CENTROID_GROUP_COUNT] = {};
+    int SumCount[16*MAX_CENTROID_GROUP_COUNT] = {};
+
+    __m512i IndexBits = _mm512_set1_epi32(CENTROID_INDEX_MASK);
+
+    b32 Changed = false;
+
+    for(int Index = First;
+        Index < (First + Count);
+        Index++)
+    {
+        f32 ObservationX = Observations->X[Index];
+        f32 ObservationY = Observations->Y[Index];
+        f32 ObservationZ = Observations->Z[Index];
+        __m512 X = _mm512_set1_ps(ObservationX);
+        __m512 Y = _mm512_set1_ps(ObservationY);
+        __m512 Z = _mm512_set1_ps(ObservationZ);
+
+        // NOTE: Squared distances are never negative, so their bit patterns
+        // sort the same way as integers do. Overwriting the low mantissa bits
+        // with the cluster index lets a single unsigned min track both the
+        // closest distance and its index, and ties between (nearly) equal
+        // distances go to the lowest cluster index like the scalar loop.
+        __m512i Closest = _mm512_set1_epi32(-1);
+        for(int GroupIndex = 0;
+            GroupIndex < GroupCount;
+            GroupIndex++)
+        {
+            __m512 dX = _mm512_sub_ps(CentroidX[GroupIndex], X);
+            __m512 dY = _mm512_sub_ps(CentroidY[GroupIndex], Y);
+            __m512 dZ = _mm512_sub_ps(CentroidZ[GroupIndex], Z);
+            __m512 d = _mm512_fmadd_ps(dZ, dZ, _mm512_fmadd_ps(dY, dY, _mm512_mul_ps(dX, dX)));
+
+            __m512i Keyed = _mm512_or_si512(_mm512_andnot_si512(IndexBits, _mm512_castps_si512(d)),
+                                            GroupIndices[GroupIndex]);
+            Closest = _mm512_mask_min_epu32(Closest, GroupMasks[GroupIndex], Closest, Keyed);
+        }
+
+        u32 ClusterIndex = ((u32)_mm512_reduce_min_epu32(Closest) & CENTROID_INDEX_MASK);
+        Assert(ClusterIndex < (u32)ClusterCount);
+
+        SumX[ClusterIndex] += ObservationX;
+        SumY[ClusterIndex] += ObservationY;
+        SumZ[ClusterIndex] += ObservationZ;
+        SumCount[ClusterIndex]++;
+
+        if(DetectChanges && (ClusterIndices[Index] != ClusterIndex))
+        {
+            Changed = true;
+        }
+        ClusterIndices[Index] = ClusterIndex;
+    }
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        Cluster->ObservationSum += V3(SumX[ClusterIndex], SumY[ClusterIndex], SumZ[ClusterIndex]);
+        Cluster->ObservationCount += SumCount[ClusterIndex];
+    }
+
+    return(Changed);
+}
+
+// NOTE: Going across centroids loses to going across observations while every
+// centroid fits in a single register (mostly to the horizontal min), but wins
+// by a growing margin past that: ~1.1x at 32 clusters, ~1.3x at 64. The
+// unrolled kernels beat both, so it's only used for the counts they skip.
+// It only has registers for 64 centroids, past that it's going across
+// observations again until the k-d tree catches up, which takes twice as
+// many centroids per lane here as it does for the narrower kernels.
+static
+ASSIGN_OBSERVATIONS(AssignObservationsByClusterCount_AVX512)
+{
+    assign_observations *Kernel = AssignObservations_AVX512;
+    if((Context->ClusterCount <= MAX_UNROLLED_CLUSTER_COUNT) &&
+       AssignObservationsUnrolledTable_AVX512[Context->ClusterCount])
+    {
+        Kernel = AssignObservationsUnrolledTable_AVX512[Context->ClusterCount];
+    }
+    else if(Context->ClusterCount >= 2*MIN_KD_TREE_CLUSTERS_PER_LANE*16)
+    {
+        Kernel = AssignObservationsKDTree_Scalar;
+    }
+    else if((Context->ClusterCount > 16) &&
+            (Context->ClusterCount <= 16*MAX_CENTROID_GROUP_COUNT))
+    {
+        Kernel = AssignObservationsAcrossCentroids_AVX512;
+    }
+
+    b32 Result = Kernel(Context, Observations, First, Count, ClusterIndices, DetectChanges);
+
+    return(Result);
+}
@@ -0,0 +1,511 @@
+// NOTE: This file is deliberately not include-guarded. palettize_kernels.cpp
+// includes it once per instruction set, right after the matching
+// palettize_lane_*.h header has mapped lane_f32, LANE_WIDTH, LANE_NAME, etc.
+// onto that instruction set's types.
+
+// 
+// Branchless transfer functions, one to one with the Fast* versions in
+// palettize_math.h
+// 
+
+inline lane_f32
+Clamp01(lane_f32 S)
+{
+    lane_f32 Result = Min(Max(S, LaneF32(0.0f)), LaneF32(1.0f));
+
+    return(Result);
+}
+
+inline lane_f32
+FastCubeRoot(lane_f32 S)
+{
+    lane_f32 Two = LaneF32(2.0f);
+
+    lane_f32 Y = FromBits(TruncateToU32(ConvertToF32(BitsOf(S))*LaneF32(1.0f / 3.0f)) +
+                          LaneU32(CUBE_ROOT_MAGIC));
+    for(int Step = 0;
+        Step < 2;
+        Step++)
+    {
+        lane_f32 Y3 = Y*Y*Y;
+        Y = Y*(MulAdd(Two, S, Y3) / MulAdd(Two, Y3, S));
+    }
+
+    return(Y);
+}
+
+inline lane_f32
+FastFifthRoot(lane_f32 S)
+{
+    lane_f32 Four = LaneF32(4.0f);
+    lane_f32 Six = LaneF32(6.0f);
+
+    lane_f32 Y = FromBits(TruncateToU32(ConvertToF32(BitsOf(S))*LaneF32(1.0f / 5.0f)) +
+                          LaneU32(FIFTH_ROOT_MAGIC));
+    for(int Step = 0;
+        Step < 2;
+        Step++)
+    {
+        lane_f32 Y2 = Y*Y;
+        lane_f32 Y5 = Y2*Y2*Y;
+        Y = Y*(MulAdd(Four, Y5, Six*S) / MulAdd(Six, Y5, Four*S));
+    }
+
+    return(Y);
+}
+
+inline lane_f32
+FastFt(lane_f32 t)
+{
+    f32 Sigma = (6.0f / 29.0f);
+    lane_f32 Cubed = LaneF32(Cube(Sigma));
+
+    lane_f32 Root = FastCubeRoot(Max(t, Cubed));
+    lane_f32 Linear = MulAdd(t, LaneF32(1.0f / (3.0f*Square(Sigma))), LaneF32(4.0f / 29.0f));
+    lane_f32 Result = Select(t > Cubed, Root, Linear);
+
+    return(Result);
+}
+
+inline lane_f32
+FastInvFt(lane_f32 t)
+{
+    f32 Sigma = (6.0f / 29.0f);
+
+    lane_f32 Cubed = t*t*t;
+    lane_f32 Linear = LaneF32(3.0f*Square(Sigma))*(t - LaneF32(4.0f / 29.0f));
+    lane_f32 Result = Select(t > LaneF32(Sigma), Cubed, Linear);
+
+    return(Result);
+}
+
+inline lane_f32
+FastsRGBToLinearRGB(lane_f32 S)
+{
+    S = Clamp01(S);
+
+    lane_f32 Base = (S + LaneF32(0.055f)) / LaneF32(1.055f);
+    lane_f32 FifthRoot = FastFifthRoot(Base);
+    lane_f32 Curve = (Base*Base)*(FifthRoot*FifthRoot);
+    lane_f32 Linear = S / LaneF32(12.92f);
+    lane_f32 Result = Select(S > LaneF32(0.04045f), Curve, Linear);
+
+    return(Result);
+}
+
+inline lane_f32
+FastLinearRGBTosRGB(lane_f32 S)
+{
+    S = Clamp01(S);
+
+    lane_f32 Root = FastCubeRoot(Max(S, LaneF32(0.0031308f)));
+    lane_f32 Curve = MulAdd(LaneF32(1.055f), Root*SquareRoot(SquareRoot(Root)), LaneF32(-0.055f));
+    lane_f32 Linear = LaneF32(12.92f)*S;
+    lane_f32 Result = Select(S > LaneF32(0.0031308f), Curve, Linear);
+
+    return(Result);
+}
+
+// NOTE: Only used by the self-test, to check the lane-wide transfer functions
+// against the libm based scalar ones
+static
+EVALUATE_TRANSFER_FUNCTION(LANE_NAME(EvaluateTransferFunction))
+{
+    int Index = 0;
+    for(;
+        (Index + LANE_WIDTH) <= Count;
+        Index += LANE_WIDTH)
+    {
+        lane_f32 S = LoadF32(Values + Index);
+        lane_f32 Result = S;
+        switch(Function)
+        {
+            case TransferFunction_Ft: {Result = FastFt(S);} break;
+            case TransferFunction_InvFt: {Result = FastInvFt(S);} break;
+            case TransferFunction_sRGBToLinearRGB: {Result = FastsRGBToLinearRGB(S);} break;
+            case TransferFunction_LinearRGBTosRGB: {Result = FastLinearRGBTosRGB(S);} break;
+            InvalidDefaultCase;
+        }
+        Store(Values + Index, Result);
+    }
+
+    EvaluateTransferFunction_Scalar(Function, Values + Index, Count - Index);
+}
+
+// NOTE: R, G and B come out of the color space's channel table, so they're
+// already linearized where the color space expects linear RGB
+inline void
+ChannelsToColor(color_space_cielab, lane_f32 R, lane_f32 G, lane_f32 B,
+                lane_f32 *X, lane_f32 *Y, lane_f32 *Z)
+{
+    // NOTE: CIEXYZ already divided by the white point
+    lane_f32 TX = MulAdd(LaneF32(0.1804375f / Xn), B, MulAdd(LaneF32(0.3575761f / Xn), G, LaneF32(0.4124564f / Xn)*R));
+    lane_f32 TY = MulAdd(LaneF32(0.0721750f / Yn), B, MulAdd(LaneF32(0.7151522f / Yn), G, LaneF32(0.2126729f / Yn)*R));
+    lane_f32 TZ = MulAdd(LaneF32(0.9503041f / Zn), B, MulAdd(LaneF32(0.1191920f / Zn), G, LaneF32(0.0193339f / Zn)*R));
+
+    lane_f32 FtX = FastFt(TX);
+    lane_f32 FtY = FastFt(TY);
+    lane_f32 FtZ = FastFt(TZ);
+
+    *X = LaneF32(116.0f)*FtY - LaneF32(16.0f);
+    *Y = LaneF32(500.0f)*(FtX - FtY);
+    *Z = LaneF32(200.0f)*(FtY - FtZ);
+}
+
+inline void
+ChannelsToColor(color_space_oklab, lane_f32 R, lane_f32 G, lane_f32 B,
+                lane_f32 *X, lane_f32 *Y, lane_f32 *Z)
+{
+    lane_f32 L = MulAdd(LaneF32(0.0514459929f), B, MulAdd(LaneF32(0.5363325363f), G, LaneF32(0.4122214708f)*R));
+    lane_f32 M = MulAdd(LaneF32(0.1073969566f), B, MulAdd(LaneF32(0.6806995451f), G, LaneF32(0.2119034982f)*R));
+    lane_f32 S = MulAdd(LaneF32(0.6299787005f), B, MulAdd(LaneF32(0.2817188376f), G, LaneF32(0.0883024619f)*R));
+
+    // NOTE: Black is the only color with a zero L, M or S, and the cube
+    // root's bit trick needs a positive input
+    lane_f32 Tiny = LaneF32(1e-30f);
+    lane_f32 LPrime = FastCubeRoot(Max(L, Tiny));
+    lane_f32 MPrime = FastCubeRoot(Max(M, Tiny));
+    lane_f32 SPrime = FastCubeRoot(Max(S, Tiny));
+
+    *X = MulAdd(LaneF32(-0.40720468f), SPrime, MulAdd(LaneF32(79.36177850f), MPrime, LaneF32(21.04542553f)*LPrime));
+    *Y = MulAdd(LaneF32(45.05937099f), SPrime, MulAdd(LaneF32(-242.85922050f), MPrime, LaneF32(197.79984951f)*LPrime));
+    *Z = MulAdd(LaneF32(-80.86757660f), SPrime, MulAdd(LaneF32(78.27717662f), MPrime, LaneF32(2.59040371f)*LPrime));
+}
+
+inline void
+ChannelsToColor(color_space_linear_rgb, lane_f32 R, lane_f32 G, lane_f32 B,
+                lane_f32 *X, lane_f32 *Y, lane_f32 *Z)
+{
+    *X = LaneF32(100.0f)*R;
+    *Y = LaneF32(100.0f)*G;
+    *Z = LaneF32(100.0f)*B;
+}
+
+inline void
+ChannelsToColor(color_space_ycbcr, lane_f32 R, lane_f32 G, lane_f32 B,
+                lane_f32 *X, lane_f32 *Y, lane_f32 *Z)
+{
+    *X = MulAdd(LaneF32(11.4f), B, MulAdd(LaneF32(58.7f), G, LaneF32(29.9f)*R));
+    *Y = MulAdd(LaneF32(50.0f), B, MulAdd(LaneF32(-33.1264f), G, LaneF32(-16.8736f)*R));
+    *Z = MulAdd(LaneF32(-8.1312f), B, MulAdd(LaneF32(-41.8688f), G, LaneF32(50.0f)*R));
+}
+
+template<typename color_space_policy>
+static
+CONVERT_TEXELS(LANE_NAME(ConvertTexels))
+{
+    f32 *ChannelTable = GetChannelTable(color_space_policy());
+    lane_u32 ChannelMask = LaneU32(0xFF);
+
+    int Index = 0;
+    for(;
+        (Index + LANE_WIDTH) <= Count;
+        Index += LANE_WIDTH)
+    {
+        lane_u32 Texel = LoadU32(Texels + Index);
+
+        lane_f32 R = Gather(ChannelTable, (Texel >> 0) & ChannelMask);
+        lane_f32 G = Gather(ChannelTable, (Texel >> 8) & ChannelMask);
+        lane_f32 B = Gather(ChannelTable, (Texel >> 16) & ChannelMask);
+
+        lane_f32 ColorX;
+        lane_f32 ColorY;
+        lane_f32 ColorZ;
+        ChannelsToColor(color_space_policy(), R, G, B, &ColorX, &ColorY, &ColorZ);
+
+        Store(X + Index, ColorX);
+        Store(Y + Index, ColorY);
+        Store(Z + Index, ColorZ);
+    }
+
+    ConvertTexels_Scalar<color_space_policy>(Texels + Index, Count - Index,
+                                             X + Index, Y + Index, Z + Index);
+}
+
+static convert_texels *LANE_NAME(ConvertTexelsTable)[ColorSpace_Count] =
+{
+    LANE_NAME(ConvertTexels)<color_space_cielab>,
+    LANE_NAME(ConvertTexels)<color_space_oklab>,
+    LANE_NAME(ConvertTexels)<color_space_linear_rgb>,
+    LANE_NAME(ConvertTexels)<color_space_ycbcr>,
+};
+
+static
+ASSIGN_OBSERVATIONS(LANE_NAME(AssignObservations))
+{
+    b32 Changed = false;
+
+    int Index = First;
+    int OnePastLast = First + Count;
+    for(;
+        (Index + LANE_WIDTH) <= OnePastLast;
+        Index += LANE_WIDTH)
+    {
+        lane_f32 ObservationX = LoadF32(Observations->X + Index);
+        lane_f32 ObservationY = LoadF32(Observations->Y + Index);
+        lane_f32 ObservationZ = LoadF32(Observations->Z + Index);
+
+        lane_f32 ClosestDistSquared = LaneF32(F32Max);
+        lane_u32 ClosestIndex = LaneU32(0);
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+
+            lane_f32 dX = LaneF32(Centroid.x) - ObservationX;
+            lane_f32 dY = LaneF32(Centroid.y) - ObservationY;
+            lane_f32 dZ = LaneF32(Centroid.z) - ObservationZ;
+            lane_f32 d = MulAdd(dZ, dZ, MulAdd(dY, dY, dX*dX));
+
+            lane_mask Closer = (d < ClosestDistSquared);
+            ClosestDistSquared = Select(Closer, d, ClosestDistSquared);
+            ClosestIndex = Select(Closer, LaneU32((u32)ClusterIndex), ClosestIndex);
+        }
+
+        // NOTE: Several lanes may land in the same cluster, so the sums are
+        // accumulated one lane at a time
+        u32 ClusterIndices_[LANE_WIDTH];
+        Store(ClusterIndices_, ClosestIndex);
+        for(int Lane = 0;
+            Lane < LANE_WIDTH;
+            Lane++)
+        {
+            u32 ClusterIndex = ClusterIndices_[Lane];
+            Assert(ClusterIndex < (u32)Context->ClusterCount);
+
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+            Cluster->ObservationSum += GetObservation(Observations, Index + Lane);
+            Cluster->ObservationCount++;
+
+            if(DetectChanges && (ClusterIndices[Index + Lane] != ClusterIndex))
+            {
+                Changed = true;
+            }
+            ClusterIndices[Index + Lane] = ClusterIndex;
+        }
+    }
+
+    if(AssignObservations_Scalar(Context, Observations, Index, OnePastLast - Index,
+                                 ClusterIndices, DetectChanges))
+    {
+        Changed = true;
+    }
+
+    return(Changed);
+}
+
+// NOTE: Same as above, but with the cluster count known at compile time the
+// distance loop is fully unrolled and every centroid is broadcast into a
+// register once per call instead of once per lane of observations
+template<int ClusterCount>
+static
+ASSIGN_OBSERVATIONS(LANE_NAME(AssignObservationsUnrolled))
+{
+    Assert(Context->ClusterCount == ClusterCount);
+
+    lane_f32 CentroidX[ClusterCount];
+    lane_f32 CentroidY[ClusterCount];
+    lane_f32 CentroidZ[ClusterCount];
+    for(int ClusterIndex = 0;
+        ClusterIndex < ClusterCount;
+        ClusterIndex++)
+    {
+        v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+        CentroidX[ClusterIndex] = LaneF32(Centroid.x);
+        CentroidY[ClusterIndex] = LaneF32(Centroid.y);
+        CentroidZ[ClusterIndex] = LaneF32(Centroid.z);
+    }
+
+    f32 SumX[ClusterCount] = {};
+    f32 SumY[ClusterCount] = {};
+    f32 SumZ[ClusterCount] = {};
+    int SumCount[ClusterCount] = {};
+
+    b32 Changed = false;
+
+    // NOTE: Each compare depends on the select before it, so two independent
+    // lanes of observations are run side by side to hide that latency
+    int Index = First;
+    int OnePastLast = First + Count;
+    for(;
+        (Index + 2*LANE_WIDTH) <= OnePastLast;
+        Index += 2*LANE_WIDTH)
+    {
+        lane_f32 ObservationX0 = LoadF32(Observations->X + Index);
+        lane_f32 ObservationY0 = LoadF32(Observations->Y + Index);
+        lane_f32 ObservationZ0 = LoadF32(Observations->Z + Index);
+        lane_f32 ObservationX1 = LoadF32(Observations->X + Index + LANE_WIDTH);
+        lane_f32 ObservationY1 = LoadF32(Observations->Y + Index + LANE_WIDTH);
+        lane_f32 ObservationZ1 = LoadF32(Observations->Z + Index + LANE_WIDTH);
+
+        lane_f32 ClosestDistSquared0 = LaneF32(F32Max);
+        lane_f32 ClosestDistSquared1 = LaneF32(F32Max);
+        lane_u32 ClosestIndex0 = LaneU32(0);
+        lane_u32 ClosestIndex1 = LaneU32(0);
+        for(int ClusterIndex = 0;
+            ClusterIndex < ClusterCount;
+            ClusterIndex++)
+        {
+            lane_u32 ClusterIndexLane = LaneU32((u32)ClusterIndex);
+
+            lane_f32 dX0 = CentroidX[ClusterIndex] - ObservationX0;
+            lane_f32 dY0 = CentroidY[ClusterIndex] - ObservationY0;
+            lane_f32 dZ0 = CentroidZ[ClusterIndex] - ObservationZ0;
+            lane_f32 d0 = MulAdd(dZ0, dZ0, MulAdd(dY0, dY0, dX0*dX0));
+
+            lane_f32 dX1 = CentroidX[ClusterIndex] - ObservationX1;
+            lane_f32 dY1 = CentroidY[ClusterIndex] - ObservationY1;
+            lane_f32 dZ1 = CentroidZ[ClusterIndex] - ObservationZ1;
+            lane_f32 d1 = MulAdd(dZ1, dZ1, MulAdd(dY1, dY1, dX1*dX1));
+
+            lane_mask Closer0 = (d0 < ClosestDistSquared0);
+            lane_mask Closer1 = (d1 < ClosestDistSquared1);
+            ClosestDistSquared0 = Select(Closer0, d0, ClosestDistSquared0);
+            ClosestDistSquared1 = Select(Closer1, d1, ClosestDistSquared1);
+            ClosestIndex0 = Select(Closer0, ClusterIndexLane, ClosestIndex0);
+            ClosestIndex1 = Select(Closer1, ClusterIndexLane, ClosestIndex1);
+        }
+
+        u32 ClusterIndices_[2*LANE_WIDTH];
+        Store(ClusterIndices_, ClosestIndex0);
+        Store(ClusterIndices_ + LANE_WIDTH, ClosestIndex1);
+        for(int Lane = 0;
+            Lane < 2*LANE_WIDTH;
+            Lane++)
+        {
+            u32 ClusterIndex = ClusterIndices_[Lane];
+            Assert(ClusterIndex < (u32)ClusterCount);
+
+            SumX[ClusterIndex] += Observations->X[Index + Lane];
+            SumY[ClusterIndex] += Observations->Y[Index + Lane];
+            SumZ[ClusterIndex] += Observations->Z[Index + Lane];
+            SumCount[ClusterIndex]++;
+
+            if(DetectChanges && (ClusterIndices[Index + Lane] != ClusterIndex))
+            {
+                Changed = true;
+            }
+            ClusterIndices[Index + Lane] = ClusterIndex;
+        }
+    }
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        Cluster->ObservationSum += V3(SumX[ClusterIndex], SumY[ClusterIndex], SumZ[ClusterIndex]);
+        Cluster->ObservationCount += SumCount[ClusterIndex];
+    }
+
+    if(LANE_NAME(AssignObservations)(Context, Observations, Index, OnePastLast - Index,
+                                     ClusterIndices, DetectChanges))
+    {
+        Changed = true;
+    }
+
+    return(Changed);
+}
+
+#define UNROLLED(ClusterCount) LANE_NAME(AssignObservationsUnrolled)<ClusterCount>
+static assign_observations *LANE_NAME(AssignObservationsUnrolledTable)[MAX_UNROLLED_CLUSTER_COUNT + 1] =
+{
+    0, 0, UNROLLED(2), UNROLLED(3), UNROLLED(4), UNROLLED(5), UNROLLED(6), UNROLLED(7),
+    UNROLLED(8), UNROLLED(9), UNROLLED(10), UNROLLED(11), UNROLLED(12), UNROLLED(13), UNROLLED(14), UNROLLED(15),
+    UNROLLED(16), 0, 0, 0, 0, 0, 0, 0,
+    UNROLLED(24), 0, 0, 0, 0, 0, 0, 0,
+    UNROLLED(32), 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    UNROLLED(48), 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    UNROLLED(64),
+};
+#undef UNROLLED
+
+// NOTE: AVX-512 has a kernel of its own to pick from, so it dispatches in
+// palettize_kernels_avx512.cpp instead (see AssignObservationsByClusterCount)
+#if LANE_WIDTH < 16
+static
+ASSIGN_OBSERVATIONS(LANE_NAME(AssignObservationsSpecialized))
+{
+    assign_observations *Kernel = LANE_NAME(AssignObservations);
+    if((Context->ClusterCount <= MAX_UNROLLED_CLUSTER_COUNT) &&
+       LANE_NAME(AssignObservationsUnrolledTable)[Context->ClusterCount])
+    {
+        Kernel = LANE_NAME(AssignObservationsUnrolledTable)[Context->ClusterCount];
+    }
+    else if(Context->ClusterCount >= MIN_KD_TREE_CLUSTERS_PER_LANE*LANE_WIDTH)
+    {
+        Kernel = AssignObservationsKDTree_Scalar;
+    }
+
+    b32 Result = Kernel(Context, Observations, First, Count, ClusterIndices, DetectChanges);
+
+    return(Result);
+}
+#endif
+
+static
+DOWNSAMPLE_ROW(LANE_NAME(DownsampleRow))
+{
+    int X = 0;
+    for(;
+        (X + LANE_WIDTH) <= Count;
+        X += LANE_WIDTH)
+    {
+        Store(DestRow + X, Gather(SourceRow, LoadU32(SampleXs + X)));
+    }
+
+    DownsampleRow_Scalar(SourceRow, SampleXs + X, Count - X, DestRow + X);
+}
+
+// NOTE: Scattering into the bins can't be done a lane at a time (two texels
+// of the same lane can hit the same bin), so only the bin indices and the
+// linear values are computed in lanes and the adds stay scalar
+static
+ACCUMULATE_HISTOGRAM(LANE_NAME(AccumulateHistogram))
+{
+    u32 Bins[LANE_WIDTH];
+    u32 Linear[3][LANE_WIDTH];
+
+    int Index = 0;
+    for(;
+        (Index + LANE_WIDTH) <= Count;
+        Index += LANE_WIDTH)
+    {
+        lane_u32 Texel = LoadU32(Texels + Index);
+        lane_u32 ChannelMask = LaneU32(0xFF);
+
+        Store(Bins, (((Texel >> 3) & LaneU32(0x001F)) +
+                     ((Texel >> 6) & LaneU32(0x03E0)) +
+                     ((Texel >> 9) & LaneU32(0x7C00))));
+        Store(Linear[0], Gather(sRGBToLinear16Table, (Texel >> 0) & ChannelMask));
+        Store(Linear[1], Gather(sRGBToLinear16Table, (Texel >> 8) & ChannelMask));
+        Store(Linear[2], Gather(sRGBToLinear16Table, (Texel >> 16) & ChannelMask));
+
+        for(int Lane = 0;
+            Lane < LANE_WIDTH;
+            Lane++)
+        {
+            u32 Bin = Bins[Lane];
+            Histogram->Counts[Bin]++;
+            u64 *LinearSum = Histogram->LinearSums[Bin];
+            LinearSum[0] += Linear[0][Lane];
+            LinearSum[1] += Linear[1][Lane];
+            LinearSum[2] += Linear[2][Lane];
+        }
+    }
+
+    AccumulateHistogram_Scalar(Texels + Index, Count - Index, Histogram);
+}
+
+#undef LANE_WIDTH
+#undef LANE_NAME
+#undef lane_f32
+#undef lane_u32
+#undef lane_mask
+#undef LaneF32
+#undef LaneU32
+#undef LoadF32
+#undef LoadU32
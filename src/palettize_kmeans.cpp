@@ -0,0 +1,1390 @@
+// NOTE: The clustering engines. Everything here works on observations that are
+// already in the configured (and weighted) color space.
+
+static observation_buffer
+AllocateObservationBuffer(int Count)
+{
+    observation_buffer Result;
+    Result.Count = Count;
+    Result.X = (f32 *)malloc(sizeof(f32)*Count);
+    Result.Y = (f32 *)malloc(sizeof(f32)*Count);
+    Result.Z = (f32 *)malloc(sizeof(f32)*Count);
+
+    return(Result);
+}
+
+static void
+ScaleObservations(observation_buffer *Observations, v3 Scale)
+{
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        Observations->X[Index] *= Scale.x;
+        Observations->Y[Index] *= Scale.y;
+        Observations->Z[Index] *= Scale.z;
+    }
+}
+
+static observation_buffer
+ConvertBitmapToObservations(bitmap Bitmap, v3 Scale)
+{
+    observation_buffer Result = AllocateObservationBuffer(Bitmap.Width*Bitmap.Height);
+    if(Result.X && Result.Y && Result.Z)
+    {
+        u8 *Row = (u8 *)Bitmap.Memory;
+        for(int Y = 0;
+            Y < Bitmap.Height;
+            Y++)
+        {
+            int First = Y*Bitmap.Width;
+            Kernels.ConvertTexels((u32 *)Row, Bitmap.Width,
+                                  Result.X + First,
+                                  Result.Y + First,
+                                  Result.Z + First);
+
+            Row += Bitmap.Pitch;
+        }
+
+        if(!EqualsApproximately(Scale, V3(1.0f, 1.0f, 1.0f)))
+        {
+            ScaleObservations(&Result, Scale);
+        }
+    }
+
+    return(Result);
+}
+
+static void
+ClearObservations(cluster *Cluster)
+{
+    Cluster->ObservationSum = V3i(0, 0, 0);
+    Cluster->ObservationCount = 0;
+}
+
+static void
+InitializeKMeansContext(kmeans_context *Context, int ClusterCount)
+{
+    Context->ClusterCount = ClusterCount;
+    Context->Clusters = (cluster *)malloc(sizeof(cluster)*ClusterCount);
+    Context->KDTree = 0;
+}
+
+static void
+FreeKMeansContext(kmeans_context *Context)
+{
+    free(Context->Clusters);
+    FreeCentroidKDTree(Context->KDTree);
+    Context->Clusters = 0;
+    Context->KDTree = 0;
+}
+
+static void
+RecalculateCentroids(kmeans_context *Context)
+{
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+
+        // Assert(Cluster->ObservationCount);
+        if(Cluster->ObservationCount)
+        {
+            Cluster->Centroid = Cluster->ObservationSum*(1.0f / (f32)Cluster->ObservationCount);
+        }
+        ClearObservations(Cluster);
+    }
+}
+
+static s64
+ComputeTotalObservationCount(kmeans_context *Context)
+{
+    s64 Result = 0;
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        Result += Cluster->ObservationCount;
+    }
+
+    return(Result);
+}
+
+static void
+SeedClustersFromObservations(kmeans_context *Context, observation_buffer *Observations,
+                             int Width, int Height, random_series *Entropy)
+{
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+
+        ClearObservations(Cluster);
+
+        u32 SampleX = RandomU32Between(Entropy, 0, (u32)(Width - 1));
+        u32 SampleY = RandomU32Between(Entropy, 0, (u32)(Height - 1));
+
+        Cluster->Centroid = GetObservation(Observations, SampleY*Width + SampleX);
+    }
+}
+
+// NOTE: Median cut seeding. The observations are recursively split at the
+// median of their widest channel, always splitting the box whose points are
+// spread furthest along it, until there is one box per cluster, and the box
+// means become the centroids. They start close to where Lloyd ends up, so it
+// needs far fewer iterations than from random samples.
+struct median_cut_box
+{
+    int First;
+    int Count;
+    v3 Mean;
+
+    int SplitAxis;
+    // NOTE: Squared error along SplitAxis, 0 if the box can't be split
+    f32 SplitError;
+};
+
+inline f32
+GetObservationChannel(observation_buffer *Observations, u32 Index, int Axis)
+{
+    f32 *Channel = ((Axis == 0) ? Observations->X :
+                    ((Axis == 1) ? Observations->Y : Observations->Z));
+    f32 Result = Channel[Index];
+
+    return(Result);
+}
+
+static void
+MeasureMedianCutBox(median_cut_box *Box, observation_buffer *Observations, u32 *Indices)
+{
+    f64 Sum[3] = {};
+    f64 SquaredSum[3] = {};
+    for(int Index = Box->First;
+        Index < (Box->First + Box->Count);
+        Index++)
+    {
+        for(int Axis = 0;
+            Axis < 3;
+            Axis++)
+        {
+            f64 Value = GetObservationChannel(Observations, Indices[Index], Axis);
+            Sum[Axis] += Value;
+            SquaredSum[Axis] += Value*Value;
+        }
+    }
+
+    f64 InvCount = 1.0 / (f64)Maximum(Box->Count, 1);
+    Box->Mean = V3((f32)(Sum[0]*InvCount), (f32)(Sum[1]*InvCount), (f32)(Sum[2]*InvCount));
+    Box->SplitAxis = 0;
+    Box->SplitError = 0.0f;
+    for(int Axis = 0;
+        Axis < 3;
+        Axis++)
+    {
+        f32 Error = (f32)(SquaredSum[Axis] - Sum[Axis]*Sum[Axis]*InvCount);
+        if((Box->Count > 1) && (Error > Box->SplitError))
+        {
+            Box->SplitAxis = Axis;
+            Box->SplitError = Error;
+        }
+    }
+}
+
+// NOTE: Quickselect, leaves the Nth smallest value along Axis at First + Nth
+// with nothing larger before it and nothing smaller after it
+static void
+SelectNthObservation(observation_buffer *Observations, u32 *Indices,
+                     int First, int Count, int Axis, int Nth)
+{
+    int Target = First + Nth;
+    int Left = First;
+    int Right = First + Count - 1;
+    while(Left < Right)
+    {
+        f32 Pivot = GetObservationChannel(Observations, Indices[(Left + Right) / 2], Axis);
+
+        int I = Left;
+        int J = Right;
+        while(I <= J)
+        {
+            while(GetObservationChannel(Observations, Indices[I], Axis) < Pivot)
+            {
+                I++;
+            }
+            while(GetObservationChannel(Observations, Indices[J], Axis) > Pivot)
+            {
+                J--;
+            }
+            if(I <= J)
+            {
+                u32 Swap = Indices[I];
+                Indices[I] = Indices[J];
+                Indices[J] = Swap;
+                I++;
+                J--;
+            }
+        }
+
+        if(Target <= J)
+        {
+            Right = J;
+        }
+        else if(Target >= I)
+        {
+            Left = I;
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+// NOTE: If there are fewer distinct observations than clusters, the clusters
+// left over are seeded from random samples like SeedClustersFromObservations.
+// Returns false if it couldn't allocate its buffers.
+static b32
+SeedClustersByMedianCut(kmeans_context *Context, observation_buffer *Observations,
+                        int Width, int Height, random_series *Entropy)
+{
+    u32 *Indices = (u32 *)malloc(sizeof(u32)*Observations->Count);
+    median_cut_box *Boxes = (median_cut_box *)malloc(sizeof(median_cut_box)*Context->ClusterCount);
+    b32 Result = (Indices && Boxes);
+    if(Result)
+    {
+        for(int Index = 0;
+            Index < Observations->Count;
+            Index++)
+        {
+            Indices[Index] = (u32)Index;
+        }
+
+        int BoxCount = 1;
+        Boxes[0].First = 0;
+        Boxes[0].Count = Observations->Count;
+        MeasureMedianCutBox(Boxes, Observations, Indices);
+        while(BoxCount < Context->ClusterCount)
+        {
+            median_cut_box *Widest = 0;
+            for(int BoxIndex = 0;
+                BoxIndex < BoxCount;
+                BoxIndex++)
+            {
+                median_cut_box *Box = Boxes + BoxIndex;
+                if((Box->SplitError > 0.0f) &&
+                   (!Widest || (Box->SplitError > Widest->SplitError)))
+                {
+                    Widest = Box;
+                }
+            }
+
+            if(!Widest)
+            {
+                break;
+            }
+
+            // NOTE: A box with any error holds two different values along its
+            // axis, so both halves come out non-empty
+            int Half = Widest->Count / 2;
+            SelectNthObservation(Observations, Indices, Widest->First, Widest->Count,
+                                 Widest->SplitAxis, Half);
+
+            median_cut_box *Upper = Boxes + BoxCount++;
+            Upper->First = Widest->First + Half;
+            Upper->Count = Widest->Count - Half;
+            Widest->Count = Half;
+            MeasureMedianCutBox(Widest, Observations, Indices);
+            MeasureMedianCutBox(Upper, Observations, Indices);
+        }
+
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+
+            ClearObservations(Cluster);
+
+            if(ClusterIndex < BoxCount)
+            {
+                Cluster->Centroid = Boxes[ClusterIndex].Mean;
+            }
+            else
+            {
+                u32 SampleX = RandomU32Between(Entropy, 0, (u32)(Width - 1));
+                u32 SampleY = RandomU32Between(Entropy, 0, (u32)(Height - 1));
+                Cluster->Centroid = GetObservation(Observations, SampleY*Width + SampleX);
+            }
+        }
+    }
+
+    free(Indices);
+    free(Boxes);
+
+    return(Result);
+}
+
+// NOTE: Lets concurrent restarts give up on runs that are clearly losing.
+// Lloyd never increases the inertia, so once a run is well behind a finished
+// one after a few iterations it's very unlikely to catch up.
+//
+// Which runs are given up on mustn't depend on which happened to finish
+// first, or the same seed would give different palettes from one run to the
+// next and with the number of processors. So a run is only ever measured
+// against the runs before it, in order: run N is dropped if at any iteration
+// the rule looked at it was more than RESTART_ABANDON_RATIO above the lowest
+// final inertia of the runs before it that weren't dropped themselves. That's
+// decided once all of them are done, but a run can stop early as soon as the
+// finished runs before it already settle it.
+#define RESTART_MIN_ITERATION_COUNT 4
+#define RESTART_ABANDON_RATIO 1.1
+struct restart_outcome
+{
+    b32 volatile Finished;
+    b32 volatile Converged;
+    f64 volatile Inertia;
+
+    // NOTE: The highest inertia the run had at any iteration that was
+    // checked, 0 if none was
+    f64 volatile CheckedInertia;
+};
+
+struct kmeans_abandon_criterion
+{
+    // NOTE: Sum of the squared lengths of every observation, which turns the
+    // cluster sums into the inertia without another pass over the image
+    f64 TotalSquaredLength;
+
+    // NOTE: One outcome per run, this one's is at RestartIndex
+    restart_outcome *Outcomes;
+    int RestartIndex;
+};
+
+inline b32
+IsRestartKept(restart_outcome *Outcome, f64 Reference)
+{
+    b32 Result = (Outcome->Converged &&
+                  !(Outcome->CheckedInertia > (RESTART_ABANDON_RATIO*Reference)));
+
+    return(Result);
+}
+
+// NOTE: The lowest final inertia of the runs before RestartIndex that are
+// kept, as far as the ones that have finished in order go. More runs
+// finishing can only lower it.
+static f64
+FindAbandonReference(restart_outcome *Outcomes, int RestartIndex)
+{
+    f64 Result = F64Max;
+
+    for(int Index = 0;
+        (Index < RestartIndex) && Outcomes[Index].Finished;
+        Index++)
+    {
+        restart_outcome *Outcome = Outcomes + Index;
+        if(IsRestartKept(Outcome, Result) && (Outcome->Inertia < Result))
+        {
+            Result = Outcome->Inertia;
+        }
+    }
+
+    return(Result);
+}
+
+static f64
+ComputeTotalSquaredLength(observation_buffer *Observations)
+{
+    f64 Result = 0.0;
+
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        Result += LengthSquared(GetObservation(Observations, Index));
+    }
+
+    return(Result);
+}
+
+// NOTE: Inertia of the current assignment around the means it's about to be
+// recentered on, sum |x - mean|^2 = sum |x|^2 - sum |cluster sum|^2 / n
+static f64
+ComputeInertiaFromSums(kmeans_context *Context, f64 TotalSquaredLength)
+{
+    f64 Result = TotalSquaredLength;
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        if(Cluster->ObservationCount)
+        {
+            Result -= (f64)LengthSquared(Cluster->ObservationSum) / (f64)Cluster->ObservationCount;
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Active set. An observation can only leave its cluster B for a
+// cluster C if C is closer to it than half the distance between B and C.
+// After a pass every observation is with its closest centroid, so for the
+// next one only the centroids that moved since can take it away, unless B
+// moved itself. Each pass first measures every observation against half the
+// distance from its centroid to the closest one of those (one distance each
+// instead of one per cluster), and only the ones that aren't clearly inside
+// are gathered into a compact buffer and assigned again. Late iterations move
+// a handful of centroids by a hair, so they mostly reassign nothing.
+//
+// A centroid only moves if its cluster gained or lost an observation, so
+// "moved" is exact (any change at all) and there's no tolerance to tune.
+// Every observation stays with the same cluster a full pass would put it in.
+//
+// NOTE: Rounding can make a distance a hair off (and the lane kernels round
+// differently than this does), so an observation is only left out when it
+// clears the bound by a little
+#define ACTIVE_SET_SLACK 1.0001f
+
+// NOTE: Sorting out the active observations costs about as much as a full pass
+// does with a few clusters per lane, so it's only worth it past this
+#define ACTIVE_SET_MIN_CLUSTERS_PER_LANE 8
+
+struct kmeans_active_set
+{
+    // NOTE: Per cluster. The sums are kept across passes and only updated for
+    // the observations that changed clusters, in double precision so a few
+    // hundred passes of adding and taking away don't drift.
+    v3 *PreviousCentroids;
+    b32 *Moved;
+    u32 *MovedClusters;
+    f32 *SafeDistancesSquared;
+    f64 *SumX;
+    f64 *SumY;
+    f64 *SumZ;
+    int *Counts;
+
+    // NOTE: Per observation, only the first Observations.Count are used on a
+    // pass
+    u32 *Indices;
+    u32 *ClusterIndices;
+    observation_buffer Observations;
+};
+
+static b32
+AllocateActiveSet(kmeans_active_set *Set, int ObservationCount, int ClusterCount)
+{
+    Set->PreviousCentroids = (v3 *)malloc(sizeof(v3)*ClusterCount);
+    Set->Moved = (b32 *)malloc(sizeof(b32)*ClusterCount);
+    Set->MovedClusters = (u32 *)malloc(sizeof(u32)*ClusterCount);
+    Set->SafeDistancesSquared = (f32 *)malloc(sizeof(f32)*ClusterCount);
+    Set->SumX = (f64 *)malloc(sizeof(f64)*ClusterCount);
+    Set->SumY = (f64 *)malloc(sizeof(f64)*ClusterCount);
+    Set->SumZ = (f64 *)malloc(sizeof(f64)*ClusterCount);
+    Set->Counts = (int *)malloc(sizeof(int)*ClusterCount);
+    Set->Indices = (u32 *)malloc(sizeof(u32)*ObservationCount);
+    Set->ClusterIndices = (u32 *)malloc(sizeof(u32)*ObservationCount);
+    Set->Observations = AllocateObservationBuffer(ObservationCount);
+
+    b32 Result = (Set->PreviousCentroids && Set->Moved && Set->MovedClusters &&
+                  Set->SafeDistancesSquared && Set->SumX && Set->SumY && Set->SumZ &&
+                  Set->Counts && Set->Indices && Set->ClusterIndices &&
+                  Set->Observations.X && Set->Observations.Y && Set->Observations.Z);
+
+    return(Result);
+}
+
+static void
+FreeActiveSet(kmeans_active_set *Set)
+{
+    free(Set->PreviousCentroids);
+    free(Set->Moved);
+    free(Set->MovedClusters);
+    free(Set->SafeDistancesSquared);
+    free(Set->SumX);
+    free(Set->SumY);
+    free(Set->SumZ);
+    free(Set->Counts);
+    free(Set->Indices);
+    free(Set->ClusterIndices);
+    free(Set->Observations.X);
+    free(Set->Observations.Y);
+    free(Set->Observations.Z);
+}
+
+// NOTE: After the first full pass, every pass after that only adjusts these
+static void
+InitializeActiveSums(kmeans_context *Context, kmeans_active_set *Set,
+                     observation_buffer *Observations, u32 *ClusterIndices)
+{
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        Set->SumX[ClusterIndex] = 0.0;
+        Set->SumY[ClusterIndex] = 0.0;
+        Set->SumZ[ClusterIndex] = 0.0;
+        Set->Counts[ClusterIndex] = 0;
+    }
+
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        u32 ClusterIndex = ClusterIndices[Index];
+        Set->SumX[ClusterIndex] += Observations->X[Index];
+        Set->SumY[ClusterIndex] += Observations->Y[Index];
+        Set->SumZ[ClusterIndex] += Observations->Z[Index];
+        Set->Counts[ClusterIndex]++;
+    }
+}
+
+static void
+SaveCentroids(kmeans_context *Context, kmeans_active_set *Set)
+{
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        Set->PreviousCentroids[ClusterIndex] = Context->Clusters[ClusterIndex].Centroid;
+    }
+}
+
+// NOTE: After the centroids are recalculated, finds the ones that moved and
+// how close to its centroid an observation has to be to stay put
+static void
+UpdateActiveSet(kmeans_context *Context, kmeans_active_set *Set)
+{
+    int MovedCount = 0;
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        v3 Previous = Set->PreviousCentroids[ClusterIndex];
+        v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+        Set->Moved[ClusterIndex] = ((Centroid.x != Previous.x) ||
+                                    (Centroid.y != Previous.y) ||
+                                    (Centroid.z != Previous.z));
+        if(Set->Moved[ClusterIndex])
+        {
+            Set->MovedClusters[MovedCount++] = ClusterIndex;
+        }
+    }
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        v3 Centroid = Context->Clusters[ClusterIndex].Centroid;
+
+        f32 ClosestSquared = F32Max;
+        if(Set->Moved[ClusterIndex])
+        {
+            for(int OtherIndex = 0;
+                OtherIndex < Context->ClusterCount;
+                OtherIndex++)
+            {
+                if(OtherIndex != ClusterIndex)
+                {
+                    f32 d = LengthSquared(Context->Clusters[OtherIndex].Centroid - Centroid);
+                    ClosestSquared = Minimum(ClosestSquared, d);
+                }
+            }
+        }
+        else
+        {
+            for(int Moved = 0;
+                Moved < MovedCount;
+                Moved++)
+            {
+                u32 OtherIndex = Set->MovedClusters[Moved];
+                f32 d = LengthSquared(Context->Clusters[OtherIndex].Centroid - Centroid);
+                ClosestSquared = Minimum(ClosestSquared, d);
+            }
+        }
+
+        // NOTE: Half the distance, squared
+        Set->SafeDistancesSquared[ClusterIndex] =
+            0.25f*ClosestSquared*(1.0f / (ACTIVE_SET_SLACK*ACTIVE_SET_SLACK));
+    }
+}
+
+// NOTE: Reassigns the observations that could change clusters and moves the
+// ones that did from one cluster's sums to the other's
+static b32
+AssignActiveObservations(kmeans_context *Context, kmeans_active_set *Set,
+                         observation_buffer *Observations, u32 *ClusterIndices)
+{
+    int ActiveCount = 0;
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        u32 ClusterIndex = ClusterIndices[Index];
+        v3 Observation = GetObservation(Observations, Index);
+        f32 d = LengthSquared(Observation - Context->Clusters[ClusterIndex].Centroid);
+
+        // NOTE: Written either way and only kept if it has to be reassigned,
+        // whether an observation stays is too random to branch on
+        Set->Indices[ActiveCount] = (u32)Index;
+        Set->ClusterIndices[ActiveCount] = ClusterIndex;
+        Set->Observations.X[ActiveCount] = Observation.x;
+        Set->Observations.Y[ActiveCount] = Observation.y;
+        Set->Observations.Z[ActiveCount] = Observation.z;
+        ActiveCount += (d >= Set->SafeDistancesSquared[ClusterIndex]);
+    }
+    Set->Observations.Count = ActiveCount;
+
+    b32 Result = false;
+    if(ActiveCount)
+    {
+        Result = Kernels.AssignObservations(Context, &Set->Observations, 0, ActiveCount,
+                                            Set->ClusterIndices, true);
+    }
+
+    for(int Active = 0;
+        Active < ActiveCount;
+        Active++)
+    {
+        u32 Index = Set->Indices[Active];
+        u32 From = ClusterIndices[Index];
+        u32 To = Set->ClusterIndices[Active];
+        if(From != To)
+        {
+            f32 X = Set->Observations.X[Active];
+            f32 Y = Set->Observations.Y[Active];
+            f32 Z = Set->Observations.Z[Active];
+
+            Set->SumX[From] -= X;
+            Set->SumY[From] -= Y;
+            Set->SumZ[From] -= Z;
+            Set->Counts[From]--;
+
+            Set->SumX[To] += X;
+            Set->SumY[To] += Y;
+            Set->SumZ[To] += Z;
+            Set->Counts[To]++;
+
+            ClusterIndices[Index] = To;
+        }
+    }
+
+    // NOTE: What the kernel accumulated only covers the active observations
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndex;
+        Cluster->ObservationSum = V3((f32)Set->SumX[ClusterIndex],
+                                     (f32)Set->SumY[ClusterIndex],
+                                     (f32)Set->SumZ[ClusterIndex]);
+        Cluster->ObservationCount = Set->Counts[ClusterIndex];
+    }
+
+    return(Result);
+}
+
+// NOTE: In exact arithmetic Lloyd always settles, but centroids are rounded,
+// and an observation exactly between two of them can be pushed one way by the
+// rounding and back the other by the centroids it then moves, forever
+#define MAX_LLOYD_ITERATION_COUNT 1000
+
+// NOTE: Lloyd iteration until no assignment changes, or for at most
+// MaxIterationCount passes (MAX_LLOYD_ITERATION_COUNT if it's 0). The first
+// pass only goes over the observations in [MinX, MaxX) x [MinY, MaxY), and
+// the cluster sums have to already hold all the others (with ClusterIndices
+// saying where they are). Past that every pass goes over every observation,
+// or only the active set if it could be allocated. Returns false if it was
+// abandoned before converging, which only happens if an Abandon criterion is
+// passed.
+//
+// NOTE: Whenever this returns, every observation is with its closest centroid
+// and the sums are of exactly those assignments, so it can be picked up again
+// later with a rectangle of observations that changed in the meantime (see
+// UpdateIncrementalPalettizer).
+static b32
+RunLloydKMeansInRect(kmeans_context *Context, observation_buffer *Observations,
+                     int Width, int Height, u32 *ClusterIndices,
+                     int MinX, int MinY, int MaxX, int MaxY, int MaxIterationCount,
+                     kmeans_abandon_criterion *Abandon = 0)
+{
+    Assert((0 <= MinX) && (MinX <= MaxX) && (MaxX <= Width));
+    Assert((0 <= MinY) && (MinY <= MaxY) && (MaxY <= Height));
+
+    b32 Result = true;
+
+    kmeans_active_set ActiveSet = {};
+    b32 UseActiveSet = false;
+    if(Context->ClusterCount >= (ACTIVE_SET_MIN_CLUSTERS_PER_LANE*Kernels.LaneWidth))
+    {
+        UseActiveSet = AllocateActiveSet(&ActiveSet, Observations->Count, Context->ClusterCount);
+    }
+
+    if(!MaxIterationCount)
+    {
+        MaxIterationCount = MAX_LLOYD_ITERATION_COUNT;
+    }
+
+    int Iteration = 0;
+    for(;
+        ;
+        Iteration++)
+    {
+        b32 Changed = false;
+
+        if(UseActiveSet && (Iteration > 0))
+        {
+            Changed = AssignActiveObservations(Context, &ActiveSet, Observations, ClusterIndices);
+        }
+        else
+        {
+            for(int Y = MinY;
+                Y < MaxY;
+                Y++)
+            {
+                if(Kernels.AssignObservations(Context, Observations,
+                                              Y*Width + MinX, MaxX - MinX,
+                                              ClusterIndices, (Iteration > 0)))
+                {
+                    Changed = true;
+                }
+            }
+
+            if(UseActiveSet)
+            {
+                InitializeActiveSums(Context, &ActiveSet, Observations, ClusterIndices);
+            }
+
+            // NOTE: Only the first pass is limited to the rectangle
+            MinX = 0;
+            MinY = 0;
+            MaxX = Width;
+            MaxY = Height;
+        }
+
+        if(Abandon && (Iteration >= RESTART_MIN_ITERATION_COUNT))
+        {
+            restart_outcome *Outcome = Abandon->Outcomes + Abandon->RestartIndex;
+            f64 Inertia = ComputeInertiaFromSums(Context, Abandon->TotalSquaredLength);
+            Outcome->CheckedInertia = Maximum(Outcome->CheckedInertia, Inertia);
+            if(Inertia > (RESTART_ABANDON_RATIO*FindAbandonReference(Abandon->Outcomes,
+                                                                     Abandon->RestartIndex)))
+            {
+                Result = false;
+                break;
+            }
+        }
+
+        if((Iteration > 0) && !Changed)
+        {
+            break;
+        }
+
+        if((Iteration + 1) >= MaxIterationCount)
+        {
+            break;
+        }
+
+        if(UseActiveSet)
+        {
+            SaveCentroids(Context, &ActiveSet);
+            RecalculateCentroids(Context);
+            UpdateActiveSet(Context, &ActiveSet);
+        }
+        else
+        {
+            RecalculateCentroids(Context);
+        }
+    }
+
+    FreeActiveSet(&ActiveSet);
+
+    return(Result);
+}
+
+static b32
+RunLloydKMeans(kmeans_context *Context, observation_buffer *Observations,
+               int Width, int Height, u32 *ClusterIndices,
+               kmeans_abandon_criterion *Abandon = 0)
+{
+    b32 Result = RunLloydKMeansInRect(Context, Observations, Width, Height, ClusterIndices,
+                                      0, 0, Width, Height, 0, Abandon);
+
+    return(Result);
+}
+
+// 
+// Restarts
+// 
+
+#define MAX_RESTART_COUNT 64
+
+struct kmeans_restart
+{
+    kmeans_context Context;
+    random_series Entropy;
+    b32 Seeded;
+    u32 *ClusterIndices;
+
+    observation_buffer *Observations;
+    int Width;
+    int Height;
+    kmeans_abandon_criterion Abandon;
+};
+
+static f64
+ComputeInertia(kmeans_context *Context, observation_buffer *Observations, u32 *ClusterIndices)
+{
+    f64 Result = 0.0;
+
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        cluster *Cluster = Context->Clusters + ClusterIndices[Index];
+        Result += LengthSquared(GetObservation(Observations, Index) - Cluster->Centroid);
+    }
+
+    return(Result);
+}
+
+static
+WORK_QUEUE_CALLBACK(RunKMeansRestart)
+{
+    kmeans_restart *Restart = (kmeans_restart *)Data;
+
+    if(!Restart->Seeded)
+    {
+        SeedClustersFromObservations(&Restart->Context, Restart->Observations,
+                                     Restart->Width, Restart->Height, &Restart->Entropy);
+    }
+    restart_outcome *Outcome = Restart->Abandon.Outcomes + Restart->Abandon.RestartIndex;
+    Outcome->Converged = RunLloydKMeans(&Restart->Context, Restart->Observations,
+                                        Restart->Width, Restart->Height,
+                                        Restart->ClusterIndices, &Restart->Abandon);
+    if(Outcome->Converged)
+    {
+        Outcome->Inertia = ComputeInertia(&Restart->Context, Restart->Observations,
+                                          Restart->ClusterIndices);
+    }
+
+    CompletePreviousWritesBeforeFutureWrites;
+    Outcome->Finished = true;
+}
+
+// NOTE: Runs RestartCount independently seeded Lloyd runs on the queue, all
+// reading the same observations, and leaves the one with the lowest inertia
+// in Context. Restart 0 is seeded exactly like a single run, so one restart
+// gives the same result as calling RunLloydKMeans directly, unless Seeded is
+// set, in which case it starts from the centroids already in Context. Returns
+// false if it couldn't allocate its buffers.
+static b32
+RunLloydKMeansWithRestarts(kmeans_context *Context, observation_buffer *Observations,
+                           int Width, int Height, u32 Seed, int RestartCount,
+                           b32 Seeded, work_queue *Queue)
+{
+    b32 Result = false;
+
+    Assert((1 <= RestartCount) && (RestartCount <= MAX_RESTART_COUNT));
+
+    f64 TotalSquaredLength = ComputeTotalSquaredLength(Observations);
+
+    kmeans_restart Restarts[MAX_RESTART_COUNT] = {};
+    restart_outcome Outcomes[MAX_RESTART_COUNT] = {};
+    b32 Allocated = true;
+    for(int RestartIndex = 0;
+        RestartIndex < RestartCount;
+        RestartIndex++)
+    {
+        kmeans_restart *Restart = Restarts + RestartIndex;
+
+        InitializeKMeansContext(&Restart->Context, Context->ClusterCount);
+        Restart->Entropy = SeedSeries(Seed, (u32)RestartIndex);
+        Restart->ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations->Count);
+        Restart->Observations = Observations;
+        Restart->Width = Width;
+        Restart->Height = Height;
+        Restart->Abandon.TotalSquaredLength = TotalSquaredLength;
+        Restart->Abandon.Outcomes = Outcomes;
+        Restart->Abandon.RestartIndex = RestartIndex;
+
+        if(!Restart->Context.Clusters || !Restart->ClusterIndices)
+        {
+            Allocated = false;
+        }
+        else if(Seeded && (RestartIndex == 0))
+        {
+            Restart->Seeded = true;
+            for(int ClusterIndex = 0;
+                ClusterIndex < Context->ClusterCount;
+                ClusterIndex++)
+            {
+                Restart->Context.Clusters[ClusterIndex] = Context->Clusters[ClusterIndex];
+            }
+        }
+    }
+
+    if(Allocated)
+    {
+        for(int RestartIndex = 0;
+            RestartIndex < RestartCount;
+            RestartIndex++)
+        {
+            AddEntry(Queue, RunKMeansRestart, Restarts + RestartIndex);
+        }
+        CompleteAllWork(Queue);
+
+        // NOTE: The same walk FindAbandonReference does, over every run.
+        // The first run is never abandoned, so there's always at least one.
+        // Ties go to the lowest restart index.
+        kmeans_restart *Best = 0;
+        f64 BestInertia = F64Max;
+        for(int RestartIndex = 0;
+            RestartIndex < RestartCount;
+            RestartIndex++)
+        {
+            restart_outcome *Outcome = Outcomes + RestartIndex;
+            if(IsRestartKept(Outcome, BestInertia) && (Outcome->Inertia < BestInertia))
+            {
+                Best = Restarts + RestartIndex;
+                BestInertia = Outcome->Inertia;
+            }
+        }
+        Assert(Best);
+
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            Context->Clusters[ClusterIndex] = Best->Context.Clusters[ClusterIndex];
+        }
+
+        Result = true;
+    }
+
+    for(int RestartIndex = 0;
+        RestartIndex < RestartCount;
+        RestartIndex++)
+    {
+        kmeans_restart *Restart = Restarts + RestartIndex;
+        FreeKMeansContext(&Restart->Context);
+        free(Restart->ClusterIndices);
+    }
+
+    return(Result);
+}
+
+// 
+// Mini-batch k-means
+// 
+
+// NOTE: Instead of assigning every texel on every iteration, the mini-batch
+// engine (Sculley, "Web-Scale K-Means Clustering") assigns small random
+// batches drawn from the full resolution image and moves each centroid
+// towards the mean of its share of the batch. Each cluster's learning rate is
+// the fraction of all observations it has seen that came from this batch, so
+// a centroid is the running mean of everything ever assigned to it and
+// settles down as it accumulates evidence. Only the batch is converted to the
+// color space, so memory beyond the decoded image stays constant.
+#define DEFAULT_MINI_BATCH_SIZE 4096
+#define MAX_MINI_BATCH_COUNT 1000
+// NOTE: The run is considered converged once no centroid has moved further
+// than this (in weighted color space units) for this many batches in a row
+#define MINI_BATCH_TOLERANCE 0.01f
+#define MINI_BATCH_STABLE_BATCH_COUNT 10
+// NOTE: Cluster weights are counted over fresh batches with the final
+// centroids, since the counts gathered while they were still moving are
+// skewed towards wherever they started
+#define MINI_BATCH_WEIGHT_BATCH_COUNT 16
+
+static void
+DrawMiniBatch(bitmap Source, v3 Scale, random_series *Entropy,
+              u32 *Texels, observation_buffer *Batch)
+{
+    Assert(Source.Pitch == (int)sizeof(u32)*Source.Width);
+
+    u32 *SourceTexels = (u32 *)Source.Memory;
+    u64 TexelCount = (u64)((s64)Source.Width*Source.Height);
+    for(int Index = 0;
+        Index < Batch->Count;
+        Index++)
+    {
+        Texels[Index] = SourceTexels[RandomU64Between(Entropy, 0, TexelCount)];
+    }
+
+    Kernels.ConvertTexels(Texels, Batch->Count, Batch->X, Batch->Y, Batch->Z);
+    if(!EqualsApproximately(Scale, V3(1.0f, 1.0f, 1.0f)))
+    {
+        ScaleObservations(Batch, Scale);
+    }
+}
+
+// NOTE: Returns the number of batches it took, or 0 if it couldn't allocate
+// its buffers
+static int
+RunMiniBatchKMeans(kmeans_context *Context, bitmap Source, v3 Scale,
+                   int BatchSize, random_series *Entropy)
+{
+    int Result = 0;
+
+    // NOTE: Seeding takes its centroids from the first batch
+    BatchSize = Maximum(BatchSize, Context->ClusterCount);
+
+    observation_buffer Batch = AllocateObservationBuffer(BatchSize);
+    u32 *Texels = (u32 *)malloc(sizeof(u32)*BatchSize);
+    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*BatchSize);
+    s64 *SeenCounts = (s64 *)malloc(sizeof(s64)*Context->ClusterCount);
+    if(Batch.X && Batch.Y && Batch.Z &&
+       Texels && ClusterIndices && SeenCounts)
+    {
+        DrawMiniBatch(Source, Scale, Entropy, Texels, &Batch);
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+
+            ClearObservations(Cluster);
+            Cluster->Centroid = GetObservation(&Batch, ClusterIndex);
+            SeenCounts[ClusterIndex] = 0;
+        }
+
+        int StableBatchCount = 0;
+        while((Result < MAX_MINI_BATCH_COUNT) &&
+              (StableBatchCount < MINI_BATCH_STABLE_BATCH_COUNT))
+        {
+            DrawMiniBatch(Source, Scale, Entropy, Texels, &Batch);
+            Kernels.AssignObservations(Context, &Batch, 0, Batch.Count, ClusterIndices, false);
+            Result++;
+
+            f32 MaxShiftSquared = 0.0f;
+            for(int ClusterIndex = 0;
+                ClusterIndex < Context->ClusterCount;
+                ClusterIndex++)
+            {
+                cluster *Cluster = Context->Clusters + ClusterIndex;
+                if(Cluster->ObservationCount)
+                {
+                    SeenCounts[ClusterIndex] += Cluster->ObservationCount;
+
+                    f32 LearningRate = ((f32)Cluster->ObservationCount /
+                                        (f32)SeenCounts[ClusterIndex]);
+                    v3 BatchMean = Cluster->ObservationSum*(1.0f / (f32)Cluster->ObservationCount);
+                    v3 Shift = (BatchMean - Cluster->Centroid)*LearningRate;
+
+                    Cluster->Centroid += Shift;
+                    MaxShiftSquared = Maximum(MaxShiftSquared, LengthSquared(Shift));
+                }
+                ClearObservations(Cluster);
+            }
+
+            if(MaxShiftSquared < Square(MINI_BATCH_TOLERANCE))
+            {
+                StableBatchCount++;
+            }
+            else
+            {
+                StableBatchCount = 0;
+            }
+        }
+
+        for(int BatchIndex = 0;
+            BatchIndex < MINI_BATCH_WEIGHT_BATCH_COUNT;
+            BatchIndex++)
+        {
+            DrawMiniBatch(Source, Scale, Entropy, Texels, &Batch);
+            Kernels.AssignObservations(Context, &Batch, 0, Batch.Count, ClusterIndices, false);
+        }
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            Context->Clusters[ClusterIndex].ObservationSum = V3i(0, 0, 0);
+        }
+    }
+
+    free(Batch.X);
+    free(Batch.Y);
+    free(Batch.Z);
+    free(Texels);
+    free(ClusterIndices);
+    free(SeenCounts);
+
+    return(Result);
+}
+
+// 
+// Automatic cluster count
+// 
+
+// NOTE: Replaces the cluster with the largest squared error (the one whose
+// split is likely to lower the inertia the most) by two clusters one
+// standard deviation either side of its centroid, along the channel it
+// varies the most in. The new cluster goes at the end. ClusterIndices has to
+// hold the assignment the centroids were computed from.
+static void
+SplitWidestCluster(kmeans_context *Context, observation_buffer *Observations, u32 *ClusterIndices)
+{
+    Assert(Context->ClusterCount < MAX_CLUSTER_COUNT);
+
+    v3 SquaredErrors[MAX_CLUSTER_COUNT] = {};
+    int Counts[MAX_CLUSTER_COUNT] = {};
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        u32 ClusterIndex = ClusterIndices[Index];
+        v3 Delta = GetObservation(Observations, Index) - Context->Clusters[ClusterIndex].Centroid;
+        SquaredErrors[ClusterIndex] += Hadamard(Delta, Delta);
+        Counts[ClusterIndex]++;
+    }
+
+    int WidestIndex = 0;
+    f32 WidestError = -1.0f;
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        v3 Error = SquaredErrors[ClusterIndex];
+        f32 TotalError = Error.x + Error.y + Error.z;
+        if(TotalError > WidestError)
+        {
+            WidestError = TotalError;
+            WidestIndex = ClusterIndex;
+        }
+    }
+
+    v3 Variance = SquaredErrors[WidestIndex]*SafeRatio0(1.0f, (f32)Counts[WidestIndex]);
+    v3 Offset = V3(0.0f, 0.0f, 0.0f);
+    if((Variance.x >= Variance.y) && (Variance.x >= Variance.z))
+    {
+        Offset.x = SquareRoot(Variance.x);
+    }
+    else if(Variance.y >= Variance.z)
+    {
+        Offset.y = SquareRoot(Variance.y);
+    }
+    else
+    {
+        Offset.z = SquareRoot(Variance.z);
+    }
+
+    cluster *Widest = Context->Clusters + WidestIndex;
+    cluster *Split = Context->Clusters + Context->ClusterCount++;
+    Split->Centroid = Widest->Centroid + Offset;
+    Widest->Centroid = Widest->Centroid - Offset;
+}
+
+// NOTE: Simplified silhouette, which measures each observation against
+// centroids instead of every other observation: (b - a) / b, where a and b
+// are the distances to the closest and second closest centroid. Same cost as
+// an assignment pass.
+static f32
+ComputeApproximateSilhouette(kmeans_context *Context, observation_buffer *Observations)
+{
+    Assert(Context->ClusterCount >= 2);
+
+    f64 Sum = 0.0;
+    for(int Index = 0;
+        Index < Observations->Count;
+        Index++)
+    {
+        v3 Observation = GetObservation(Observations, Index);
+
+        f32 Closest = F32Max;
+        f32 SecondClosest = F32Max;
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            f32 DistanceSquared = LengthSquared(Observation - Context->Clusters[ClusterIndex].Centroid);
+            if(DistanceSquared < Closest)
+            {
+                SecondClosest = Closest;
+                Closest = DistanceSquared;
+            }
+            else if(DistanceSquared < SecondClosest)
+            {
+                SecondClosest = DistanceSquared;
+            }
+        }
+
+        f32 A = SquareRoot(Closest);
+        f32 B = SquareRoot(SecondClosest);
+        Sum += SafeRatio0(B - A, B);
+    }
+
+    f32 Result = (f32)(Sum / (f64)Maximum(Observations->Count, 1));
+
+    return(Result);
+}
+
+// NOTE: The knee of the inertia curve, i.e. the count furthest below the
+// straight line between the first and last count once both axes are
+// normalized to [0, 1]
+static int
+FindElbow(f64 *Inertias, int Count)
+{
+    int Result = 0;
+
+    if(Count > 2)
+    {
+        f64 First = Inertias[0];
+        f64 Last = Inertias[Count - 1];
+        f64 Range = First - Last;
+
+        f64 BestDepth = 0.0;
+        for(int Index = 1;
+            Index < (Count - 1);
+            Index++)
+        {
+            f64 X = (f64)Index / (f64)(Count - 1);
+            f64 Y = (Range > 0.0) ? ((Inertias[Index] - Last) / Range) : 1.0;
+            f64 Depth = (1.0 - X) - Y;
+            if(Depth > BestDepth)
+            {
+                BestDepth = Depth;
+                Result = Index;
+            }
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: One count of the sweep. Every count after the first splits the
+// widest cluster of the one before, then Lloyd settles it. After the restarts
+// the first count only re-derives the cluster indices, which converges in a
+// single iteration.
+static void
+AdvanceClusterCountSweep(kmeans_context *Context, observation_buffer *Observations,
+                         int Width, int Height, u32 *ClusterIndices, b32 Split)
+{
+    if(Split)
+    {
+        SplitWidestCluster(Context, Observations, ClusterIndices);
+    }
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        ClearObservations(Context->Clusters + ClusterIndex);
+    }
+    RunLloydKMeans(Context, Observations, Width, Height, ClusterIndices);
+}
+
+// NOTE: Runs Lloyd for every cluster count from MinClusterCount to
+// MaxClusterCount over the same observations and leaves the count picked by
+// Criterion in Context. Only the first count is seeded (with restarts, if
+// asked for, and from Context's centroids if Seeded is set), every later one
+// starts from the previous result with its widest cluster split in two, so it
+// usually converges in a few iterations.
+//
+// Every count follows from the first one without any randomness, so only the
+// first count's clusters are kept, and the picked count is rebuilt by running
+// the sweep again up to it. Keeping every count instead would take hundreds
+// of megabytes at the largest counts.
+// Returns the picked count, or 0 if it couldn't allocate its buffers.
+static int
+RunClusterCountSweep(kmeans_context *Context, observation_buffer *Observations,
+                     int Width, int Height, u32 Seed, int RestartCount,
+                     int MinClusterCount, int MaxClusterCount,
+                     cluster_count_criterion Criterion, b32 Seeded, work_queue *Queue)
+{
+    int Result = 0;
+
+    Assert((1 <= MinClusterCount) && (MinClusterCount <= MaxClusterCount));
+    Assert(MaxClusterCount <= MAX_CLUSTER_COUNT);
+
+    int SweepCount = MaxClusterCount - MinClusterCount + 1;
+    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*Observations->Count);
+    cluster *FirstClusters = (cluster *)malloc(sizeof(cluster)*MinClusterCount);
+    if(ClusterIndices && FirstClusters)
+    {
+        f64 Inertias[MAX_CLUSTER_COUNT];
+        f32 Silhouettes[MAX_CLUSTER_COUNT];
+
+        Context->ClusterCount = MinClusterCount;
+        if(RunLloydKMeansWithRestarts(Context, Observations, Width, Height,
+                                      Seed, RestartCount, Seeded, Queue))
+        {
+            for(int ClusterIndex = 0;
+                ClusterIndex < MinClusterCount;
+                ClusterIndex++)
+            {
+                FirstClusters[ClusterIndex] = Context->Clusters[ClusterIndex];
+            }
+
+            for(int SweepIndex = 0;
+                SweepIndex < SweepCount;
+                SweepIndex++)
+            {
+                AdvanceClusterCountSweep(Context, Observations, Width, Height, ClusterIndices,
+                                         (SweepIndex > 0));
+
+                Inertias[SweepIndex] = ComputeInertia(Context, Observations, ClusterIndices);
+                if(Criterion == ClusterCountCriterion_Silhouette)
+                {
+                    Silhouettes[SweepIndex] = ComputeApproximateSilhouette(Context, Observations);
+                }
+            }
+
+            int PickedIndex = 0;
+            switch(Criterion)
+            {
+                case ClusterCountCriterion_Elbow:
+                {
+                    PickedIndex = FindElbow(Inertias, SweepCount);
+                } break;
+
+                case ClusterCountCriterion_Silhouette:
+                {
+                    for(int SweepIndex = 1;
+                        SweepIndex < SweepCount;
+                        SweepIndex++)
+                    {
+                        if(Silhouettes[SweepIndex] > Silhouettes[PickedIndex])
+                        {
+                            PickedIndex = SweepIndex;
+                        }
+                    }
+                } break;
+
+                InvalidDefaultCase;
+            }
+
+            // NOTE: The last count is already in Context
+            if(PickedIndex < (SweepCount - 1))
+            {
+                Context->ClusterCount = MinClusterCount;
+                for(int ClusterIndex = 0;
+                    ClusterIndex < MinClusterCount;
+                    ClusterIndex++)
+                {
+                    Context->Clusters[ClusterIndex] = FirstClusters[ClusterIndex];
+                }
+
+                for(int SweepIndex = 0;
+                    SweepIndex <= PickedIndex;
+                    SweepIndex++)
+                {
+                    AdvanceClusterCountSweep(Context, Observations, Width, Height, ClusterIndices,
+                                             (SweepIndex > 0));
+                }
+            }
+            Assert(Context->ClusterCount == (MinClusterCount + PickedIndex));
+
+            Result = Context->ClusterCount;
+        }
+    }
+
+    free(ClusterIndices);
+    free(FirstClusters);
+
+    return(Result);
+}
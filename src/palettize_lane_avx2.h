@@ -0,0 +1,270 @@
+#if !defined(PALETTIZE_LANE_AVX2_H)
+
+// NOTE: 8-wide lanes for the AVX2 kernels. Only ever included by
+// palettize_kernels.cpp, inside a BEGIN_TARGET("avx2,fma") block.
+
+struct lane_f32x8
+{
+    __m256 V;
+};
+
+struct lane_u32x8
+{
+    __m256i V;
+};
+
+struct lane_maskx8
+{
+    __m256 V;
+};
+
+inline lane_f32x8
+LaneF32x8(f32 S)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_set1_ps(S);
+
+    return(Result);
+}
+
+inline lane_u32x8
+LaneU32x8(u32 S)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_set1_epi32((int)S);
+
+    return(Result);
+}
+
+inline lane_f32x8
+LoadF32x8(f32 *Source)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_loadu_ps(Source);
+
+    return(Result);
+}
+
+inline lane_u32x8
+LoadU32x8(u32 *Source)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_loadu_si256((__m256i *)Source);
+
+    return(Result);
+}
+
+inline void
+Store(f32 *Dest, lane_f32x8 A)
+{
+    _mm256_storeu_ps(Dest, A.V);
+}
+
+inline void
+Store(u32 *Dest, lane_u32x8 A)
+{
+    _mm256_storeu_si256((__m256i *)Dest, A.V);
+}
+
+inline lane_f32x8
+operator+(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_add_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+operator-(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_sub_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+operator*(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_mul_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+operator/(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_div_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+MulAdd(lane_f32x8 A, lane_f32x8 B, lane_f32x8 C)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_fmadd_ps(A.V, B.V, C.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+Min(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_min_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+Max(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_max_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+SquareRoot(lane_f32x8 A)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_sqrt_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_maskx8
+operator<(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_maskx8 Result;
+    Result.V = _mm256_cmp_ps(A.V, B.V, _CMP_LT_OQ);
+
+    return(Result);
+}
+
+inline lane_maskx8
+operator>(lane_f32x8 A, lane_f32x8 B)
+{
+    lane_maskx8 Result;
+    Result.V = _mm256_cmp_ps(A.V, B.V, _CMP_GT_OQ);
+
+    return(Result);
+}
+
+inline lane_f32x8
+Select(lane_maskx8 Mask, lane_f32x8 IfTrue, lane_f32x8 IfFalse)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_blendv_ps(IfFalse.V, IfTrue.V, Mask.V);
+
+    return(Result);
+}
+
+inline lane_u32x8
+Select(lane_maskx8 Mask, lane_u32x8 IfTrue, lane_u32x8 IfFalse)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_blendv_epi8(IfFalse.V, IfTrue.V, _mm256_castps_si256(Mask.V));
+
+    return(Result);
+}
+
+inline lane_u32x8
+operator+(lane_u32x8 A, lane_u32x8 B)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_add_epi32(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x8
+BitsOf(lane_f32x8 A)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_castps_si256(A.V);
+
+    return(Result);
+}
+
+inline lane_f32x8
+FromBits(lane_u32x8 A)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_castsi256_ps(A.V);
+
+    return(Result);
+}
+
+// NOTE: Treats A as signed, which is fine for anything below 2^31
+inline lane_f32x8
+ConvertToF32(lane_u32x8 A)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_cvtepi32_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x8
+TruncateToU32(lane_f32x8 A)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_cvttps_epi32(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x8
+operator&(lane_u32x8 A, lane_u32x8 B)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_and_si256(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x8
+operator>>(lane_u32x8 A, int Shift)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_srli_epi32(A.V, Shift);
+
+    return(Result);
+}
+
+inline lane_f32x8
+Gather(f32 *Table, lane_u32x8 Indices)
+{
+    lane_f32x8 Result;
+    Result.V = _mm256_i32gather_ps(Table, Indices.V, sizeof(f32));
+
+    return(Result);
+}
+
+inline lane_u32x8
+Gather(u32 *Table, lane_u32x8 Indices)
+{
+    lane_u32x8 Result;
+    Result.V = _mm256_i32gather_epi32((int *)Table, Indices.V, sizeof(u32));
+
+    return(Result);
+}
+
+#define LANE_WIDTH 8
+#define LANE_NAME(Name) Name##_AVX2
+#define lane_f32 lane_f32x8
+#define lane_u32 lane_u32x8
+#define lane_mask lane_maskx8
+#define LaneF32 LaneF32x8
+#define LaneU32 LaneU32x8
+#define LoadF32 LoadF32x8
+#define LoadU32 LoadU32x8
+
+#define PALETTIZE_LANE_AVX2_H
+#endif
@@ -0,0 +1,271 @@
+#if !defined(PALETTIZE_LANE_AVX512_H)
+
+// NOTE: 16-wide lanes for the AVX-512 kernels. Only ever included by
+// palettize_kernels.cpp, inside a BEGIN_TARGET("avx512f,...") block.
+// Unlike SSE and AVX2, comparisons produce a k-register bitmask.
+
+struct lane_f32x16
+{
+    __m512 V;
+};
+
+struct lane_u32x16
+{
+    __m512i V;
+};
+
+struct lane_maskx16
+{
+    __mmask16 V;
+};
+
+inline lane_f32x16
+LaneF32x16(f32 S)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_set1_ps(S);
+
+    return(Result);
+}
+
+inline lane_u32x16
+LaneU32x16(u32 S)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_set1_epi32((int)S);
+
+    return(Result);
+}
+
+inline lane_f32x16
+LoadF32x16(f32 *Source)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_loadu_ps(Source);
+
+    return(Result);
+}
+
+inline lane_u32x16
+LoadU32x16(u32 *Source)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_loadu_si512(Source);
+
+    return(Result);
+}
+
+inline void
+Store(f32 *Dest, lane_f32x16 A)
+{
+    _mm512_storeu_ps(Dest, A.V);
+}
+
+inline void
+Store(u32 *Dest, lane_u32x16 A)
+{
+    _mm512_storeu_si512(Dest, A.V);
+}
+
+inline lane_f32x16
+operator+(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_add_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+operator-(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_sub_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+operator*(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_mul_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+operator/(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_div_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+MulAdd(lane_f32x16 A, lane_f32x16 B, lane_f32x16 C)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_fmadd_ps(A.V, B.V, C.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+Min(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_min_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+Max(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_max_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+SquareRoot(lane_f32x16 A)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_sqrt_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_maskx16
+operator<(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_maskx16 Result;
+    Result.V = _mm512_cmp_ps_mask(A.V, B.V, _CMP_LT_OQ);
+
+    return(Result);
+}
+
+inline lane_maskx16
+operator>(lane_f32x16 A, lane_f32x16 B)
+{
+    lane_maskx16 Result;
+    Result.V = _mm512_cmp_ps_mask(A.V, B.V, _CMP_GT_OQ);
+
+    return(Result);
+}
+
+inline lane_f32x16
+Select(lane_maskx16 Mask, lane_f32x16 IfTrue, lane_f32x16 IfFalse)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_mask_blend_ps(Mask.V, IfFalse.V, IfTrue.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+Select(lane_maskx16 Mask, lane_u32x16 IfTrue, lane_u32x16 IfFalse)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_mask_blend_epi32(Mask.V, IfFalse.V, IfTrue.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+operator+(lane_u32x16 A, lane_u32x16 B)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_add_epi32(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+BitsOf(lane_f32x16 A)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_castps_si512(A.V);
+
+    return(Result);
+}
+
+inline lane_f32x16
+FromBits(lane_u32x16 A)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_castsi512_ps(A.V);
+
+    return(Result);
+}
+
+// NOTE: Treats A as signed, which is fine for anything below 2^31
+inline lane_f32x16
+ConvertToF32(lane_u32x16 A)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_cvtepi32_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+TruncateToU32(lane_f32x16 A)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_cvttps_epi32(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+operator&(lane_u32x16 A, lane_u32x16 B)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_and_si512(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x16
+operator>>(lane_u32x16 A, int Shift)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_srli_epi32(A.V, (unsigned int)Shift);
+
+    return(Result);
+}
+
+inline lane_f32x16
+Gather(f32 *Table, lane_u32x16 Indices)
+{
+    lane_f32x16 Result;
+    Result.V = _mm512_i32gather_ps(Indices.V, Table, sizeof(f32));
+
+    return(Result);
+}
+
+inline lane_u32x16
+Gather(u32 *Table, lane_u32x16 Indices)
+{
+    lane_u32x16 Result;
+    Result.V = _mm512_i32gather_epi32(Indices.V, Table, sizeof(u32));
+
+    return(Result);
+}
+
+#define LANE_WIDTH 16
+#define LANE_NAME(Name) Name##_AVX512
+#define lane_f32 lane_f32x16
+#define lane_u32 lane_u32x16
+#define lane_mask lane_maskx16
+#define LaneF32 LaneF32x16
+#define LaneU32 LaneU32x16
+#define LoadF32 LoadF32x16
+#define LoadU32 LoadU32x16
+
+#define PALETTIZE_LANE_AVX512_H
+#endif
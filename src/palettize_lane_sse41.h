@@ -0,0 +1,277 @@
+#if !defined(PALETTIZE_LANE_SSE41_H)
+
+// NOTE: 4-wide lanes for the SSE4.1 kernels. Only ever included by
+// palettize_kernels.cpp, inside a BEGIN_TARGET("sse4.1") block.
+
+struct lane_f32x4
+{
+    __m128 V;
+};
+
+struct lane_u32x4
+{
+    __m128i V;
+};
+
+struct lane_maskx4
+{
+    __m128 V;
+};
+
+inline lane_f32x4
+LaneF32x4(f32 S)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_set1_ps(S);
+
+    return(Result);
+}
+
+inline lane_u32x4
+LaneU32x4(u32 S)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_set1_epi32((int)S);
+
+    return(Result);
+}
+
+inline lane_f32x4
+LoadF32x4(f32 *Source)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_loadu_ps(Source);
+
+    return(Result);
+}
+
+inline lane_u32x4
+LoadU32x4(u32 *Source)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_loadu_si128((__m128i *)Source);
+
+    return(Result);
+}
+
+inline void
+Store(f32 *Dest, lane_f32x4 A)
+{
+    _mm_storeu_ps(Dest, A.V);
+}
+
+inline void
+Store(u32 *Dest, lane_u32x4 A)
+{
+    _mm_storeu_si128((__m128i *)Dest, A.V);
+}
+
+inline lane_f32x4
+operator+(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_add_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+operator-(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_sub_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+operator*(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_mul_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+operator/(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_div_ps(A.V, B.V);
+
+    return(Result);
+}
+
+// NOTE: A*B + C. SSE4.1 has no FMA, so this rounds twice.
+inline lane_f32x4
+MulAdd(lane_f32x4 A, lane_f32x4 B, lane_f32x4 C)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_add_ps(_mm_mul_ps(A.V, B.V), C.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+Min(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_min_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+Max(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_max_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+SquareRoot(lane_f32x4 A)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_sqrt_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_maskx4
+operator<(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_maskx4 Result;
+    Result.V = _mm_cmplt_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_maskx4
+operator>(lane_f32x4 A, lane_f32x4 B)
+{
+    lane_maskx4 Result;
+    Result.V = _mm_cmpgt_ps(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+Select(lane_maskx4 Mask, lane_f32x4 IfTrue, lane_f32x4 IfFalse)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_blendv_ps(IfFalse.V, IfTrue.V, Mask.V);
+
+    return(Result);
+}
+
+inline lane_u32x4
+Select(lane_maskx4 Mask, lane_u32x4 IfTrue, lane_u32x4 IfFalse)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_blendv_epi8(IfFalse.V, IfTrue.V, _mm_castps_si128(Mask.V));
+
+    return(Result);
+}
+
+inline lane_u32x4
+operator+(lane_u32x4 A, lane_u32x4 B)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_add_epi32(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x4
+BitsOf(lane_f32x4 A)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_castps_si128(A.V);
+
+    return(Result);
+}
+
+inline lane_f32x4
+FromBits(lane_u32x4 A)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_castsi128_ps(A.V);
+
+    return(Result);
+}
+
+// NOTE: Treats A as signed, which is fine for anything below 2^31
+inline lane_f32x4
+ConvertToF32(lane_u32x4 A)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_cvtepi32_ps(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x4
+TruncateToU32(lane_f32x4 A)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_cvttps_epi32(A.V);
+
+    return(Result);
+}
+
+inline lane_u32x4
+operator&(lane_u32x4 A, lane_u32x4 B)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_and_si128(A.V, B.V);
+
+    return(Result);
+}
+
+inline lane_u32x4
+operator>>(lane_u32x4 A, int Shift)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_srli_epi32(A.V, Shift);
+
+    return(Result);
+}
+
+inline lane_f32x4
+Gather(f32 *Table, lane_u32x4 Indices)
+{
+    lane_f32x4 Result;
+    Result.V = _mm_setr_ps(Table[(u32)_mm_extract_epi32(Indices.V, 0)],
+                           Table[(u32)_mm_extract_epi32(Indices.V, 1)],
+                           Table[(u32)_mm_extract_epi32(Indices.V, 2)],
+                           Table[(u32)_mm_extract_epi32(Indices.V, 3)]);
+
+    return(Result);
+}
+
+inline lane_u32x4
+Gather(u32 *Table, lane_u32x4 Indices)
+{
+    lane_u32x4 Result;
+    Result.V = _mm_setr_epi32((int)Table[(u32)_mm_extract_epi32(Indices.V, 0)],
+                              (int)Table[(u32)_mm_extract_epi32(Indices.V, 1)],
+                              (int)Table[(u32)_mm_extract_epi32(Indices.V, 2)],
+                              (int)Table[(u32)_mm_extract_epi32(Indices.V, 3)]);
+
+    return(Result);
+}
+
+#define LANE_WIDTH 4
+#define LANE_NAME(Name) Name##_SSE41
+#define lane_f32 lane_f32x4
+#define lane_u32 lane_u32x4
+#define lane_mask lane_maskx4
+#define LaneF32 LaneF32x4
+#define LaneU32 LaneU32x4
+#define LoadF32 LoadF32x4
+#define LoadU32 LoadU32x4
+
+#define PALETTIZE_LANE_SSE41_H
+#endif
@@ -5,6 +5,7 @@
 
 #define F32Max FLT_MAX
 #define F32Epsilon FLT_EPSILON
+#define F64Max DBL_MAX
 
 struct v3
 {
@@ -49,6 +50,34 @@ Abs(f32 S)
     return(Result);
 }
 
+inline int
+Absi(int S)
+{
+    int Result = (S < 0) ? -S : S;
+
+    return(Result);
+}
+
+inline u32
+BitsOf(f32 S)
+{
+    union {f32 F; u32 U;} Cast;
+    Cast.F = S;
+    u32 Result = Cast.U;
+
+    return(Result);
+}
+
+inline f32
+FromBits(u32 U)
+{
+    union {f32 F; u32 U;} Cast;
+    Cast.U = U;
+    f32 Result = Cast.F;
+
+    return(Result);
+}
+
 inline f32
 Clamp(f32 Min, f32 S, f32 Max)
 {
@@ -217,6 +246,12 @@ operator+=(v3 &A, v3 B)
     A = A + B;
 }
 
+inline void
+operator-=(v3 &A, v3 B)
+{
+    A = A - B;
+}
+
 inline void
 operator*=(v3 &A, f32 S)
 {
@@ -241,6 +276,17 @@ EqualsApproximately(v3 A, v3 B)
     return(Result);
 }
 
+inline v3
+Hadamard(v3 A, v3 B)
+{
+    v3 Result;
+    Result.x = A.x*B.x;
+    Result.y = A.y*B.y;
+    Result.z = A.z*B.z;
+    
+    return(Result);
+}
+
 inline f32
 LengthSquared(v3 V)
 {
@@ -461,5 +507,188 @@ UnpackRGBAToCIELAB(u32 U)
     return(CIELAB);
 }
 
+inline v3
+LinearRGBToOklab(v3 V)
+{
+    m3x3 LMSMatrix;
+    LMSMatrix.XAxis = V3(0.4122214708f, 0.2119034982f, 0.0883024619f);
+    LMSMatrix.YAxis = V3(0.5363325363f, 0.6806995451f, 0.2817188376f);
+    LMSMatrix.ZAxis = V3(0.0514459929f, 0.1073969566f, 0.6299787005f);
+    v3 LMS = LMSMatrix*V;
+    
+    v3 LMSPrime = V3(CubeRoot(LMS.x), CubeRoot(LMS.y), CubeRoot(LMS.z));
+    
+    m3x3 LabMatrix;
+    LabMatrix.XAxis = V3(0.2104542553f, 1.9779984951f, 0.0259040371f);
+    LabMatrix.YAxis = V3(0.7936177850f, -2.4285922050f, 0.7827717662f);
+    LabMatrix.ZAxis = V3(-0.0040720468f, 0.4505937099f, -0.8086757660f);
+    v3 Result = LabMatrix*LMSPrime;
+    
+    return(Result);
+}
+
+inline v3
+OklabToLinearRGB(v3 V)
+{
+    m3x3 LMSMatrix;
+    LMSMatrix.XAxis = V3(1.0f, 1.0f, 1.0f);
+    LMSMatrix.YAxis = V3(0.3963377774f, -0.1055613458f, -0.0894841775f);
+    LMSMatrix.ZAxis = V3(0.2158037573f, -0.0638541728f, -1.2914855480f);
+    v3 LMSPrime = LMSMatrix*V;
+    
+    v3 LMS = V3(Cube(LMSPrime.x), Cube(LMSPrime.y), Cube(LMSPrime.z));
+    
+    m3x3 RGBMatrix;
+    RGBMatrix.XAxis = V3(4.0767416621f, -1.2684380046f, -0.0041960863f);
+    RGBMatrix.YAxis = V3(-3.3077115913f, 2.6097574011f, -0.7034186147f);
+    RGBMatrix.ZAxis = V3(0.2309699292f, -0.3413193965f, 1.7076147010f);
+    v3 Result = RGBMatrix*LMS;
+    
+    return(Result);
+}
+
+// NOTE: Full range BT.601, on gamma encoded sRGB rather than linear RGB
+inline v3
+sRGBToYCbCr(v3 V)
+{
+    m3x3 Matrix;
+    Matrix.XAxis = V3(0.299f, -0.168736f, 0.5f);
+    Matrix.YAxis = V3(0.587f, -0.331264f, -0.418688f);
+    Matrix.ZAxis = V3(0.114f, 0.5f, -0.081312f);
+    v3 Result = Matrix*V;
+    
+    return(Result);
+}
+
+inline v3
+YCbCrTosRGB(v3 V)
+{
+    m3x3 Matrix;
+    Matrix.XAxis = V3(1.0f, 1.0f, 1.0f);
+    Matrix.YAxis = V3(0.0f, -0.344136f, 1.772f);
+    Matrix.ZAxis = V3(1.402f, -0.714136f, 0.0f);
+    v3 Result = Matrix*V;
+    
+    return(Result);
+}
+
+// 
+// Branchless transfer functions
+// 
+
+// NOTE: Drop-in replacements for CubeRoot, Ft, InvFt, sRGBToLinearRGB and
+// LinearRGBTosRGB that use no libm calls and no data dependent branches, so
+// the same arithmetic can run lane-wide (see palettize_kernels_lane.cpp,
+// which mirrors these one to one). Both branches of each piecewise function
+// are evaluated and the right one is selected at the end.
+//
+// Roots start from an exponent-dividing bit trick (<= 3.2% relative error
+// for the cube root, <= 3.3% for the fifth root) and take two Halley steps.
+// Halley converges cubically (e' <= e^3 for these roots), so after two steps
+// the remaining error is far below f32 precision and what's left is
+// rounding. Measured over the whole 8-bit sRGB domain (palettize --selftest,
+// which enforces these bounds), against the libm based versions:
+//     FastsRGBToLinearRGB   max abs error 3.0e-7
+//     FastLinearRGBTosRGB   max abs error 1.8e-7, round trips every 8-bit value
+//     FastFt                max abs error 1.8e-7, max CIELAB delta 1.8e-4
+//     FastInvFt             exact, same arithmetic without the branch
+
+#define CUBE_ROOT_MAGIC 0x2A510555
+#define FIFTH_ROOT_MAGIC 0x32C818CC
+
+// NOTE: Only valid for S > 0
+inline f32
+FastCubeRoot(f32 S)
+{
+    f32 Y = FromBits((u32)((f32)BitsOf(S)*(1.0f / 3.0f)) + CUBE_ROOT_MAGIC);
+    for(int Step = 0;
+        Step < 2;
+        Step++)
+    {
+        f32 Y3 = Y*Y*Y;
+        Y = Y*((Y3 + 2.0f*S) / (2.0f*Y3 + S));
+    }
+
+    return(Y);
+}
+
+// NOTE: Only valid for S > 0
+inline f32
+FastFifthRoot(f32 S)
+{
+    f32 Y = FromBits((u32)((f32)BitsOf(S)*(1.0f / 5.0f)) + FIFTH_ROOT_MAGIC);
+    for(int Step = 0;
+        Step < 2;
+        Step++)
+    {
+        f32 Y5 = Y*Y*Y*Y*Y;
+        Y = Y*((4.0f*Y5 + 6.0f*S) / (6.0f*Y5 + 4.0f*S));
+    }
+
+    return(Y);
+}
+
+inline f32
+Select(b32 Condition, f32 IfTrue, f32 IfFalse)
+{
+    f32 Result = Condition ? IfTrue : IfFalse;
+
+    return(Result);
+}
+
+inline f32
+FastFt(f32 t)
+{
+    f32 Sigma = (6.0f / 29.0f);
+    f32 Cubed = Cube(Sigma);
+
+    f32 Root = FastCubeRoot(Maximum(t, Cubed));
+    f32 Linear = ((t / (3.0f*Square(Sigma))) + (4.0f / 29.0f));
+    f32 Result = Select(t > Cubed, Root, Linear);
+
+    return(Result);
+}
+
+inline f32
+FastInvFt(f32 t)
+{
+    f32 Sigma = (6.0f / 29.0f);
+
+    f32 Cubed = Cube(t);
+    f32 Linear = ((3.0f*Square(Sigma))*(t - (4.0f / 29.0f)));
+    f32 Result = Select(t > Sigma, Cubed, Linear);
+
+    return(Result);
+}
+
+inline f32
+FastsRGBToLinearRGB(f32 S)
+{
+    S = Clamp01(S);
+
+    // NOTE: x^2.4 = x^2*(x^(1/5))^2
+    f32 Base = ((S + 0.055f) / 1.055f);
+    f32 FifthRoot = FastFifthRoot(Base);
+    f32 Curve = Square(Base)*Square(FifthRoot);
+    f32 Linear = S / 12.92f;
+    f32 Result = Select(S <= 0.04045f, Linear, Curve);
+
+    return(Result);
+}
+
+inline f32
+FastLinearRGBTosRGB(f32 S)
+{
+    S = Clamp01(S);
+
+    // NOTE: x^(1/2.4) = x^(1/3)*x^(1/12) = r*sqrt(sqrt(r)) with r = x^(1/3)
+    f32 Root = FastCubeRoot(Maximum(S, 0.0031308f));
+    f32 Curve = ((1.055f*(Root*SquareRoot(SquareRoot(Root)))) - 0.055f);
+    f32 Linear = 12.92f*S;
+    f32 Result = Select(S <= 0.0031308f, Linear, Curve);
+
+    return(Result);
+}
+
 #define PALETTIZE_MATH_H
 #endif
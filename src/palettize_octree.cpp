@@ -0,0 +1,525 @@
+// NOTE: Octree color quantizer (Gervautz and Purgathofer). Every texel walks
+// down from the root taking one bit of each sRGB channel per level, so the
+// leaves at the bottom level are exact 24-bit colors, and accumulates into
+// the leaf it ends up in. Nodes come from a fixed pool, and whenever the pool
+// runs low the deepest internal node is folded into a single leaf holding the
+// sum of its children. Memory therefore stays constant no matter how many
+// texels go in, and rows can be inserted one at a time as they're decoded.
+//
+// Its leaves can either be the palette directly (engine=octree) or seed the
+// Lloyd loop (init=octree).
+
+#define OCTREE_DEPTH 8
+#define DEFAULT_OCTREE_NODE_BUDGET 16384
+
+struct octree_node
+{
+    // NOTE: 0 is the root, which is never anyone's child, so it doubles as
+    // "no child". Free nodes chain through Children[0].
+    u32 Children[8];
+    // NOTE: Internal nodes of each level are chained through this so the
+    // deepest one can be found without a search
+    u32 NextReducible;
+
+    b32 IsLeaf;
+    u32 ChildCount;
+
+    u64 TexelCount;
+    u64 RedSum;
+    u64 GreenSum;
+    u64 BlueSum;
+};
+
+struct octree
+{
+    int NodeBudget;
+    int FreeCount;
+    u32 FirstFree;
+    octree_node *Nodes;
+
+    int LeafCount;
+    // NOTE: Heads of the per-level reducible lists, 0 if empty
+    u32 Reducible[OCTREE_DEPTH];
+};
+
+static octree_node *
+AllocateOctreeNode(octree *Tree, u32 *Index)
+{
+    Assert(Tree->FreeCount > 0);
+
+    *Index = Tree->FirstFree;
+    octree_node *Result = Tree->Nodes + Tree->FirstFree;
+    Tree->FirstFree = Result->Children[0];
+    Tree->FreeCount--;
+
+    for(int ChildIndex = 0;
+        ChildIndex < 8;
+        ChildIndex++)
+    {
+        Result->Children[ChildIndex] = 0;
+    }
+    Result->NextReducible = 0;
+    Result->IsLeaf = false;
+    Result->ChildCount = 0;
+    Result->TexelCount = 0;
+    Result->RedSum = 0;
+    Result->GreenSum = 0;
+    Result->BlueSum = 0;
+
+    return(Result);
+}
+
+static void
+FreeOctreeNode(octree *Tree, u32 Index)
+{
+    Tree->Nodes[Index].Children[0] = Tree->FirstFree;
+    Tree->FirstFree = Index;
+    Tree->FreeCount++;
+}
+
+// NOTE: Returns false if it couldn't allocate the node pool
+static b32
+InitializeOctree(octree *Tree, int NodeBudget)
+{
+    // NOTE: An insertion needs a whole path of fresh nodes, and a reduction
+    // only frees leaves, so anything smaller could get stuck
+    Assert(NodeBudget > 8*OCTREE_DEPTH);
+
+    Tree->NodeBudget = NodeBudget;
+    Tree->Nodes = (octree_node *)malloc(sizeof(octree_node)*NodeBudget);
+    Tree->LeafCount = 0;
+    for(int Level = 0;
+        Level < OCTREE_DEPTH;
+        Level++)
+    {
+        Tree->Reducible[Level] = 0;
+    }
+
+    b32 Result = (Tree->Nodes != 0);
+    if(Result)
+    {
+        Tree->FirstFree = 0;
+        Tree->FreeCount = 0;
+        for(int NodeIndex = NodeBudget - 1;
+            NodeIndex >= 0;
+            NodeIndex--)
+        {
+            FreeOctreeNode(Tree, (u32)NodeIndex);
+        }
+
+        u32 RootIndex;
+        AllocateOctreeNode(Tree, &RootIndex);
+        Assert(RootIndex == 0);
+    }
+
+    return(Result);
+}
+
+// NOTE: Folds the children of a node whose children are all leaves into it
+static void
+ReduceOctreeNode(octree *Tree, octree_node *Node)
+{
+    Assert(!Node->IsLeaf);
+
+    for(int ChildIndex = 0;
+        ChildIndex < 8;
+        ChildIndex++)
+    {
+        u32 Child = Node->Children[ChildIndex];
+        if(Child)
+        {
+            octree_node *ChildNode = Tree->Nodes + Child;
+            Assert(ChildNode->IsLeaf);
+
+            Node->TexelCount += ChildNode->TexelCount;
+            Node->RedSum += ChildNode->RedSum;
+            Node->GreenSum += ChildNode->GreenSum;
+            Node->BlueSum += ChildNode->BlueSum;
+
+            FreeOctreeNode(Tree, Child);
+            Node->Children[ChildIndex] = 0;
+            Tree->LeafCount--;
+        }
+    }
+
+    Node->IsLeaf = true;
+    Node->ChildCount = 0;
+    Tree->LeafCount++;
+}
+
+// NOTE: The deepest level with internal nodes, whose children are all leaves
+// because any internal node below it would be on a deeper list. The root is
+// never on a list, since its index would read as an empty one, so level 0
+// means the root itself. -1 if the root is the only leaf.
+static int
+GetDeepestReducibleLevel(octree *Tree)
+{
+    int Result = OCTREE_DEPTH - 1;
+    while((Result > 0) && !Tree->Reducible[Result])
+    {
+        Result--;
+    }
+    if((Result == 0) && Tree->Nodes[0].IsLeaf)
+    {
+        Result = -1;
+    }
+
+    return(Result);
+}
+
+static void
+InsertOctreeTexel(octree *Tree, u32 Texel)
+{
+    u32 R = (Texel >> 0) & 0xFF;
+    u32 G = (Texel >> 8) & 0xFF;
+    u32 B = (Texel >> 16) & 0xFF;
+
+    // NOTE: A texel creates at most one node per level
+    while(Tree->FreeCount < OCTREE_DEPTH)
+    {
+        int Level = GetDeepestReducibleLevel(Tree);
+        Assert(Level >= 0);
+
+        octree_node *Node = Tree->Nodes;
+        if(Level > 0)
+        {
+            Node += Tree->Reducible[Level];
+            Tree->Reducible[Level] = Node->NextReducible;
+        }
+        ReduceOctreeNode(Tree, Node);
+    }
+
+    octree_node *Node = Tree->Nodes;
+    for(int Level = 0;
+        !Node->IsLeaf;
+        Level++)
+    {
+        int Shift = 7 - Level;
+        int ChildIndex = (int)((((R >> Shift) & 1) << 2) |
+                               (((G >> Shift) & 1) << 1) |
+                               (((B >> Shift) & 1) << 0));
+
+        u32 Child = Node->Children[ChildIndex];
+        if(!Child)
+        {
+            octree_node *ChildNode = AllocateOctreeNode(Tree, &Child);
+            Node->Children[ChildIndex] = Child;
+            Node->ChildCount++;
+
+            int ChildLevel = Level + 1;
+            if(ChildLevel == OCTREE_DEPTH)
+            {
+                ChildNode->IsLeaf = true;
+                Tree->LeafCount++;
+            }
+            else
+            {
+                ChildNode->NextReducible = Tree->Reducible[ChildLevel];
+                Tree->Reducible[ChildLevel] = Child;
+            }
+        }
+
+        Node = Tree->Nodes + Child;
+    }
+
+    Node->TexelCount++;
+    Node->RedSum += R;
+    Node->GreenSum += G;
+    Node->BlueSum += B;
+}
+
+// NOTE: Rows can come straight from a decoder, nothing is kept of them
+static void
+InsertOctreeRow(octree *Tree, u32 *Texels, int Count)
+{
+    for(int Index = 0;
+        Index < Count;
+        Index++)
+    {
+        InsertOctreeTexel(Tree, Texels[Index]);
+    }
+}
+
+// NOTE: Folds the lightest of a node's leaf children into the second
+// lightest, which takes away exactly one leaf
+static void
+MergeLightestOctreeChildren(octree *Tree, octree_node *Node)
+{
+    Assert(Node->ChildCount >= 2);
+
+    u32 *Lightest = 0;
+    u32 *SecondLightest = 0;
+    for(int ChildIndex = 0;
+        ChildIndex < 8;
+        ChildIndex++)
+    {
+        u32 *Child = Node->Children + ChildIndex;
+        if(*Child)
+        {
+            u64 TexelCount = Tree->Nodes[*Child].TexelCount;
+            if(!Lightest || (TexelCount < Tree->Nodes[*Lightest].TexelCount))
+            {
+                SecondLightest = Lightest;
+                Lightest = Child;
+            }
+            else if(!SecondLightest || (TexelCount < Tree->Nodes[*SecondLightest].TexelCount))
+            {
+                SecondLightest = Child;
+            }
+        }
+    }
+
+    octree_node *From = Tree->Nodes + *Lightest;
+    octree_node *To = Tree->Nodes + *SecondLightest;
+    Assert(From->IsLeaf && To->IsLeaf);
+    To->TexelCount += From->TexelCount;
+    To->RedSum += From->RedSum;
+    To->GreenSum += From->GreenSum;
+    To->BlueSum += From->BlueSum;
+
+    FreeOctreeNode(Tree, *Lightest);
+    *Lightest = 0;
+    Node->ChildCount--;
+    Tree->LeafCount--;
+}
+
+// NOTE: Reduces until exactly LeafCount leaves are left, or the root is the
+// only one. Unlike the reductions during insertion this searches the deepest
+// level for its lightest node. Folding a whole node can take away up to 7
+// leaves, so once every node there would overshoot, the two lightest children
+// of the lightest node are merged instead.
+static void
+ReduceOctree(octree *Tree, int LeafCount)
+{
+    while(Tree->LeafCount > LeafCount)
+    {
+        int Level = GetDeepestReducibleLevel(Tree);
+        if(Level < 0)
+        {
+            break;
+        }
+
+        int ExcessLeafCount = Tree->LeafCount - LeafCount;
+
+        u32 *FoldableLink = 0;
+        octree_node *Foldable = 0;
+        octree_node *Lightest = 0;
+
+        // NOTE: The root isn't on a list, so it has no link to unlink
+        u32 *Link = (Level > 0) ? (Tree->Reducible + Level) : 0;
+        u32 Index = Link ? *Link : 0;
+        for(;;)
+        {
+            octree_node *Node = Tree->Nodes + Index;
+
+            Node->TexelCount = 0;
+            for(int ChildIndex = 0;
+                ChildIndex < 8;
+                ChildIndex++)
+            {
+                if(Node->Children[ChildIndex])
+                {
+                    Node->TexelCount += Tree->Nodes[Node->Children[ChildIndex]].TexelCount;
+                }
+            }
+
+            if(!Lightest || (Node->TexelCount < Lightest->TexelCount))
+            {
+                Lightest = Node;
+            }
+            if((((int)Node->ChildCount - 1) <= ExcessLeafCount) &&
+               (!Foldable || (Node->TexelCount < Foldable->TexelCount)))
+            {
+                Foldable = Node;
+                FoldableLink = Link;
+            }
+
+            if(!Link || !Node->NextReducible)
+            {
+                break;
+            }
+            Link = &Node->NextReducible;
+            Index = *Link;
+        }
+
+        if(Foldable)
+        {
+            if(FoldableLink)
+            {
+                *FoldableLink = Foldable->NextReducible;
+            }
+            Foldable->TexelCount = 0;
+            ReduceOctreeNode(Tree, Foldable);
+        }
+        else
+        {
+            MergeLightestOctreeChildren(Tree, Lightest);
+            Lightest->TexelCount = 0;
+        }
+    }
+}
+
+// NOTE: Writes the mean color of every leaf, converted to the color space and
+// scaled like the observations, into Clusters (up to MaxCount of them) along
+// with its texel count. Returns how many were written.
+static int
+GetOctreeClusters(octree *Tree, cluster *Clusters, int MaxCount,
+                  color_space ColorSpace, v3 Scale)
+{
+    int Result = 0;
+
+    u32 Stack[8*OCTREE_DEPTH + 1];
+    int StackCount = 0;
+    Stack[StackCount++] = 0;
+    while(StackCount && (Result < MaxCount))
+    {
+        octree_node *Node = Tree->Nodes + Stack[--StackCount];
+        if(Node->IsLeaf)
+        {
+            if(Node->TexelCount)
+            {
+                f32 InvCount = 1.0f / (f32)Node->TexelCount;
+                u32 Mean = (0xFF000000 |
+                            (RoundToU32((f32)Node->BlueSum*InvCount) << 16) |
+                            (RoundToU32((f32)Node->GreenSum*InvCount) << 8) |
+                            (RoundToU32((f32)Node->RedSum*InvCount) << 0));
+
+                cluster *Cluster = Clusters + Result++;
+                Cluster->Centroid = Hadamard(UnpackRGBAToColor(ColorSpace, Mean), Scale);
+                Cluster->ObservationSum = V3(0.0f, 0.0f, 0.0f);
+                Cluster->ObservationCount = (s64)Node->TexelCount;
+            }
+        }
+        else
+        {
+            for(int ChildIndex = 7;
+                ChildIndex >= 0;
+                ChildIndex--)
+            {
+                if(Node->Children[ChildIndex])
+                {
+                    Stack[StackCount++] = Node->Children[ChildIndex];
+                }
+            }
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Reduces Tree to at most Context->ClusterCount leaves and makes them
+// the clusters. Returns the number of clusters.
+static int
+TakeOctreeClusters(kmeans_context *Context, octree *Tree, color_space ColorSpace, v3 Scale)
+{
+    ReduceOctree(Tree, Context->ClusterCount);
+    int Result = GetOctreeClusters(Tree, Context->Clusters, Context->ClusterCount,
+                                   ColorSpace, Scale);
+    Context->ClusterCount = Result;
+
+    return(Result);
+}
+
+// NOTE: Streams Bitmap through an octree and makes its leaves the clusters,
+// reduced to at most Context->ClusterCount. Returns the number of clusters,
+// or 0 if it couldn't allocate the node pool.
+static int
+RunOctreeQuantizer(kmeans_context *Context, bitmap Bitmap, color_space ColorSpace, v3 Scale)
+{
+    int Result = 0;
+
+    octree Tree;
+    if(InitializeOctree(&Tree, DEFAULT_OCTREE_NODE_BUDGET))
+    {
+        for(int Y = 0;
+            Y < Bitmap.Height;
+            Y++)
+        {
+            InsertOctreeRow(&Tree, (u32 *)GetBitmapPtr(Bitmap, 0, Y), Bitmap.Width);
+        }
+
+        Result = TakeOctreeClusters(Context, &Tree, ColorSpace, Scale);
+    }
+
+    free(Tree.Nodes);
+
+    return(Result);
+}
+
+// NOTE: The same as RunOctreeQuantizer, but the rows come straight from the
+// file, so only one of them is ever in memory. Returns 0 if it couldn't
+// allocate or the file ended early.
+static int
+StreamOctreeQuantizer(kmeans_context *Context, image_stream *Stream, color_space ColorSpace, v3 Scale)
+{
+    int Result = 0;
+
+    u32 *Row = (u32 *)malloc(sizeof(u32)*Stream->Width);
+    octree Tree;
+    if(InitializeOctree(&Tree, DEFAULT_OCTREE_NODE_BUDGET) && Row)
+    {
+        b32 Complete = true;
+        while(Complete && (Stream->NextY < Stream->Height))
+        {
+            Complete = ReadImageStreamRow(Stream, Row);
+            if(Complete)
+            {
+                InsertOctreeRow(&Tree, Row, Stream->Width);
+            }
+        }
+
+        if(Complete)
+        {
+            Result = TakeOctreeClusters(Context, &Tree, ColorSpace, Scale);
+        }
+    }
+
+    free(Tree.Nodes);
+    free(Row);
+
+    return(Result);
+}
+
+// NOTE: Seeds the clusters with the octree's leaf colors. If the reduction
+// overshot, or the image has fewer colors than clusters, the rest are
+// seeded from random observations like the default seeding. Returns false if
+// it couldn't allocate the node pool.
+static b32
+SeedClustersFromOctree(kmeans_context *Context, bitmap Bitmap, observation_buffer *Observations,
+                       color_space ColorSpace, v3 Scale, random_series *Entropy)
+{
+    octree Tree;
+    b32 Result = InitializeOctree(&Tree, DEFAULT_OCTREE_NODE_BUDGET);
+    if(Result)
+    {
+        for(int Y = 0;
+            Y < Bitmap.Height;
+            Y++)
+        {
+            InsertOctreeRow(&Tree, (u32 *)GetBitmapPtr(Bitmap, 0, Y), Bitmap.Width);
+        }
+
+        ReduceOctree(&Tree, Context->ClusterCount);
+        int SeededCount = GetOctreeClusters(&Tree, Context->Clusters, Context->ClusterCount,
+                                            ColorSpace, Scale);
+        for(int ClusterIndex = SeededCount;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            u32 SampleX = RandomU32Between(Entropy, 0, (u32)(Bitmap.Width - 1));
+            u32 SampleY = RandomU32Between(Entropy, 0, (u32)(Bitmap.Height - 1));
+            Context->Clusters[ClusterIndex].Centroid = GetObservation(Observations, SampleY*Bitmap.Width + SampleX);
+        }
+
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            ClearObservations(Context->Clusters + ClusterIndex);
+        }
+    }
+
+    free(Tree.Nodes);
+
+    return(Result);
+}
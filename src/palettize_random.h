@@ -14,6 +14,34 @@ SeedSeries(u32 Seed)
     return(Result);
 }
 
+// NOTE: Independent series for parallel runs. Stream 0 is the plain seed so a
+// single run matches SeedSeries, the others are scrambled with a MurmurHash3
+// finalizer so nearby seeds and streams don't produce correlated sequences.
+inline random_series
+SeedSeries(u32 Seed, u32 Stream)
+{
+    u32 Mixed = Seed;
+    if(Stream)
+    {
+        Mixed ^= Stream*0x9E3779B9;
+        Mixed ^= Mixed >> 16;
+        Mixed *= 0x85EBCA6B;
+        Mixed ^= Mixed >> 13;
+        Mixed *= 0xC2B2AE35;
+        Mixed ^= Mixed >> 16;
+
+        // NOTE: Xorshift never leaves zero
+        if(Mixed == 0)
+        {
+            Mixed = 0x9E3779B9;
+        }
+    }
+
+    random_series Result = SeedSeries(Mixed);
+
+    return(Result);
+}
+
 inline u32
 RandomU32(random_series *Series)
 {
@@ -37,5 +65,23 @@ RandomU32Between(random_series *Series, u32 Min, u32 Max)
     return(Result);
 }
 
+// NOTE: For ranges too big for RandomU32Between. A range that fits in 32 bits
+// draws a single value, so it gives the same sequence RandomU32Between would.
+inline u64
+RandomU64Between(random_series *Series, u64 Min, u64 Max)
+{
+    u64 Range = Max - Min;
+    u64 Random = RandomU32(Series);
+    if(Range > 0xFFFFFFFF)
+    {
+        Random = (Random << 32) | RandomU32(Series);
+    }
+
+    u64 Result = Min + (Random % Range);
+    Assert((Min <= Result) && (Result <= Max));
+
+    return(Result);
+}
+
 #define PALETTIZE_RANDOM_H
 #endif
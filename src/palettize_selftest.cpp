@@ -0,0 +1,701 @@
+// NOTE: palettize --selftest checks the branchless transfer functions and the
+// conversion kernels of every instruction set the CPU supports against the
+// libm based scalar reference, over every input an 8-bit sRGB image can
+// produce, and fails if any error exceeds the bounds documented in
+// palettize_math.h. It then checks every assignment kernel against the plain
+// scalar scan, which has to agree with them exactly, and that Lloyd restarts
+// pick the same palette on one thread as on many.
+
+#define SELF_TEST_CHUNK_SIZE 4096
+
+struct self_test_result
+{
+    char *Name;
+    f32 MaxError;
+    f32 Bound;
+};
+
+static b32
+ReportSelfTestResult(self_test_result Result, isa_level ISALevel)
+{
+    b32 Passed = (Result.MaxError <= Result.Bound);
+    printf("%-24s %-8s max error %.3e (bound %.1e) %s\n",
+           Result.Name, ISALevelNames[ISALevel], Result.MaxError, Result.Bound,
+           Passed ? "ok" : "FAILED");
+
+    return(Passed);
+}
+
+static f32
+EvaluateReferenceTransferFunction(transfer_function Function, f32 S)
+{
+    f32 Result = 0.0f;
+    switch(Function)
+    {
+        case TransferFunction_Ft: {Result = Ft(S);} break;
+        case TransferFunction_InvFt: {Result = InvFt(S);} break;
+        case TransferFunction_sRGBToLinearRGB: {Result = sRGBToLinearRGB(S);} break;
+        case TransferFunction_LinearRGBTosRGB: {Result = LinearRGBTosRGB(S);} break;
+        InvalidDefaultCase;
+    }
+
+    return(Result);
+}
+
+// NOTE: Fills Values with every input the function sees for the 8-bit colors
+// [FirstColor, FirstColor + ColorCount), returning how many were written
+static int
+GenerateTransferFunctionInputs(transfer_function Function, u32 FirstColor, int ColorCount,
+                               f32 *Values)
+{
+    int Result = 0;
+
+    for(u32 Color = FirstColor;
+        Color < (FirstColor + ColorCount);
+        Color++)
+    {
+        switch(Function)
+        {
+            case TransferFunction_Ft:
+            {
+                v3 CIEXYZ = LinearRGBToCIEXYZ(sRGBToLinearRGB(UnpackRGBA(Color)));
+                Values[Result++] = CIEXYZ.x / Xn;
+                Values[Result++] = CIEXYZ.y / Yn;
+                Values[Result++] = CIEXYZ.z / Zn;
+            } break;
+
+            case TransferFunction_InvFt:
+            {
+                v3 CIELAB = UnpackRGBAToCIELAB(Color);
+                Values[Result++] = ((CIELAB.x + 16.0f) / 116.0f) + (CIELAB.y / 500.0f);
+                Values[Result++] = ((CIELAB.x + 16.0f) / 116.0f);
+                Values[Result++] = ((CIELAB.x + 16.0f) / 116.0f) - (CIELAB.z / 200.0f);
+            } break;
+
+            // NOTE: These two only ever see one channel, so their whole 8-bit
+            // domain is the first 256 colors
+            case TransferFunction_sRGBToLinearRGB:
+            {
+                Values[Result++] = (f32)(Color & 0xFF) / 255.0f;
+            } break;
+
+            case TransferFunction_LinearRGBTosRGB:
+            {
+                Values[Result++] = sRGBToLinearRGB((f32)(Color & 0xFF) / 255.0f);
+            } break;
+
+            InvalidDefaultCase;
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Coordinates are small integers, so every distance and sum is exact
+// whichever way a kernel rounds or orders its math, and ties between
+// centroids are common. Rows are an odd width so the kernels' scalar tails
+// get used too.
+#define ASSIGNMENT_TEST_OBSERVATION_COUNT 1999
+#define ASSIGNMENT_TEST_ROW_WIDTH 61
+#define MAX_ASSIGNMENT_TEST_CLUSTER_COUNT 4096
+
+struct assignment_test_kernel
+{
+    char *Name;
+    isa_level ISALevel;
+
+    // NOTE: Kernel is tested at every cluster count, Table only at the ones
+    // it has an entry for
+    assign_observations *Kernel;
+    assign_observations **Table;
+    int MaxClusterCount;
+};
+
+static f32
+RandomTestCoordinate(random_series *Entropy)
+{
+    f32 Result = (f32)RandomU32Between(Entropy, 0, 101) - 50.0f;
+
+    return(Result);
+}
+
+static b32
+RunAssignmentTestPass(assign_observations *Kernel, kmeans_context *Context,
+                      observation_buffer *Observations, u32 *ClusterIndices, b32 DetectChanges)
+{
+    b32 Result = false;
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        ClearObservations(Context->Clusters + ClusterIndex);
+    }
+
+    for(int First = 0;
+        First < Observations->Count;
+        First += ASSIGNMENT_TEST_ROW_WIDTH)
+    {
+        int Count = Minimum(ASSIGNMENT_TEST_ROW_WIDTH, Observations->Count - First);
+        if(Kernel(Context, Observations, First, Count, ClusterIndices, DetectChanges))
+        {
+            Result = true;
+        }
+    }
+
+    return(Result);
+}
+
+static b32
+MatchesReferenceAssignment(kmeans_context *Context, u32 *ClusterIndices,
+                           kmeans_context *Reference, u32 *ReferenceIndices, int ObservationCount)
+{
+    b32 Result = true;
+
+    for(int Index = 0;
+        Index < ObservationCount;
+        Index++)
+    {
+        if(ClusterIndices[Index] != ReferenceIndices[Index])
+        {
+            Result = false;
+        }
+    }
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *A = Context->Clusters + ClusterIndex;
+        cluster *B = Reference->Clusters + ClusterIndex;
+        if((A->ObservationCount != B->ObservationCount) ||
+           (A->ObservationSum.x != B->ObservationSum.x) ||
+           (A->ObservationSum.y != B->ObservationSum.y) ||
+           (A->ObservationSum.z != B->ObservationSum.z))
+        {
+            Result = false;
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Each kernel gets a first pass, a pass that has to correct a third of
+// the previous indices and say so, and a pass over indices that are already
+// right, which must not report a change
+static b32
+TestAssignmentKernels(isa_level Detected)
+{
+    b32 Passed = true;
+
+    assignment_test_kernel TestKernels[] =
+    {
+        {"Assignment k-d tree", ISALevel_Scalar, AssignObservationsKDTree_Scalar, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment dispatch", ISALevel_Scalar, AssignObservationsSpecialized_Scalar, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+#if PALETTIZE_X86
+        {"Assignment", ISALevel_SSE41, AssignObservations_SSE41, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment unrolled", ISALevel_SSE41, 0, AssignObservationsUnrolledTable_SSE41, MAX_UNROLLED_CLUSTER_COUNT},
+        {"Assignment dispatch", ISALevel_SSE41, AssignObservationsSpecialized_SSE41, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment", ISALevel_AVX2, AssignObservations_AVX2, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment unrolled", ISALevel_AVX2, 0, AssignObservationsUnrolledTable_AVX2, MAX_UNROLLED_CLUSTER_COUNT},
+        {"Assignment dispatch", ISALevel_AVX2, AssignObservationsSpecialized_AVX2, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment", ISALevel_AVX512, AssignObservations_AVX512, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+        {"Assignment unrolled", ISALevel_AVX512, 0, AssignObservationsUnrolledTable_AVX512, MAX_UNROLLED_CLUSTER_COUNT},
+        {"Assignment by centroid", ISALevel_AVX512, AssignObservationsAcrossCentroids_AVX512, 0, 16*MAX_CENTROID_GROUP_COUNT},
+        {"Assignment dispatch", ISALevel_AVX512, AssignObservationsByClusterCount_AVX512, 0, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT},
+#endif
+    };
+
+    // NOTE: Every count the unrolled kernels and the centroid groups could
+    // care about, then either side of the k-d tree thresholds
+    int ClusterCounts[63 + 5];
+    int ClusterCountCount = 0;
+    for(int ClusterCount = 2;
+        ClusterCount <= 64;
+        ClusterCount++)
+    {
+        ClusterCounts[ClusterCountCount++] = ClusterCount;
+    }
+    ClusterCounts[ClusterCountCount++] = 100;
+    ClusterCounts[ClusterCountCount++] = 256;
+    ClusterCounts[ClusterCountCount++] = 300;
+    ClusterCounts[ClusterCountCount++] = 1024;
+    ClusterCounts[ClusterCountCount++] = 4096;
+    Assert(ClusterCountCount == (int)ArrayCount(ClusterCounts));
+
+    kmeans_context Contexts[ArrayCount(TestKernels)] = {};
+    int TestedCounts[ArrayCount(TestKernels)] = {};
+    int FailedCounts[ArrayCount(TestKernels)] = {};
+
+    kmeans_context Reference;
+    InitializeKMeansContext(&Reference, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT);
+    observation_buffer Observations = AllocateObservationBuffer(ASSIGNMENT_TEST_OBSERVATION_COUNT);
+    u32 *ReferenceIndices = (u32 *)malloc(sizeof(u32)*ASSIGNMENT_TEST_OBSERVATION_COUNT);
+    u32 *ClusterIndices = (u32 *)malloc(sizeof(u32)*ASSIGNMENT_TEST_OBSERVATION_COUNT);
+    b32 Allocated = (Reference.Clusters &&
+                     Observations.X && Observations.Y && Observations.Z &&
+                     ReferenceIndices && ClusterIndices);
+    for(int KernelIndex = 0;
+        KernelIndex < (int)ArrayCount(TestKernels);
+        KernelIndex++)
+    {
+        InitializeKMeansContext(Contexts + KernelIndex, MAX_ASSIGNMENT_TEST_CLUSTER_COUNT);
+        if(!Contexts[KernelIndex].Clusters)
+        {
+            Allocated = false;
+        }
+    }
+
+    if(Allocated)
+    {
+        random_series Entropy = SeedSeries(1234);
+        for(int Index = 0;
+            Index < Observations.Count;
+            Index++)
+        {
+            Observations.X[Index] = RandomTestCoordinate(&Entropy);
+            Observations.Y[Index] = RandomTestCoordinate(&Entropy);
+            Observations.Z[Index] = RandomTestCoordinate(&Entropy);
+        }
+
+        for(int CountIndex = 0;
+            CountIndex < ClusterCountCount;
+            CountIndex++)
+        {
+            int ClusterCount = ClusterCounts[CountIndex];
+
+            // NOTE: About one centroid in eight is a copy of an earlier one
+            Reference.ClusterCount = ClusterCount;
+            for(int ClusterIndex = 0;
+                ClusterIndex < ClusterCount;
+                ClusterIndex++)
+            {
+                v3 Centroid;
+                if(ClusterIndex && ((RandomU32(&Entropy) % 8) == 0))
+                {
+                    Centroid = Reference.Clusters[RandomU32Between(&Entropy, 0, (u32)ClusterIndex)].Centroid;
+                }
+                else
+                {
+                    Centroid.x = RandomTestCoordinate(&Entropy);
+                    Centroid.y = RandomTestCoordinate(&Entropy);
+                    Centroid.z = RandomTestCoordinate(&Entropy);
+                }
+                Reference.Clusters[ClusterIndex].Centroid = Centroid;
+            }
+
+            RunAssignmentTestPass(AssignObservations_Scalar, &Reference, &Observations,
+                                  ReferenceIndices, false);
+
+            for(int KernelIndex = 0;
+                KernelIndex < (int)ArrayCount(TestKernels);
+                KernelIndex++)
+            {
+                assignment_test_kernel *Test = TestKernels + KernelIndex;
+
+                assign_observations *Kernel = Test->Kernel;
+                if(Test->Table && (ClusterCount <= Test->MaxClusterCount))
+                {
+                    Kernel = Test->Table[ClusterCount];
+                }
+                if((Test->ISALevel > Detected) || !Kernel ||
+                   (ClusterCount > Test->MaxClusterCount))
+                {
+                    continue;
+                }
+
+                kmeans_context *Context = Contexts + KernelIndex;
+                Context->ClusterCount = ClusterCount;
+                for(int ClusterIndex = 0;
+                    ClusterIndex < ClusterCount;
+                    ClusterIndex++)
+                {
+                    Context->Clusters[ClusterIndex].Centroid = Reference.Clusters[ClusterIndex].Centroid;
+                }
+
+                for(int Index = 0;
+                    Index < Observations.Count;
+                    Index++)
+                {
+                    ClusterIndices[Index] = 0xFFFFFFFF;
+                }
+                b32 Matched = (!RunAssignmentTestPass(Kernel, Context, &Observations, ClusterIndices, false) &&
+                               MatchesReferenceAssignment(Context, ClusterIndices, &Reference,
+                                                          ReferenceIndices, Observations.Count));
+
+                for(int Index = 0;
+                    Index < Observations.Count;
+                    Index++)
+                {
+                    ClusterIndices[Index] = ReferenceIndices[Index];
+                    if((Index % 3) == 0)
+                    {
+                        ClusterIndices[Index] = (ReferenceIndices[Index] + 1) % (u32)ClusterCount;
+                    }
+                }
+                Matched = (Matched &&
+                           RunAssignmentTestPass(Kernel, Context, &Observations, ClusterIndices, true) &&
+                           MatchesReferenceAssignment(Context, ClusterIndices, &Reference,
+                                                      ReferenceIndices, Observations.Count));
+
+                for(int Index = 0;
+                    Index < Observations.Count;
+                    Index++)
+                {
+                    ClusterIndices[Index] = ReferenceIndices[Index];
+                }
+                Matched = (Matched &&
+                           !RunAssignmentTestPass(Kernel, Context, &Observations, ClusterIndices, true) &&
+                           MatchesReferenceAssignment(Context, ClusterIndices, &Reference,
+                                                      ReferenceIndices, Observations.Count));
+
+                TestedCounts[KernelIndex]++;
+                if(!Matched)
+                {
+                    printf("%-24s %-8s %d clusters FAILED\n",
+                           Test->Name, ISALevelNames[Test->ISALevel], ClusterCount);
+                    FailedCounts[KernelIndex]++;
+                }
+            }
+        }
+
+        for(int KernelIndex = 0;
+            KernelIndex < (int)ArrayCount(TestKernels);
+            KernelIndex++)
+        {
+            assignment_test_kernel *Test = TestKernels + KernelIndex;
+            if(Test->ISALevel <= Detected)
+            {
+                printf("%-24s %-8s %d of %d cluster counts matched %s\n",
+                       Test->Name, ISALevelNames[Test->ISALevel],
+                       TestedCounts[KernelIndex] - FailedCounts[KernelIndex], TestedCounts[KernelIndex],
+                       FailedCounts[KernelIndex] ? "FAILED" : "ok");
+                if(FailedCounts[KernelIndex])
+                {
+                    Passed = false;
+                }
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: malloc failed at startup\n");
+        Passed = false;
+    }
+
+    for(int KernelIndex = 0;
+        KernelIndex < (int)ArrayCount(TestKernels);
+        KernelIndex++)
+    {
+        FreeKMeansContext(Contexts + KernelIndex);
+    }
+    FreeKMeansContext(&Reference);
+    free(Observations.X);
+    free(Observations.Y);
+    free(Observations.Z);
+    free(ReferenceIndices);
+    free(ClusterIndices);
+
+    return(Passed);
+}
+
+// NOTE: Observations in blobs of very different sizes, so the restarts land
+// in different local minima and some of them are abandoned. The serial queue
+// runs every restart on this thread in order, the other one as many at once
+// as there are processors, and that's repeated since a mismatch depends on
+// timing.
+#define RESTART_TEST_WIDTH 150
+#define RESTART_TEST_HEIGHT 100
+#define RESTART_TEST_BLOB_COUNT 24
+#define RESTART_TEST_RESTART_COUNT 16
+#define RESTART_TEST_REPEAT_COUNT 8
+
+static b32
+MatchesReferenceClusters(kmeans_context *Context, kmeans_context *Reference)
+{
+    b32 Result = true;
+
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        cluster *A = Context->Clusters + ClusterIndex;
+        cluster *B = Reference->Clusters + ClusterIndex;
+        if((A->ObservationCount != B->ObservationCount) ||
+           (A->Centroid.x != B->Centroid.x) ||
+           (A->Centroid.y != B->Centroid.y) ||
+           (A->Centroid.z != B->Centroid.z))
+        {
+            Result = false;
+        }
+    }
+
+    return(Result);
+}
+
+static b32
+TestRestartDeterminism(void)
+{
+    b32 Passed = true;
+
+    int ClusterCounts[] = {16, 200};
+
+    kmeans_context Context;
+    kmeans_context Reference;
+    InitializeKMeansContext(&Context, MAX_CLUSTER_COUNT);
+    InitializeKMeansContext(&Reference, MAX_CLUSTER_COUNT);
+    observation_buffer Observations = AllocateObservationBuffer(RESTART_TEST_WIDTH*RESTART_TEST_HEIGHT);
+    if(Context.Clusters && Reference.Clusters &&
+       Observations.X && Observations.Y && Observations.Z)
+    {
+        random_series Entropy = SeedSeries(4321);
+        v3 Centers[RESTART_TEST_BLOB_COUNT];
+        u32 Spreads[RESTART_TEST_BLOB_COUNT];
+        for(int Blob = 0;
+            Blob < RESTART_TEST_BLOB_COUNT;
+            Blob++)
+        {
+            Centers[Blob] = V3(RandomTestCoordinate(&Entropy),
+                               RandomTestCoordinate(&Entropy),
+                               RandomTestCoordinate(&Entropy));
+            Spreads[Blob] = RandomU32Between(&Entropy, 1, 20);
+        }
+
+        for(int Index = 0;
+            Index < Observations.Count;
+            Index++)
+        {
+            // NOTE: Squaring the pick makes the low blobs much more common
+            u32 Pick = RandomU32Between(&Entropy, 0, RESTART_TEST_BLOB_COUNT);
+            int Blob = (int)((Pick*Pick) / RESTART_TEST_BLOB_COUNT);
+            u32 Spread = Spreads[Blob];
+            f32 Half = 0.5f*(f32)Spread;
+            Observations.X[Index] = Centers[Blob].x + (f32)RandomU32Between(&Entropy, 0, Spread) - Half;
+            Observations.Y[Index] = Centers[Blob].y + (f32)RandomU32Between(&Entropy, 0, Spread) - Half;
+            Observations.Z[Index] = Centers[Blob].z + (f32)RandomU32Between(&Entropy, 0, Spread) - Half;
+        }
+
+        work_queue SerialQueue;
+        work_queue ParallelQueue;
+        int ThreadCount = Maximum(GetLogicalProcessorCount(), 4);
+        InitializeWorkQueue(&SerialQueue, 0);
+        InitializeWorkQueue(&ParallelQueue, ThreadCount - 1);
+
+        for(int CountIndex = 0;
+            CountIndex < (int)ArrayCount(ClusterCounts);
+            CountIndex++)
+        {
+            int ClusterCount = ClusterCounts[CountIndex];
+
+            Reference.ClusterCount = ClusterCount;
+            b32 Matched = RunLloydKMeansWithRestarts(&Reference, &Observations,
+                                                     RESTART_TEST_WIDTH, RESTART_TEST_HEIGHT, 3,
+                                                     RESTART_TEST_RESTART_COUNT, false, &SerialQueue);
+            for(int Repeat = 0;
+                Matched && (Repeat < RESTART_TEST_REPEAT_COUNT);
+                Repeat++)
+            {
+                Context.ClusterCount = ClusterCount;
+                Matched = (RunLloydKMeansWithRestarts(&Context, &Observations,
+                                                      RESTART_TEST_WIDTH, RESTART_TEST_HEIGHT, 3,
+                                                      RESTART_TEST_RESTART_COUNT, false, &ParallelQueue) &&
+                           MatchesReferenceClusters(&Context, &Reference));
+            }
+
+            printf("%-24s %d clusters, 1 and %d threads %s\n",
+                   "Lloyd restarts", ClusterCount, ThreadCount, Matched ? "matched ok" : "differ FAILED");
+            if(!Matched)
+            {
+                Passed = false;
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: malloc failed at startup\n");
+        Passed = false;
+    }
+
+    FreeKMeansContext(&Context);
+    FreeKMeansContext(&Reference);
+    free(Observations.X);
+    free(Observations.Y);
+    free(Observations.Z);
+
+    return(Passed);
+}
+
+static b32
+RunSelfTest(void)
+{
+    b32 Passed = true;
+
+    isa_level Detected = DetectISALevel();
+
+    evaluate_transfer_function *Evaluators[ISALevel_Count] = {EvaluateTransferFunction_Scalar};
+    convert_texels **ConvertTexelsTables[ISALevel_Count] = {ConvertTexelsTable_Scalar};
+#if PALETTIZE_X86
+    Evaluators[ISALevel_SSE41] = EvaluateTransferFunction_SSE41;
+    Evaluators[ISALevel_AVX2] = EvaluateTransferFunction_AVX2;
+    Evaluators[ISALevel_AVX512] = EvaluateTransferFunction_AVX512;
+    ConvertTexelsTables[ISALevel_SSE41] = ConvertTexelsTable_SSE41;
+    ConvertTexelsTables[ISALevel_AVX2] = ConvertTexelsTable_AVX2;
+    ConvertTexelsTables[ISALevel_AVX512] = ConvertTexelsTable_AVX512;
+#endif
+
+    self_test_result TransferResults[TransferFunction_Count] =
+    {
+        {"Ft", 0.0f, 5e-7f},
+        {"InvFt", 0.0f, 5e-7f},
+        {"sRGBToLinearRGB", 0.0f, 5e-7f},
+        {"LinearRGBTosRGB", 0.0f, 5e-7f},
+    };
+    // NOTE: Channels are on a 0..100 scale, and SIMD FMAs round differently
+    // from the scalar code even where the math is identical
+    self_test_result ConversionResults[ColorSpace_Count] =
+    {
+        {"CIELAB conversion", 0.0f, 5e-4f},
+        {"Oklab conversion", 0.0f, 5e-4f},
+        {"Linear RGB conversion", 0.0f, 1e-4f},
+        {"YCbCr conversion", 0.0f, 1e-4f},
+    };
+
+    // NOTE: Three values per color at most
+    f32 *Inputs = (f32 *)malloc(sizeof(f32)*3*SELF_TEST_CHUNK_SIZE);
+    f32 *Expected = (f32 *)malloc(sizeof(f32)*3*SELF_TEST_CHUNK_SIZE);
+    f32 *Actual = (f32 *)malloc(sizeof(f32)*3*SELF_TEST_CHUNK_SIZE);
+    u32 *Texels = (u32 *)malloc(sizeof(u32)*SELF_TEST_CHUNK_SIZE);
+    if(Inputs && Expected && Actual && Texels)
+    {
+        for(int ISALevel = ISALevel_Scalar;
+            ISALevel <= Detected;
+            ISALevel++)
+        {
+            for(int Function = 0;
+                Function < TransferFunction_Count;
+                Function++)
+            {
+                self_test_result *Result = TransferResults + Function;
+                Result->MaxError = 0.0f;
+
+                u32 ColorCount = 0x1000000;
+                if((Function == TransferFunction_sRGBToLinearRGB) ||
+                   (Function == TransferFunction_LinearRGBTosRGB))
+                {
+                    ColorCount = 256;
+                }
+
+                for(u32 FirstColor = 0;
+                    FirstColor < ColorCount;
+                    FirstColor += SELF_TEST_CHUNK_SIZE)
+                {
+                    int ChunkColorCount = Minimum(SELF_TEST_CHUNK_SIZE, (int)(ColorCount - FirstColor));
+                    int ValueCount = GenerateTransferFunctionInputs((transfer_function)Function,
+                                                                    FirstColor, ChunkColorCount, Inputs);
+                    for(int Index = 0;
+                        Index < ValueCount;
+                        Index++)
+                    {
+                        Expected[Index] = EvaluateReferenceTransferFunction((transfer_function)Function,
+                                                                            Inputs[Index]);
+                        Actual[Index] = Inputs[Index];
+                    }
+
+                    Evaluators[ISALevel]((transfer_function)Function, Actual, ValueCount);
+
+                    for(int Index = 0;
+                        Index < ValueCount;
+                        Index++)
+                    {
+                        Result->MaxError = Maximum(Result->MaxError, Abs(Actual[Index] - Expected[Index]));
+                    }
+                }
+
+                if(!ReportSelfTestResult(*Result, (isa_level)ISALevel))
+                {
+                    Passed = false;
+                }
+            }
+
+            if(ISALevel == ISALevel_Scalar)
+            {
+                // NOTE: The scalar conversion kernels are the reference
+                continue;
+            }
+
+            for(int ColorSpace = 0;
+                ColorSpace < ColorSpace_Count;
+                ColorSpace++)
+            {
+                self_test_result *Result = ConversionResults + ColorSpace;
+                Result->MaxError = 0.0f;
+
+                for(u32 FirstColor = 0;
+                    FirstColor < 0x1000000;
+                    FirstColor += SELF_TEST_CHUNK_SIZE)
+                {
+                    for(int Index = 0;
+                        Index < SELF_TEST_CHUNK_SIZE;
+                        Index++)
+                    {
+                        Texels[Index] = 0xFF000000 | (FirstColor + Index);
+                    }
+
+                    int Count = SELF_TEST_CHUNK_SIZE;
+                    ConvertTexelsTable_Scalar[ColorSpace](Texels, Count, Expected,
+                                                          Expected + Count, Expected + 2*Count);
+                    ConvertTexelsTables[ISALevel][ColorSpace](Texels, Count, Actual,
+                                                              Actual + Count, Actual + 2*Count);
+                    for(int Index = 0;
+                        Index < 3*Count;
+                        Index++)
+                    {
+                        Result->MaxError = Maximum(Result->MaxError, Abs(Actual[Index] - Expected[Index]));
+                    }
+                }
+
+                if(!ReportSelfTestResult(*Result, (isa_level)ISALevel))
+                {
+                    Passed = false;
+                }
+            }
+        }
+
+        // NOTE: Whatever the error, every 8-bit value has to survive a round
+        // trip through linear RGB
+        for(u32 Value = 0;
+            Value < 256;
+            Value++)
+        {
+            f32 Linear = FastsRGBToLinearRGB((f32)Value / 255.0f);
+            u32 RoundTrip = RoundToU32(FastLinearRGBTosRGB(Linear)*255.0f);
+            if(RoundTrip != Value)
+            {
+                printf("sRGB round trip of %u gave %u FAILED\n", Value, RoundTrip);
+                Passed = false;
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: malloc failed at startup\n");
+        Passed = false;
+    }
+
+    free(Inputs);
+    free(Expected);
+    free(Actual);
+    free(Texels);
+
+    if(!TestAssignmentKernels(Detected))
+    {
+        Passed = false;
+    }
+
+    if(!TestRestartDeterminism())
+    {
+        Passed = false;
+    }
+
+    return(Passed);
+}
@@ -0,0 +1,440 @@
+// NOTE: Frame sequences. Frames come one after the other from a stream,
+// either YUV4MPEG2 (8-bit 4:2:0, 4:2:2, 4:4:4 or mono, converted to sRGB with
+// BT.601) or headerless RGBA of a given size, and each one is handed out as
+// an RGBA bitmap. The sequence mode in main keeps one incremental palettizer
+// for the whole stream, so every frame starts from the centroids of the one
+// before it.
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#define MAX_Y4M_HEADER_LENGTH 1024
+
+struct frame_reader
+{
+    FILE *File;
+    sequence_format Format;
+
+    int Width;
+    int Height;
+
+    // NOTE: Only used for Y4M. ChromaShiftX/Y are how many times smaller the
+    // chroma planes are on each axis, as a shift.
+    b32 HasChroma;
+    b32 FullRange;
+    int ChromaShiftX;
+    int ChromaShiftY;
+    int ChromaWidth;
+    int ChromaHeight;
+    u8 *Planes;
+};
+
+// NOTE: Reads up to and including the next newline, which isn't stored.
+// Returns the length, or -1 if the stream ended before anything was read.
+static int
+ReadStreamLine(FILE *File, char *Line, int MaxLength)
+{
+    int Length = 0;
+    int C = fgetc(File);
+    int Result = (C == EOF) ? -1 : 0;
+    while((C != EOF) && (C != '\n'))
+    {
+        if(Length < (MaxLength - 1))
+        {
+            Line[Length++] = (char)C;
+        }
+        C = fgetc(File);
+    }
+    Line[Length] = '\0';
+
+    if(Result == 0)
+    {
+        Result = Length;
+    }
+
+    return(Result);
+}
+
+static b32
+ParseY4MHeader(frame_reader *Reader)
+{
+    b32 Result = false;
+
+    char Line[MAX_Y4M_HEADER_LENGTH];
+    char *Magic = "YUV4MPEG2 ";
+    char *Parameters = Line;
+    if(ReadStreamLine(Reader->File, Line, sizeof(Line)) > 0)
+    {
+        while(*Magic && (*Parameters == *Magic))
+        {
+            Magic++;
+            Parameters++;
+        }
+    }
+
+    if(*Magic == '\0')
+    {
+        // NOTE: The defaults when a stream doesn't say
+        Reader->HasChroma = true;
+        Reader->ChromaShiftX = 1;
+        Reader->ChromaShiftY = 1;
+        Reader->FullRange = false;
+        b32 Supported = true;
+
+        char *Token = Parameters;
+        while(*Token)
+        {
+            char *End = Token;
+            while(*End && (*End != ' '))
+            {
+                End++;
+            }
+            char Separator = *End;
+            *End = '\0';
+
+            switch(Token[0])
+            {
+                case 'W': {Reader->Width = atoi(Token + 1);} break;
+                case 'H': {Reader->Height = atoi(Token + 1);} break;
+
+                case 'C':
+                {
+                    char *Chroma = Token + 1;
+                    if(StringsMatch(Chroma, "420jpeg") || StringsMatch(Chroma, "420paldv") ||
+                       StringsMatch(Chroma, "420mpeg2") || StringsMatch(Chroma, "420"))
+                    {
+                        Reader->ChromaShiftX = 1;
+                        Reader->ChromaShiftY = 1;
+                    }
+                    else if(StringsMatch(Chroma, "422"))
+                    {
+                        Reader->ChromaShiftX = 1;
+                        Reader->ChromaShiftY = 0;
+                    }
+                    else if(StringsMatch(Chroma, "444"))
+                    {
+                        Reader->ChromaShiftX = 0;
+                        Reader->ChromaShiftY = 0;
+                    }
+                    else if(StringsMatch(Chroma, "mono"))
+                    {
+                        Reader->HasChroma = false;
+                    }
+                    else
+                    {
+                        fprintf(stderr, "Error: unsupported Y4M chroma format \"%s\"\n", Chroma);
+                        Supported = false;
+                    }
+                } break;
+
+                case 'X':
+                {
+                    char *Range = GetOptionValue(Token + 1, "COLORRANGE");
+                    if(Range)
+                    {
+                        Reader->FullRange = StringsMatch(Range, "FULL", false);
+                    }
+                } break;
+
+                default:
+                {
+                    // NOTE: Frame rate, interlacing and aspect ratio don't
+                    // matter to the palette
+                } break;
+            }
+
+            Token = End;
+            if(Separator)
+            {
+                Token++;
+            }
+        }
+
+        Result = Supported;
+    }
+    else
+    {
+        fprintf(stderr, "Error: the stream doesn't start with a YUV4MPEG2 header\n");
+    }
+
+    return(Result);
+}
+
+static void
+CloseFrameReader(frame_reader *Reader)
+{
+    if(Reader->File && (Reader->File != stdin))
+    {
+        fclose(Reader->File);
+    }
+    free(Reader->Planes);
+
+    Reader->File = 0;
+    Reader->Planes = 0;
+}
+
+// NOTE: Path "-" is stdin. Width and Height are only used for raw RGBA, a Y4M
+// stream has its own.
+static b32
+OpenFrameReader(frame_reader *Reader, char *Path, sequence_format Format,
+                int Width, int Height)
+{
+    frame_reader Zero = {};
+    *Reader = Zero;
+    Reader->Format = Format;
+    Reader->Width = Width;
+    Reader->Height = Height;
+
+    if(StringsMatch(Path, "-"))
+    {
+#if defined(_WIN32)
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+        Reader->File = stdin;
+    }
+    else
+    {
+        Reader->File = fopen(Path, "rb");
+    }
+
+    b32 Result = false;
+    if(Reader->File)
+    {
+        if(Format == SequenceFormat_Y4M)
+        {
+            Result = ParseY4MHeader(Reader);
+        }
+        else
+        {
+            Result = true;
+        }
+
+        if(Result)
+        {
+            if((Reader->Width > 0) && (Reader->Height > 0))
+            {
+                if(Format == SequenceFormat_Y4M)
+                {
+                    int ChromaCount = 0;
+                    if(Reader->HasChroma)
+                    {
+                        Reader->ChromaWidth = (Reader->Width + (1 << Reader->ChromaShiftX) - 1) >> Reader->ChromaShiftX;
+                        Reader->ChromaHeight = (Reader->Height + (1 << Reader->ChromaShiftY) - 1) >> Reader->ChromaShiftY;
+                        ChromaCount = 2*Reader->ChromaWidth*Reader->ChromaHeight;
+                    }
+                    Reader->Planes = (u8 *)malloc((size_t)Reader->Width*Reader->Height + ChromaCount);
+                    Result = (Reader->Planes != 0);
+                }
+            }
+            else
+            {
+                fprintf(stderr, "Error: the frames need a size\n");
+                Result = false;
+            }
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Error: couldn't open %s\n", Path);
+    }
+
+    if(!Result)
+    {
+        CloseFrameReader(Reader);
+    }
+
+    return(Result);
+}
+
+inline u32
+PackYCbCrToRGBA(int Y, int Cb, int Cr, b32 FullRange)
+{
+    // NOTE: BT.601 in 8.8 fixed point
+    int D = Cb - 128;
+    int E = Cr - 128;
+    int R;
+    int G;
+    int B;
+    if(FullRange)
+    {
+        int C = Y << 8;
+        R = (C + 359*E + 128) >> 8;
+        G = (C - 88*D - 183*E + 128) >> 8;
+        B = (C + 454*D + 128) >> 8;
+    }
+    else
+    {
+        int C = 298*(Y - 16);
+        R = (C + 409*E + 128) >> 8;
+        G = (C - 100*D - 208*E + 128) >> 8;
+        B = (C + 516*D + 128) >> 8;
+    }
+
+    u32 Result = (((u32)Clampi(0, R, 255) << 0) |
+                  ((u32)Clampi(0, G, 255) << 8) |
+                  ((u32)Clampi(0, B, 255) << 16) |
+                  0xFF000000);
+
+    return(Result);
+}
+
+// NOTE: Dest has to be Width x Height. Returns false at the end of the stream
+// (or if it ends in the middle of a frame).
+static b32
+ReadFrame(frame_reader *Reader, bitmap Dest)
+{
+    Assert((Dest.Width == Reader->Width) && (Dest.Height == Reader->Height));
+
+    b32 Result = false;
+    if(Reader->Format == SequenceFormat_Y4M)
+    {
+        char Line[MAX_Y4M_HEADER_LENGTH];
+        if(ReadStreamLine(Reader->File, Line, sizeof(Line)) >= 0)
+        {
+            // NOTE: "FRAME", maybe followed by parameters that don't matter
+            Line[5] = '\0';
+            int LumaCount = Reader->Width*Reader->Height;
+            int ChromaCount = Reader->ChromaWidth*Reader->ChromaHeight;
+            int PlaneSize = LumaCount + (Reader->HasChroma ? 2*ChromaCount : 0);
+            if(StringsMatch(Line, "FRAME") &&
+               (fread(Reader->Planes, 1, PlaneSize, Reader->File) == (size_t)PlaneSize))
+            {
+                u8 *Luma = Reader->Planes;
+                u8 *Cb = Luma + LumaCount;
+                u8 *Cr = Cb + ChromaCount;
+                for(int Y = 0;
+                    Y < Reader->Height;
+                    Y++)
+                {
+                    u32 *Row = (u32 *)GetBitmapPtr(Dest, 0, Y);
+                    u8 *LumaRow = Luma + Y*Reader->Width;
+                    int ChromaRow = (Y >> Reader->ChromaShiftY)*Reader->ChromaWidth;
+                    for(int X = 0;
+                        X < Reader->Width;
+                        X++)
+                    {
+                        int ChromaIndex = ChromaRow + (X >> Reader->ChromaShiftX);
+                        Row[X] = (Reader->HasChroma ?
+                                  PackYCbCrToRGBA(LumaRow[X], Cb[ChromaIndex], Cr[ChromaIndex], Reader->FullRange) :
+                                  PackYCbCrToRGBA(LumaRow[X], 128, 128, Reader->FullRange));
+                    }
+                }
+
+                Result = true;
+            }
+        }
+    }
+    else
+    {
+        Result = true;
+        for(int Y = 0;
+            Result && (Y < Reader->Height);
+            Y++)
+        {
+            Result = (fread(GetBitmapPtr(Dest, 0, Y), sizeof(u32), Reader->Width, Reader->File) ==
+                      (size_t)Reader->Width);
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Coarse on purpose, so noise and compression don't count as change
+#define FRAME_HISTOGRAM_BITS 4
+#define FRAME_HISTOGRAM_BIN_COUNT (1 << (3*FRAME_HISTOGRAM_BITS))
+struct frame_histogram
+{
+    int TexelCount;
+    u32 Counts[FRAME_HISTOGRAM_BIN_COUNT];
+};
+
+static void
+ComputeFrameHistogram(bitmap Bitmap, frame_histogram *Histogram)
+{
+    Histogram->TexelCount = Bitmap.Width*Bitmap.Height;
+    for(int Bin = 0;
+        Bin < FRAME_HISTOGRAM_BIN_COUNT;
+        Bin++)
+    {
+        Histogram->Counts[Bin] = 0;
+    }
+
+    int Shift = 8 - FRAME_HISTOGRAM_BITS;
+    u32 Mask = (1 << FRAME_HISTOGRAM_BITS) - 1;
+    for(int Y = 0;
+        Y < Bitmap.Height;
+        Y++)
+    {
+        u32 *Row = (u32 *)GetBitmapPtr(Bitmap, 0, Y);
+        for(int X = 0;
+            X < Bitmap.Width;
+            X++)
+        {
+            u32 Texel = Row[X];
+            u32 Bin = ((((Texel >> (0 + Shift)) & Mask) << (0*FRAME_HISTOGRAM_BITS)) |
+                       (((Texel >> (8 + Shift)) & Mask) << (1*FRAME_HISTOGRAM_BITS)) |
+                       (((Texel >> (16 + Shift)) & Mask) << (2*FRAME_HISTOGRAM_BITS)));
+            Histogram->Counts[Bin]++;
+        }
+    }
+}
+
+// NOTE: The fraction of texels that would have to change bins to turn one
+// histogram into the other, from 0 to 1
+static f32
+ComputeHistogramChange(frame_histogram *A, frame_histogram *B)
+{
+    Assert(A->TexelCount == B->TexelCount);
+
+    u64 Difference = 0;
+    for(int Bin = 0;
+        Bin < FRAME_HISTOGRAM_BIN_COUNT;
+        Bin++)
+    {
+        u32 CountA = A->Counts[Bin];
+        u32 CountB = B->Counts[Bin];
+        Difference += (CountA > CountB) ? (CountA - CountB) : (CountB - CountA);
+    }
+
+    f32 Result = SafeRatio0((f32)Difference, 2.0f*(f32)A->TexelCount);
+
+    return(Result);
+}
+
+// NOTE: The bounding rectangle of the texels that differ between two bitmaps
+// of the same size, empty (MinX == MaxX) if none do
+static void
+FindChangedRect(bitmap A, bitmap B, int *MinX, int *MinY, int *MaxX, int *MaxY)
+{
+    Assert((A.Width == B.Width) && (A.Height == B.Height));
+
+    *MinX = A.Width;
+    *MinY = A.Height;
+    *MaxX = 0;
+    *MaxY = 0;
+    for(int Y = 0;
+        Y < A.Height;
+        Y++)
+    {
+        u32 *RowA = (u32 *)GetBitmapPtr(A, 0, Y);
+        u32 *RowB = (u32 *)GetBitmapPtr(B, 0, Y);
+        for(int X = 0;
+            X < A.Width;
+            X++)
+        {
+            if(RowA[X] != RowB[X])
+            {
+                *MinX = Minimum(*MinX, X);
+                *MinY = Minimum(*MinY, Y);
+                *MaxX = Maximum(*MaxX, X + 1);
+                *MaxY = Maximum(*MaxY, Y + 1);
+            }
+        }
+    }
+
+    if(*MaxX == 0)
+    {
+        *MinX = *MinY = *MaxX = *MaxY = 0;
+    }
+}
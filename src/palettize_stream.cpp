@@ -0,0 +1,544 @@
+// NOTE: Row streaming for the formats simple enough to read a row at a time:
+// binary PPM and PGM with 8-bit samples, uncompressed 24-bit BMP, and
+// non-interlaced PNG with 8-bit gray, RGB or palette samples, inflated a row
+// at a time (see palettize_inflate.cpp). stb_image always decodes a whole
+// image into memory, so for these the downsampler, the histogram builder and
+// the octree read rows straight from the file instead and never hold more
+// than a few rows of the source. Everything else still goes through
+// stb_image, including any PNG with alpha or a transparent color, so every
+// streamed texel comes out opaque.
+//
+// NOTE: A row's bytes have to fit in an int, the image as a whole doesn't, so
+// a scan too big for stb_image can still be read whole
+#define MAX_STREAM_WIDTH (1 << 24)
+
+enum image_stream_format
+{
+    ImageStreamFormat_PPM,
+    ImageStreamFormat_PGM,
+    ImageStreamFormat_BMP,
+    ImageStreamFormat_PNG,
+};
+
+struct image_stream
+{
+    FILE *File;
+    image_stream_format Format;
+
+    int Width;
+    int Height;
+    int NextY;
+
+    // NOTE: Where the first stored row starts and how far apart rows are,
+    // padding included. BMP stores its rows bottom up unless its height is
+    // negative, so those are read with a seek each.
+    s64 PixelOffset;
+    int RowStride;
+    b32 BottomUp;
+
+    u8 *Row;
+
+    // NOTE: PNG rows are inflated into Row, filter type byte first, and
+    // unfiltered against the row before, which stays in PreviousRow
+    inflater *Inflater;
+    u8 *PreviousRow;
+    int ChannelCount;
+    b32 Paletted;
+    u32 Palette[256];
+};
+
+// NOTE: Skips whitespace and # comments, then reads a decimal number.
+// Returns -1 if there isn't one.
+static int
+ReadPNMNumber(FILE *File)
+{
+    int C = fgetc(File);
+    for(;;)
+    {
+        if(C == '#')
+        {
+            while((C != EOF) && (C != '\n'))
+            {
+                C = fgetc(File);
+            }
+        }
+        else if((C == ' ') || (C == '\t') || (C == '\r') || (C == '\n'))
+        {
+            C = fgetc(File);
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    int Result = -1;
+    if((C >= '0') && (C <= '9'))
+    {
+        Result = 0;
+        while((C >= '0') && (C <= '9'))
+        {
+            if(Result < 100000000)
+            {
+                Result = 10*Result + (C - '0');
+            }
+            C = fgetc(File);
+        }
+        // NOTE: The single whitespace character after the last number of the
+        // header is consumed with it, and the texels start right after
+    }
+
+    return(Result);
+}
+
+inline u32
+ReadU16LE(u8 *Bytes)
+{
+    u32 Result = ((u32)Bytes[0] << 0) | ((u32)Bytes[1] << 8);
+
+    return(Result);
+}
+
+inline u32
+ReadU32LE(u8 *Bytes)
+{
+    u32 Result = (((u32)Bytes[0] << 0) | ((u32)Bytes[1] << 8) |
+                  ((u32)Bytes[2] << 16) | ((u32)Bytes[3] << 24));
+
+    return(Result);
+}
+
+static void
+CloseImageStream(image_stream *Stream)
+{
+    if(Stream->File)
+    {
+        fclose(Stream->File);
+    }
+    free(Stream->Row);
+    free(Stream->PreviousRow);
+    if(Stream->Inflater)
+    {
+        free(Stream->Inflater->Input);
+        free(Stream->Inflater->Window);
+    }
+    free(Stream->Inflater);
+
+    Stream->File = 0;
+    Stream->Row = 0;
+    Stream->PreviousRow = 0;
+    Stream->Inflater = 0;
+}
+
+inline b32
+IsPNGChunk(u8 *Type, char *Name)
+{
+    b32 Result = ((Type[0] == Name[0]) && (Type[1] == Name[1]) &&
+                  (Type[2] == Name[2]) && (Type[3] == Name[3]));
+
+    return(Result);
+}
+
+// NOTE: Reads the chunks up to the first IDAT, leaving the file at the start
+// of its data. Returns false if the PNG is one stb_image has to decode.
+static b32
+OpenPNGStream(image_stream *Stream)
+{
+    b32 Result = false;
+
+    u8 Header[8];
+    u8 Info[13];
+    if((fread(Header, 1, sizeof(Header), Stream->File) == sizeof(Header)) &&
+       (ReadU32BE(Header) == sizeof(Info)) && IsPNGChunk(Header + 4, "IHDR") &&
+       (fread(Info, 1, sizeof(Info), Stream->File) == sizeof(Info)))
+    {
+        u32 Width = ReadU32BE(Info + 0);
+        u32 Height = ReadU32BE(Info + 4);
+        u32 BitDepth = Info[8];
+        u32 ColorType = Info[9];
+
+        Stream->Format = ImageStreamFormat_PNG;
+        Stream->Width = (int)Minimum(Width, (u32)MAX_STREAM_WIDTH + 1);
+        Stream->Height = (int)Minimum(Height, (u32)0x7FFFFFFF);
+        Stream->ChannelCount = (ColorType == 2) ? 3 : 1;
+        Stream->Paletted = (ColorType == 3);
+        Stream->RowStride = 1 + Stream->ChannelCount*Stream->Width;
+        Stream->BottomUp = false;
+
+        // NOTE: Gray, RGB and palette only, with no 16-bit or packed samples
+        // and no interlacing. The chunk's CRC is skipped.
+        Result = ((Width > 0) && (Height > 0) && (BitDepth == 8) &&
+                  ((ColorType == 0) || (ColorType == 2) || (ColorType == 3)) &&
+                  (Info[10] == 0) && (Info[11] == 0) && (Info[12] == 0) &&
+                  SeekFile(Stream->File, 4, SEEK_CUR));
+    }
+
+    for(int Index = 0;
+        Index < 256;
+        Index++)
+    {
+        Stream->Palette[Index] = 0xFF000000;
+    }
+
+    b32 HasPalette = false;
+    b32 FoundData = false;
+    while(Result && !FoundData)
+    {
+        Result = (fread(Header, 1, sizeof(Header), Stream->File) == sizeof(Header));
+        u32 Length = ReadU32BE(Header);
+        u8 *Type = Header + 4;
+        if(Result && IsPNGChunk(Type, "IDAT"))
+        {
+            FoundData = true;
+
+            inflater *Inflater = Stream->Inflater = (inflater *)calloc(1, sizeof(inflater));
+            Result = (Inflater != 0);
+            if(Result)
+            {
+                Inflater->File = Stream->File;
+                Inflater->ChunkRemaining = Length;
+                Inflater->Input = (u8 *)malloc(INFLATE_INPUT_SIZE);
+                Inflater->Window = (u8 *)malloc(INFLATE_WINDOW_SIZE);
+                Result = (Inflater->Input && Inflater->Window && BeginInflater(Inflater));
+            }
+        }
+        else if(Result && IsPNGChunk(Type, "PLTE"))
+        {
+            u8 Entries[3*256];
+            Result = ((Length <= sizeof(Entries)) && ((Length % 3) == 0) &&
+                      (fread(Entries, 1, Length, Stream->File) == Length) &&
+                      SeekFile(Stream->File, 4, SEEK_CUR));
+            for(u32 Index = 0;
+                Result && (Index < (Length / 3));
+                Index++)
+            {
+                u8 *Entry = Entries + 3*Index;
+                Stream->Palette[Index] = (((u32)Entry[0] << 0) | ((u32)Entry[1] << 8) |
+                                          ((u32)Entry[2] << 16) | 0xFF000000);
+            }
+            HasPalette = true;
+        }
+        else if(Result && IsPNGChunk(Type, "tRNS"))
+        {
+            // NOTE: Some of the texels aren't opaque
+            Result = false;
+        }
+        else if(Result)
+        {
+            Result = ((Length <= 0x7FFFFFFF) &&
+                      SeekFile(Stream->File, Length, SEEK_CUR) &&
+                      SeekFile(Stream->File, 4, SEEK_CUR));
+        }
+    }
+
+    Result = (Result && (!Stream->Paletted || HasPalette));
+    if(Result)
+    {
+        Stream->PreviousRow = (u8 *)calloc(1, Stream->RowStride);
+        Result = (Stream->PreviousRow != 0);
+    }
+
+    return(Result);
+}
+
+inline int
+PaethPredictor(int Left, int Up, int UpLeft)
+{
+    int Estimate = Left + Up - UpLeft;
+    int LeftDistance = Absi(Estimate - Left);
+    int UpDistance = Absi(Estimate - Up);
+    int UpLeftDistance = Absi(Estimate - UpLeft);
+
+    int Result = UpLeft;
+    if((LeftDistance <= UpDistance) && (LeftDistance <= UpLeftDistance))
+    {
+        Result = Left;
+    }
+    else if(UpDistance <= UpLeftDistance)
+    {
+        Result = Up;
+    }
+
+    return(Result);
+}
+
+// NOTE: Undoes the filter of the row in Row, then swaps it into PreviousRow
+// for the next one. Returns false for a filter type PNG doesn't have.
+static b32
+UnfilterPNGRow(image_stream *Stream)
+{
+    b32 Result = true;
+
+    u8 *Row = Stream->Row + 1;
+    u8 *Previous = Stream->PreviousRow + 1;
+    int ByteCount = Stream->RowStride - 1;
+    int Step = Stream->ChannelCount;
+    switch(Stream->Row[0])
+    {
+        case 0:
+        {
+        } break;
+
+        case 1:
+        {
+            for(int Index = Step;
+                Index < ByteCount;
+                Index++)
+            {
+                Row[Index] = (u8)(Row[Index] + Row[Index - Step]);
+            }
+        } break;
+
+        case 2:
+        {
+            for(int Index = 0;
+                Index < ByteCount;
+                Index++)
+            {
+                Row[Index] = (u8)(Row[Index] + Previous[Index]);
+            }
+        } break;
+
+        case 3:
+        {
+            for(int Index = 0;
+                Index < ByteCount;
+                Index++)
+            {
+                int Left = (Index >= Step) ? Row[Index - Step] : 0;
+                Row[Index] = (u8)(Row[Index] + ((Left + Previous[Index]) >> 1));
+            }
+        } break;
+
+        case 4:
+        {
+            for(int Index = 0;
+                Index < ByteCount;
+                Index++)
+            {
+                int Left = (Index >= Step) ? Row[Index - Step] : 0;
+                int UpLeft = (Index >= Step) ? Previous[Index - Step] : 0;
+                Row[Index] = (u8)(Row[Index] + PaethPredictor(Left, Previous[Index], UpLeft));
+            }
+        } break;
+
+        default:
+        {
+            Result = false;
+        } break;
+    }
+
+    u8 *Swap = Stream->PreviousRow;
+    Stream->PreviousRow = Stream->Row;
+    Stream->Row = Swap;
+
+    return(Result);
+}
+
+// NOTE: Returns false, without complaining, if Path isn't in one of the
+// streamed formats, so the caller can hand it to stb_image instead
+static b32
+OpenImageStream(image_stream *Stream, char *Path)
+{
+    image_stream Zero = {};
+    *Stream = Zero;
+
+    b32 Result = false;
+    Stream->File = fopen(Path, "rb");
+    if(Stream->File)
+    {
+        u8 Header[54];
+        size_t HeaderSize = fread(Header, 1, 2, Stream->File);
+        if((HeaderSize == 2) && (Header[0] == 0x89) && (Header[1] == 'P') &&
+           (fread(Header + 2, 1, 6, Stream->File) == 6) &&
+           (Header[2] == 'N') && (Header[3] == 'G') && (Header[4] == '\r') && (Header[5] == '\n') &&
+           (Header[6] == 0x1A) && (Header[7] == '\n'))
+        {
+            Result = OpenPNGStream(Stream);
+        }
+        else if((HeaderSize == 2) && (Header[0] == 'P') &&
+           ((Header[1] == '6') || (Header[1] == '5')))
+        {
+            Stream->Format = (Header[1] == '6') ? ImageStreamFormat_PPM : ImageStreamFormat_PGM;
+            Stream->Width = ReadPNMNumber(Stream->File);
+            Stream->Height = ReadPNMNumber(Stream->File);
+            int MaxValue = ReadPNMNumber(Stream->File);
+
+            Stream->PixelOffset = TellFile(Stream->File);
+            Stream->RowStride = (int)((s64)Stream->Width*((Stream->Format == ImageStreamFormat_PPM) ? 3 : 1));
+            Stream->BottomUp = false;
+
+            // NOTE: 16-bit samples are left to stb_image
+            Result = ((Stream->Width > 0) && (Stream->Height > 0) && (MaxValue == 255));
+        }
+        else if((HeaderSize == 2) && (Header[0] == 'B') && (Header[1] == 'M') &&
+                (fread(Header + 2, 1, sizeof(Header) - 2, Stream->File) == (sizeof(Header) - 2)))
+        {
+            int Width = (int)ReadU32LE(Header + 18);
+            int Height = (int)ReadU32LE(Header + 22);
+            u32 InfoSize = ReadU32LE(Header + 14);
+            u32 BitCount = ReadU16LE(Header + 28);
+            u32 Compression = ReadU32LE(Header + 30);
+
+            Stream->Format = ImageStreamFormat_BMP;
+            Stream->Width = Width;
+            Stream->Height = (Height < 0) ? -Height : Height;
+            Stream->PixelOffset = ReadU32LE(Header + 10);
+            Stream->RowStride = (int)((3*(s64)Width + 3) & ~3);
+            Stream->BottomUp = (Height > 0);
+
+            Result = ((InfoSize >= 40) && (BitCount == 24) && (Compression == 0) &&
+                      (Stream->Width > 0) && (Stream->Height > 0));
+        }
+
+        Result = (Result && (Stream->Width <= MAX_STREAM_WIDTH));
+        if(Result)
+        {
+            Stream->Row = (u8 *)malloc(Stream->RowStride);
+            Result = (Stream->Row != 0);
+        }
+    }
+
+    if(!Result)
+    {
+        CloseImageStream(Stream);
+    }
+
+    return(Result);
+}
+
+// NOTE: Rows come top to bottom, Dest has to hold Width texels. Returns false
+// if the file ends early.
+static b32
+ReadImageStreamRow(image_stream *Stream, u32 *Dest)
+{
+    Assert(Stream->NextY < Stream->Height);
+
+    b32 Result = true;
+    if(Stream->BottomUp)
+    {
+        s64 Offset = Stream->PixelOffset + (s64)(Stream->Height - 1 - Stream->NextY)*Stream->RowStride;
+        Result = SeekFile(Stream->File, Offset, SEEK_SET);
+    }
+    else if((Stream->Format == ImageStreamFormat_BMP) && (Stream->NextY == 0))
+    {
+        Result = SeekFile(Stream->File, Stream->PixelOffset, SEEK_SET);
+    }
+
+    if(Result)
+    {
+        if(Stream->Format == ImageStreamFormat_PNG)
+        {
+            Result = (InflateBytes(Stream->Inflater, Stream->Row, Stream->RowStride) &&
+                      UnfilterPNGRow(Stream));
+        }
+        else
+        {
+            Result = (fread(Stream->Row, 1, Stream->RowStride, Stream->File) == (size_t)Stream->RowStride);
+        }
+    }
+
+    if(Result)
+    {
+        u8 *Source = Stream->Row;
+        switch(Stream->Format)
+        {
+            case ImageStreamFormat_PPM:
+            {
+                for(int X = 0;
+                    X < Stream->Width;
+                    X++)
+                {
+                    Dest[X] = (((u32)Source[0] << 0) | ((u32)Source[1] << 8) |
+                               ((u32)Source[2] << 16) | 0xFF000000);
+                    Source += 3;
+                }
+            } break;
+
+            case ImageStreamFormat_PGM:
+            {
+                for(int X = 0;
+                    X < Stream->Width;
+                    X++)
+                {
+                    u32 Gray = Source[X];
+                    Dest[X] = (Gray << 0) | (Gray << 8) | (Gray << 16) | 0xFF000000;
+                }
+            } break;
+
+            case ImageStreamFormat_BMP:
+            {
+                for(int X = 0;
+                    X < Stream->Width;
+                    X++)
+                {
+                    Dest[X] = (((u32)Source[2] << 0) | ((u32)Source[1] << 8) |
+                               ((u32)Source[0] << 16) | 0xFF000000);
+                    Source += 3;
+                }
+            } break;
+
+            case ImageStreamFormat_PNG:
+            {
+                // NOTE: The unfiltered row was swapped into PreviousRow
+                Source = Stream->PreviousRow + 1;
+                for(int X = 0;
+                    X < Stream->Width;
+                    X++)
+                {
+                    if(Stream->Paletted)
+                    {
+                        Dest[X] = Stream->Palette[Source[X]];
+                    }
+                    else if(Stream->ChannelCount == 3)
+                    {
+                        u8 *Texel = Source + 3*X;
+                        Dest[X] = (((u32)Texel[0] << 0) | ((u32)Texel[1] << 8) |
+                                   ((u32)Texel[2] << 16) | 0xFF000000);
+                    }
+                    else
+                    {
+                        u32 Gray = Source[X];
+                        Dest[X] = (Gray << 0) | (Gray << 8) | (Gray << 16) | 0xFF000000;
+                    }
+                }
+            } break;
+
+            InvalidDefaultCase;
+        }
+
+        Stream->NextY++;
+    }
+    else
+    {
+        fprintf(stderr, "Error: the image ends, or is corrupt, before its last row\n");
+        Result = false;
+    }
+
+    return(Result);
+}
+
+// NOTE: Reads every row into one bitmap, allocated with malloc. Returns a
+// bitmap with no memory if it couldn't allocate or the file ended early.
+static bitmap
+ReadStreamedBitmap(image_stream *Stream)
+{
+    bitmap Result = {};
+    Result.Width = Stream->Width;
+    Result.Height = Stream->Height;
+    Result.Pitch = (int)sizeof(u32)*Result.Width;
+    Result.Memory = malloc((size_t)Result.Pitch*Result.Height);
+
+    for(int Y = 0;
+        Result.Memory && (Y < Result.Height);
+        Y++)
+    {
+        if(!ReadImageStreamRow(Stream, (u32 *)GetBitmapPtr(Result, 0, Y)))
+        {
+            free(Result.Memory);
+            Result.Memory = 0;
+        }
+    }
+
+    return(Result);
+}
@@ -40,5 +40,26 @@ StringsMatch(char *A, char *B, b32 CaseSensitive = true)
     return(Result);
 }
 
+// NOTE: Returns the value part of an argument of the form Name=Value, or 0 if
+// the argument is not that option
+inline char *
+GetOptionValue(char *Arg, char *Name)
+{
+    char *Result = 0;
+
+    while(*Name && (*Arg == *Name))
+    {
+        Arg++;
+        Name++;
+    }
+
+    if((*Name == '\0') && (*Arg == '='))
+    {
+        Result = Arg + 1;
+    }
+
+    return(Result);
+}
+
 #define PALETTIZE_STRING_H
 #endif
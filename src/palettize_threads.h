@@ -0,0 +1,209 @@
+#if !defined(PALETTIZE_THREADS_H)
+
+// NOTE: A small work queue in the style of a platform layer. Worker threads
+// sleep on a semaphore and pull entries off a fixed ring, and the thread that
+// queued the work (the only one allowed to add to it) helps finish it in
+// CompleteAllWork. Entries must not depend on each other.
+
+#if defined(_WIN32)
+#pragma warning(push, 0)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#pragma warning(pop)
+typedef HANDLE semaphore_handle;
+#define CompletePreviousWritesBeforeFutureWrites MemoryBarrier()
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#include <unistd.h>
+typedef sem_t semaphore_handle;
+#define CompletePreviousWritesBeforeFutureWrites __sync_synchronize()
+#endif
+
+// NOTE: Returns the value *Value had before the exchange
+inline u32
+AtomicCompareExchangeU32(u32 volatile *Value, u32 New, u32 Expected)
+{
+#if defined(_WIN32)
+    u32 Result = (u32)InterlockedCompareExchange((LONG volatile *)Value, (LONG)New, (LONG)Expected);
+#else
+    u32 Result = __sync_val_compare_and_swap(Value, Expected, New);
+#endif
+
+    return(Result);
+}
+
+// NOTE: Returns the incremented value
+inline u32
+AtomicIncrementU32(u32 volatile *Value)
+{
+#if defined(_WIN32)
+    u32 Result = (u32)InterlockedIncrement((LONG volatile *)Value);
+#else
+    u32 Result = __sync_add_and_fetch(Value, 1);
+#endif
+
+    return(Result);
+}
+
+inline int
+GetLogicalProcessorCount(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO SystemInfo;
+    GetSystemInfo(&SystemInfo);
+    int Result = (int)SystemInfo.dwNumberOfProcessors;
+#else
+    int Result = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+    if(Result < 1)
+    {
+        Result = 1;
+    }
+
+    return(Result);
+}
+
+struct work_queue;
+// NOTE: None of the callbacks add work of their own, so the queue is left
+// unnamed to keep them from warning about it
+#define WORK_QUEUE_CALLBACK(name) void name(work_queue * /* Queue */, void *Data)
+typedef WORK_QUEUE_CALLBACK(work_queue_callback);
+
+struct work_queue_entry
+{
+    work_queue_callback *Callback;
+    void *Data;
+};
+
+#define MAX_WORK_QUEUE_ENTRY_COUNT 256
+struct work_queue
+{
+    u32 volatile CompletionGoal;
+    u32 volatile CompletionCount;
+
+    u32 volatile NextEntryToWrite;
+    u32 volatile NextEntryToRead;
+    semaphore_handle Semaphore;
+
+    work_queue_entry Entries[MAX_WORK_QUEUE_ENTRY_COUNT];
+};
+
+inline void
+AddEntry(work_queue *Queue, work_queue_callback *Callback, void *Data)
+{
+    u32 NewNextEntryToWrite = (Queue->NextEntryToWrite + 1) % MAX_WORK_QUEUE_ENTRY_COUNT;
+    Assert(NewNextEntryToWrite != Queue->NextEntryToRead);
+
+    work_queue_entry *Entry = Queue->Entries + Queue->NextEntryToWrite;
+    Entry->Callback = Callback;
+    Entry->Data = Data;
+    ++Queue->CompletionGoal;
+
+    CompletePreviousWritesBeforeFutureWrites;
+
+    Queue->NextEntryToWrite = NewNextEntryToWrite;
+#if defined(_WIN32)
+    ReleaseSemaphore(Queue->Semaphore, 1, 0);
+#else
+    sem_post(&Queue->Semaphore);
+#endif
+}
+
+// NOTE: Returns whether there was nothing to do
+inline b32
+DoNextWorkQueueEntry(work_queue *Queue)
+{
+    b32 ShouldSleep = false;
+
+    u32 OriginalNextEntryToRead = Queue->NextEntryToRead;
+    u32 NewNextEntryToRead = (OriginalNextEntryToRead + 1) % MAX_WORK_QUEUE_ENTRY_COUNT;
+    if(OriginalNextEntryToRead != Queue->NextEntryToWrite)
+    {
+        u32 Index = AtomicCompareExchangeU32(&Queue->NextEntryToRead,
+                                             NewNextEntryToRead,
+                                             OriginalNextEntryToRead);
+        if(Index == OriginalNextEntryToRead)
+        {
+            work_queue_entry Entry = Queue->Entries[Index];
+            Entry.Callback(Queue, Entry.Data);
+            AtomicIncrementU32(&Queue->CompletionCount);
+        }
+    }
+    else
+    {
+        ShouldSleep = true;
+    }
+
+    return(ShouldSleep);
+}
+
+inline void
+CompleteAllWork(work_queue *Queue)
+{
+    while(Queue->CompletionGoal != Queue->CompletionCount)
+    {
+        DoNextWorkQueueEntry(Queue);
+    }
+
+    Queue->CompletionGoal = 0;
+    Queue->CompletionCount = 0;
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI
+WorkQueueThreadProc(LPVOID Parameter)
+#else
+static void *
+WorkQueueThreadProc(void *Parameter)
+#endif
+{
+    work_queue *Queue = (work_queue *)Parameter;
+
+    for(;;)
+    {
+        if(DoNextWorkQueueEntry(Queue))
+        {
+#if defined(_WIN32)
+            WaitForSingleObjectEx(Queue->Semaphore, INFINITE, FALSE);
+#else
+            sem_wait(&Queue->Semaphore);
+#endif
+        }
+    }
+}
+
+// NOTE: The worker threads live until the process exits
+static void
+InitializeWorkQueue(work_queue *Queue, int ThreadCount)
+{
+    Queue->CompletionGoal = 0;
+    Queue->CompletionCount = 0;
+    Queue->NextEntryToWrite = 0;
+    Queue->NextEntryToRead = 0;
+
+#if defined(_WIN32)
+    Queue->Semaphore = CreateSemaphoreEx(0, 0, Maximum(ThreadCount, 1), 0, 0, SEMAPHORE_ALL_ACCESS);
+#else
+    sem_init(&Queue->Semaphore, 0, 0);
+#endif
+
+    for(int ThreadIndex = 0;
+        ThreadIndex < ThreadCount;
+        ThreadIndex++)
+    {
+#if defined(_WIN32)
+        HANDLE Thread = CreateThread(0, 0, WorkQueueThreadProc, Queue, 0, 0);
+        CloseHandle(Thread);
+#else
+        pthread_t Thread;
+        pthread_create(&Thread, 0, WorkQueueThreadProc, Queue);
+        pthread_detach(Thread);
+#endif
+    }
+}
+
+#define PALETTIZE_THREADS_H
+#endif
@@ -0,0 +1,254 @@
+// NOTE: Tiled Lloyd for clustering every texel of a full resolution source.
+// The other exact engines convert the whole image to observations up front
+// and keep a cluster index per texel, which is 16 bytes a texel on top of the
+// image and far more than any cache holds. Here the image is walked in tiles
+// of TILE_TEXEL_COUNT texels instead. Each tile is converted into a scratch
+// buffer, assigned, and folded into partial sums before the next one, so all
+// a pass touches besides the texels themselves stays in L2.
+//
+// The tiles are split into a fixed number of chunks, each with its own
+// context and double precision sums, and the chunks' sums are merged in
+// order. How the work is split doesn't depend on the thread count, so
+// neither do the centroids.
+//
+// Without the per-texel indices, a pass can't tell whether any assignment
+// changed. It wouldn't help much anyway: over tens of millions of texels
+// Lloyd takes hundreds of passes to settle completely, each one nudging the
+// centroids a little less than the last. So it's meant to start from
+// centroids that are already close, like those of Lloyd on the 100px copy,
+// and it stops once a pass takes less than TILED_INERTIA_TOLERANCE of the
+// inertia off, or no centroid moves at all.
+#define TILE_TEXEL_COUNT 8192
+#define MAX_TILE_CHUNK_COUNT 64
+#define MAX_TILED_ITERATION_COUNT 256
+#define TILED_INERTIA_TOLERANCE 1e-4
+
+struct tile_chunk
+{
+    kmeans_context Context;
+
+    u32 *Texels;
+    s64 FirstTexel;
+    s64 OnePastLastTexel;
+    v3 Scale;
+
+    // NOTE: One tile's worth of scratch
+    observation_buffer Observations;
+    u32 *ClusterIndices;
+
+    // NOTE: Over all of the chunk's tiles, the squared lengths of the
+    // observations and per cluster sums of them
+    f64 SquaredLengthSum;
+    f64 *SumX;
+    f64 *SumY;
+    f64 *SumZ;
+    s64 *Counts;
+};
+
+static
+WORK_QUEUE_CALLBACK(AccumulateTileChunk)
+{
+    tile_chunk *Chunk = (tile_chunk *)Data;
+    kmeans_context *Context = &Chunk->Context;
+
+    Chunk->SquaredLengthSum = 0.0;
+    for(int ClusterIndex = 0;
+        ClusterIndex < Context->ClusterCount;
+        ClusterIndex++)
+    {
+        ClearObservations(Context->Clusters + ClusterIndex);
+        Chunk->SumX[ClusterIndex] = 0.0;
+        Chunk->SumY[ClusterIndex] = 0.0;
+        Chunk->SumZ[ClusterIndex] = 0.0;
+        Chunk->Counts[ClusterIndex] = 0;
+    }
+
+    b32 Scaled = !EqualsApproximately(Chunk->Scale, V3(1.0f, 1.0f, 1.0f));
+    for(s64 First = Chunk->FirstTexel;
+        First < Chunk->OnePastLastTexel;
+        First += TILE_TEXEL_COUNT)
+    {
+        observation_buffer *Observations = &Chunk->Observations;
+        Observations->Count = (int)Minimum((s64)TILE_TEXEL_COUNT, Chunk->OnePastLastTexel - First);
+
+        Kernels.ConvertTexels(Chunk->Texels + First, Observations->Count,
+                              Observations->X, Observations->Y, Observations->Z);
+        if(Scaled)
+        {
+            ScaleObservations(Observations, Chunk->Scale);
+        }
+        Kernels.AssignObservations(Context, Observations, 0, Observations->Count,
+                                   Chunk->ClusterIndices, false);
+
+        for(int Index = 0;
+            Index < Observations->Count;
+            Index++)
+        {
+            Chunk->SquaredLengthSum += (Square(Observations->X[Index]) +
+                                        Square(Observations->Y[Index]) +
+                                        Square(Observations->Z[Index]));
+        }
+
+        // NOTE: A tile's sums are small enough for single precision, it's
+        // adding up all of them that needs double
+        for(int ClusterIndex = 0;
+            ClusterIndex < Context->ClusterCount;
+            ClusterIndex++)
+        {
+            cluster *Cluster = Context->Clusters + ClusterIndex;
+            if(Cluster->ObservationCount)
+            {
+                Chunk->SumX[ClusterIndex] += Cluster->ObservationSum.x;
+                Chunk->SumY[ClusterIndex] += Cluster->ObservationSum.y;
+                Chunk->SumZ[ClusterIndex] += Cluster->ObservationSum.z;
+                Chunk->Counts[ClusterIndex] += Cluster->ObservationCount;
+                ClearObservations(Cluster);
+            }
+        }
+    }
+}
+
+// NOTE: Starts from the centroids already in Context and iterates over the
+// whole of Source. Every cluster ends up with its share of all the texels.
+// Returns the number of passes it took, or 0 if it couldn't allocate its
+// buffers.
+static int
+RunTiledKMeans(kmeans_context *Context, bitmap Source, v3 Scale, work_queue *Queue)
+{
+    int Result = 0;
+
+    Assert(Source.Pitch == (int)sizeof(u32)*Source.Width);
+
+    u32 *Texels = (u32 *)Source.Memory;
+    s64 TexelCount = (s64)Source.Width*Source.Height;
+    s64 TileCount = (TexelCount + TILE_TEXEL_COUNT - 1) / TILE_TEXEL_COUNT;
+    int ChunkCount = (int)Minimum((s64)MAX_TILE_CHUNK_COUNT, TileCount);
+
+    tile_chunk Chunks[MAX_TILE_CHUNK_COUNT] = {};
+    b32 Allocated = true;
+    for(int ChunkIndex = 0;
+        ChunkIndex < ChunkCount;
+        ChunkIndex++)
+    {
+        tile_chunk *Chunk = Chunks + ChunkIndex;
+
+        InitializeKMeansContext(&Chunk->Context, Context->ClusterCount);
+        Chunk->Texels = Texels;
+        Chunk->FirstTexel = TILE_TEXEL_COUNT*((TileCount*ChunkIndex) / ChunkCount);
+        Chunk->OnePastLastTexel = Minimum(TexelCount,
+                                          TILE_TEXEL_COUNT*((TileCount*(ChunkIndex + 1)) / ChunkCount));
+        Chunk->Scale = Scale;
+        Chunk->Observations = AllocateObservationBuffer(TILE_TEXEL_COUNT);
+        Chunk->ClusterIndices = (u32 *)malloc(sizeof(u32)*TILE_TEXEL_COUNT);
+        Chunk->SumX = (f64 *)malloc(sizeof(f64)*Context->ClusterCount);
+        Chunk->SumY = (f64 *)malloc(sizeof(f64)*Context->ClusterCount);
+        Chunk->SumZ = (f64 *)malloc(sizeof(f64)*Context->ClusterCount);
+        Chunk->Counts = (s64 *)malloc(sizeof(s64)*Context->ClusterCount);
+
+        if(!Chunk->Context.Clusters ||
+           !Chunk->Observations.X || !Chunk->Observations.Y || !Chunk->Observations.Z ||
+           !Chunk->ClusterIndices ||
+           !Chunk->SumX || !Chunk->SumY || !Chunk->SumZ || !Chunk->Counts)
+        {
+            Allocated = false;
+        }
+    }
+
+    if(Allocated && (ChunkCount > 0))
+    {
+        f64 PreviousInertia = 0.0;
+        b32 Improved = true;
+        while(Improved && (Result < MAX_TILED_ITERATION_COUNT))
+        {
+            for(int ChunkIndex = 0;
+                ChunkIndex < ChunkCount;
+                ChunkIndex++)
+            {
+                tile_chunk *Chunk = Chunks + ChunkIndex;
+                for(int ClusterIndex = 0;
+                    ClusterIndex < Context->ClusterCount;
+                    ClusterIndex++)
+                {
+                    Chunk->Context.Clusters[ClusterIndex].Centroid = Context->Clusters[ClusterIndex].Centroid;
+                }
+
+                AddEntry(Queue, AccumulateTileChunk, Chunk);
+            }
+            CompleteAllWork(Queue);
+            Result++;
+
+            f64 Inertia = 0.0;
+            for(int ChunkIndex = 0;
+                ChunkIndex < ChunkCount;
+                ChunkIndex++)
+            {
+                Inertia += Chunks[ChunkIndex].SquaredLengthSum;
+            }
+
+            b32 Moved = false;
+            for(int ClusterIndex = 0;
+                ClusterIndex < Context->ClusterCount;
+                ClusterIndex++)
+            {
+                f64 SumX = 0.0;
+                f64 SumY = 0.0;
+                f64 SumZ = 0.0;
+                s64 Count = 0;
+                for(int ChunkIndex = 0;
+                    ChunkIndex < ChunkCount;
+                    ChunkIndex++)
+                {
+                    tile_chunk *Chunk = Chunks + ChunkIndex;
+                    SumX += Chunk->SumX[ClusterIndex];
+                    SumY += Chunk->SumY[ClusterIndex];
+                    SumZ += Chunk->SumZ[ClusterIndex];
+                    Count += Chunk->Counts[ClusterIndex];
+                }
+
+                cluster *Cluster = Context->Clusters + ClusterIndex;
+                Cluster->ObservationSum = V3((f32)SumX, (f32)SumY, (f32)SumZ);
+                Cluster->ObservationCount = Count;
+                if(Count)
+                {
+                    f64 InvCount = 1.0 / (f64)Count;
+                    Inertia -= (Square(SumX) + Square(SumY) + Square(SumZ))*InvCount;
+
+                    v3 Centroid = V3((f32)(SumX*InvCount),
+                                     (f32)(SumY*InvCount),
+                                     (f32)(SumZ*InvCount));
+                    if((Centroid.x != Cluster->Centroid.x) ||
+                       (Centroid.y != Cluster->Centroid.y) ||
+                       (Centroid.z != Cluster->Centroid.z))
+                    {
+                        Moved = true;
+                    }
+                    Cluster->Centroid = Centroid;
+                }
+            }
+
+            // NOTE: The first pass has nothing to compare against
+            Improved = (Moved &&
+                        ((Result == 1) ||
+                         ((PreviousInertia - Inertia) > (TILED_INERTIA_TOLERANCE*Inertia))));
+            PreviousInertia = Inertia;
+        }
+    }
+
+    for(int ChunkIndex = 0;
+        ChunkIndex < ChunkCount;
+        ChunkIndex++)
+    {
+        tile_chunk *Chunk = Chunks + ChunkIndex;
+        FreeKMeansContext(&Chunk->Context);
+        free(Chunk->Observations.X);
+        free(Chunk->Observations.Y);
+        free(Chunk->Observations.Z);
+        free(Chunk->ClusterIndices);
+        free(Chunk->SumX);
+        free(Chunk->SumY);
+        free(Chunk->SumZ);
+        free(Chunk->Counts);
+    }
+
+    return(Result);
+}
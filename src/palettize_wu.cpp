@@ -0,0 +1,507 @@
+// NOTE: Xiaolin Wu's color quantizer ("Efficient Statistical Computations for
+// Optimal Color Quantization", Graphics Gems II). Texels go into a 32^3 sRGB
+// histogram, which is turned into cumulative moment tables with one extra
+// row of zeros on each axis (hence 33^3) so the weight, sum and squared sum
+// of any box come out of 8 lookups. Starting from the whole cube, the box
+// with the largest variance is cut in two where the cut removes the most
+// variance, until there are as many boxes as clusters. There's no seed and
+// no iteration, so the result only depends on the image.
+//
+// The cuts are made in sRGB, but each cluster's centroid is the mean of its
+// texels' observations, so they're in the configured color space like every
+// other engine's and can be refined with a few Lloyd passes from there.
+
+#define WU_SIDE 33
+#define WU_CELL_COUNT (WU_SIDE*WU_SIDE*WU_SIDE)
+#define WuIndex(R, G, B) (((R)*WU_SIDE*WU_SIDE) + ((G)*WU_SIDE) + (B))
+
+enum wu_axis
+{
+    WuAxis_Red,
+    WuAxis_Green,
+    WuAxis_Blue,
+};
+
+struct wu_moments
+{
+    s64 *Weight;
+    s64 *Red;
+    s64 *Green;
+    s64 *Blue;
+    f64 *SquaredLength;
+};
+
+// NOTE: R0/G0/B0 are exclusive, R1/G1/B1 inclusive
+struct wu_box
+{
+    int R0;
+    int R1;
+    int G0;
+    int G1;
+    int B0;
+    int B1;
+};
+
+inline int
+GetWuCell(u32 Texel)
+{
+    int R = (int)((Texel >> 0) & 0xFF);
+    int G = (int)((Texel >> 8) & 0xFF);
+    int B = (int)((Texel >> 16) & 0xFF);
+    int Result = WuIndex((R >> 3) + 1, (G >> 3) + 1, (B >> 3) + 1);
+
+    return(Result);
+}
+
+static void
+BuildWuMoments(wu_moments *Moments, bitmap Bitmap)
+{
+    for(int Index = 0;
+        Index < WU_CELL_COUNT;
+        Index++)
+    {
+        Moments->Weight[Index] = 0;
+        Moments->Red[Index] = 0;
+        Moments->Green[Index] = 0;
+        Moments->Blue[Index] = 0;
+        Moments->SquaredLength[Index] = 0.0;
+    }
+
+    for(int Y = 0;
+        Y < Bitmap.Height;
+        Y++)
+    {
+        u32 *Texels = (u32 *)GetBitmapPtr(Bitmap, 0, Y);
+        for(int X = 0;
+            X < Bitmap.Width;
+            X++)
+        {
+            u32 Texel = Texels[X];
+            int R = (int)((Texel >> 0) & 0xFF);
+            int G = (int)((Texel >> 8) & 0xFF);
+            int B = (int)((Texel >> 16) & 0xFF);
+
+            int Cell = GetWuCell(Texel);
+            Moments->Weight[Cell]++;
+            Moments->Red[Cell] += R;
+            Moments->Green[Cell] += G;
+            Moments->Blue[Cell] += B;
+            Moments->SquaredLength[Cell] += (f64)(R*R + G*G + B*B);
+        }
+    }
+
+    // NOTE: Turns the histogram into cumulative moments, one axis at a time
+    for(int R = 1;
+        R < WU_SIDE;
+        R++)
+    {
+        for(int G = 1;
+            G < WU_SIDE;
+            G++)
+        {
+            for(int B = 1;
+                B < WU_SIDE;
+                B++)
+            {
+                int Index = WuIndex(R, G, B);
+                int Previous = WuIndex(R, G, B - 1);
+                Moments->Weight[Index] += Moments->Weight[Previous];
+                Moments->Red[Index] += Moments->Red[Previous];
+                Moments->Green[Index] += Moments->Green[Previous];
+                Moments->Blue[Index] += Moments->Blue[Previous];
+                Moments->SquaredLength[Index] += Moments->SquaredLength[Previous];
+            }
+        }
+    }
+    for(int R = 1;
+        R < WU_SIDE;
+        R++)
+    {
+        for(int G = 1;
+            G < WU_SIDE;
+            G++)
+        {
+            for(int B = 1;
+                B < WU_SIDE;
+                B++)
+            {
+                int Index = WuIndex(R, G, B);
+                int Previous = WuIndex(R, G - 1, B);
+                Moments->Weight[Index] += Moments->Weight[Previous];
+                Moments->Red[Index] += Moments->Red[Previous];
+                Moments->Green[Index] += Moments->Green[Previous];
+                Moments->Blue[Index] += Moments->Blue[Previous];
+                Moments->SquaredLength[Index] += Moments->SquaredLength[Previous];
+            }
+        }
+    }
+    for(int R = 1;
+        R < WU_SIDE;
+        R++)
+    {
+        for(int G = 1;
+            G < WU_SIDE;
+            G++)
+        {
+            for(int B = 1;
+                B < WU_SIDE;
+                B++)
+            {
+                int Index = WuIndex(R, G, B);
+                int Previous = WuIndex(R - 1, G, B);
+                Moments->Weight[Index] += Moments->Weight[Previous];
+                Moments->Red[Index] += Moments->Red[Previous];
+                Moments->Green[Index] += Moments->Green[Previous];
+                Moments->Blue[Index] += Moments->Blue[Previous];
+                Moments->SquaredLength[Index] += Moments->SquaredLength[Previous];
+            }
+        }
+    }
+}
+
+// NOTE: Sum of a cumulative moment over the box
+template<typename type> inline type
+Volume(wu_box *Box, type *Moment)
+{
+    type Result = (Moment[WuIndex(Box->R1, Box->G1, Box->B1)] -
+                   Moment[WuIndex(Box->R1, Box->G1, Box->B0)] -
+                   Moment[WuIndex(Box->R1, Box->G0, Box->B1)] +
+                   Moment[WuIndex(Box->R1, Box->G0, Box->B0)] -
+                   Moment[WuIndex(Box->R0, Box->G1, Box->B1)] +
+                   Moment[WuIndex(Box->R0, Box->G1, Box->B0)] +
+                   Moment[WuIndex(Box->R0, Box->G0, Box->B1)] -
+                   Moment[WuIndex(Box->R0, Box->G0, Box->B0)]);
+
+    return(Result);
+}
+
+// NOTE: The part of Volume that doesn't depend on the box's upper bound
+// along Axis, so a sweep of cut positions only has to add Top
+static s64
+Bottom(wu_box *Box, wu_axis Axis, s64 *Moment)
+{
+    s64 Result = 0;
+    switch(Axis)
+    {
+        case WuAxis_Red:
+        {
+            Result = (-Moment[WuIndex(Box->R0, Box->G1, Box->B1)] +
+                      Moment[WuIndex(Box->R0, Box->G1, Box->B0)] +
+                      Moment[WuIndex(Box->R0, Box->G0, Box->B1)] -
+                      Moment[WuIndex(Box->R0, Box->G0, Box->B0)]);
+        } break;
+
+        case WuAxis_Green:
+        {
+            Result = (-Moment[WuIndex(Box->R1, Box->G0, Box->B1)] +
+                      Moment[WuIndex(Box->R1, Box->G0, Box->B0)] +
+                      Moment[WuIndex(Box->R0, Box->G0, Box->B1)] -
+                      Moment[WuIndex(Box->R0, Box->G0, Box->B0)]);
+        } break;
+
+        case WuAxis_Blue:
+        {
+            Result = (-Moment[WuIndex(Box->R1, Box->G1, Box->B0)] +
+                      Moment[WuIndex(Box->R1, Box->G0, Box->B0)] +
+                      Moment[WuIndex(Box->R0, Box->G1, Box->B0)] -
+                      Moment[WuIndex(Box->R0, Box->G0, Box->B0)]);
+        } break;
+    }
+
+    return(Result);
+}
+
+// NOTE: The rest of Volume with the box's upper bound along Axis at Position
+static s64
+Top(wu_box *Box, wu_axis Axis, int Position, s64 *Moment)
+{
+    s64 Result = 0;
+    switch(Axis)
+    {
+        case WuAxis_Red:
+        {
+            Result = (Moment[WuIndex(Position, Box->G1, Box->B1)] -
+                      Moment[WuIndex(Position, Box->G1, Box->B0)] -
+                      Moment[WuIndex(Position, Box->G0, Box->B1)] +
+                      Moment[WuIndex(Position, Box->G0, Box->B0)]);
+        } break;
+
+        case WuAxis_Green:
+        {
+            Result = (Moment[WuIndex(Box->R1, Position, Box->B1)] -
+                      Moment[WuIndex(Box->R1, Position, Box->B0)] -
+                      Moment[WuIndex(Box->R0, Position, Box->B1)] +
+                      Moment[WuIndex(Box->R0, Position, Box->B0)]);
+        } break;
+
+        case WuAxis_Blue:
+        {
+            Result = (Moment[WuIndex(Box->R1, Box->G1, Position)] -
+                      Moment[WuIndex(Box->R1, Box->G0, Position)] -
+                      Moment[WuIndex(Box->R0, Box->G1, Position)] +
+                      Moment[WuIndex(Box->R0, Box->G0, Position)]);
+        } break;
+    }
+
+    return(Result);
+}
+
+// NOTE: Weighted variance of the box, i.e. its squared error
+static f64
+Variance(wu_box *Box, wu_moments *Moments)
+{
+    f64 R = (f64)Volume(Box, Moments->Red);
+    f64 G = (f64)Volume(Box, Moments->Green);
+    f64 B = (f64)Volume(Box, Moments->Blue);
+    f64 Weight = (f64)Volume(Box, Moments->Weight);
+    f64 Result = Volume(Box, Moments->SquaredLength) - ((R*R + G*G + B*B) / Weight);
+
+    return(Result);
+}
+
+// NOTE: Finds the cut along Axis in (First, Last) that leaves the two halves
+// with the most between-half variance (which is the same as removing the
+// most squared error). Cut is -1 if every candidate leaves a half empty.
+static f64
+MaximizeWuCut(wu_box *Box, wu_axis Axis, int First, int Last, int *Cut, wu_moments *Moments,
+              s64 WholeR, s64 WholeG, s64 WholeB, s64 WholeWeight)
+{
+    s64 BaseR = Bottom(Box, Axis, Moments->Red);
+    s64 BaseG = Bottom(Box, Axis, Moments->Green);
+    s64 BaseB = Bottom(Box, Axis, Moments->Blue);
+    s64 BaseWeight = Bottom(Box, Axis, Moments->Weight);
+
+    f64 Result = 0.0;
+    *Cut = -1;
+    for(int Position = First;
+        Position < Last;
+        Position++)
+    {
+        s64 HalfR = BaseR + Top(Box, Axis, Position, Moments->Red);
+        s64 HalfG = BaseG + Top(Box, Axis, Position, Moments->Green);
+        s64 HalfB = BaseB + Top(Box, Axis, Position, Moments->Blue);
+        s64 HalfWeight = BaseWeight + Top(Box, Axis, Position, Moments->Weight);
+        if((HalfWeight == 0) || (HalfWeight == WholeWeight))
+        {
+            continue;
+        }
+
+        f64 Temp = ((f64)HalfR*HalfR + (f64)HalfG*HalfG + (f64)HalfB*HalfB) / (f64)HalfWeight;
+        HalfR = WholeR - HalfR;
+        HalfG = WholeG - HalfG;
+        HalfB = WholeB - HalfB;
+        HalfWeight = WholeWeight - HalfWeight;
+        Temp += ((f64)HalfR*HalfR + (f64)HalfG*HalfG + (f64)HalfB*HalfB) / (f64)HalfWeight;
+
+        if(Temp > Result)
+        {
+            Result = Temp;
+            *Cut = Position;
+        }
+    }
+
+    return(Result);
+}
+
+// NOTE: Cuts Box in two, leaving one half in Box and the other in Split.
+// Returns false if it can't be cut.
+static b32
+CutWuBox(wu_box *Box, wu_box *Split, wu_moments *Moments)
+{
+    b32 Result = false;
+
+    s64 WholeR = Volume(Box, Moments->Red);
+    s64 WholeG = Volume(Box, Moments->Green);
+    s64 WholeB = Volume(Box, Moments->Blue);
+    s64 WholeWeight = Volume(Box, Moments->Weight);
+
+    int CutR;
+    int CutG;
+    int CutB;
+    f64 MaxR = MaximizeWuCut(Box, WuAxis_Red, Box->R0 + 1, Box->R1, &CutR, Moments,
+                             WholeR, WholeG, WholeB, WholeWeight);
+    f64 MaxG = MaximizeWuCut(Box, WuAxis_Green, Box->G0 + 1, Box->G1, &CutG, Moments,
+                             WholeR, WholeG, WholeB, WholeWeight);
+    f64 MaxB = MaximizeWuCut(Box, WuAxis_Blue, Box->B0 + 1, Box->B1, &CutB, Moments,
+                             WholeR, WholeG, WholeB, WholeWeight);
+
+    *Split = *Box;
+    if((MaxR >= MaxG) && (MaxR >= MaxB))
+    {
+        if(CutR >= 0)
+        {
+            Split->R0 = Box->R1 = CutR;
+            Result = true;
+        }
+    }
+    else if((MaxG >= MaxR) && (MaxG >= MaxB))
+    {
+        Split->G0 = Box->G1 = CutG;
+        Result = true;
+    }
+    else
+    {
+        Split->B0 = Box->B1 = CutB;
+        Result = true;
+    }
+
+    return(Result);
+}
+
+static void
+TagWuBox(wu_box *Box, u32 Label, u32 *Tags)
+{
+    for(int R = Box->R0 + 1;
+        R <= Box->R1;
+        R++)
+    {
+        for(int G = Box->G0 + 1;
+            G <= Box->G1;
+            G++)
+        {
+            for(int B = Box->B0 + 1;
+                B <= Box->B1;
+                B++)
+            {
+                Tags[WuIndex(R, G, B)] = Label;
+            }
+        }
+    }
+}
+
+// NOTE: Observations have to be Bitmap's texels converted in order, and
+// ClusterIndices needs room for one index per observation. Returns the
+// number of clusters, which is lower than Context->ClusterCount if the
+// image has fewer distinct (5-bit) colors, or 0 if it couldn't allocate its
+// tables.
+static int
+RunWuQuantizer(kmeans_context *Context, bitmap Bitmap, observation_buffer *Observations,
+               int RefinementPassCount, u32 *ClusterIndices)
+{
+    int Result = 0;
+
+    wu_moments Moments;
+    Moments.Weight = (s64 *)malloc(sizeof(s64)*WU_CELL_COUNT);
+    Moments.Red = (s64 *)malloc(sizeof(s64)*WU_CELL_COUNT);
+    Moments.Green = (s64 *)malloc(sizeof(s64)*WU_CELL_COUNT);
+    Moments.Blue = (s64 *)malloc(sizeof(s64)*WU_CELL_COUNT);
+    Moments.SquaredLength = (f64 *)malloc(sizeof(f64)*WU_CELL_COUNT);
+    wu_box *Boxes = (wu_box *)malloc(sizeof(wu_box)*Context->ClusterCount);
+    f64 *Variances = (f64 *)malloc(sizeof(f64)*Context->ClusterCount);
+    u32 *Tags = (u32 *)malloc(sizeof(u32)*WU_CELL_COUNT);
+    if(Moments.Weight && Moments.Red && Moments.Green && Moments.Blue &&
+       Moments.SquaredLength && Boxes && Variances && Tags)
+    {
+        BuildWuMoments(&Moments, Bitmap);
+
+        Boxes[0].R0 = Boxes[0].G0 = Boxes[0].B0 = 0;
+        Boxes[0].R1 = Boxes[0].G1 = Boxes[0].B1 = WU_SIDE - 1;
+        Variances[0] = Variance(Boxes, &Moments);
+
+        int BoxCount = 1;
+        int Next = 0;
+        while(BoxCount < Context->ClusterCount)
+        {
+            wu_box *Box = Boxes + Next;
+            wu_box *Split = Boxes + BoxCount;
+            if(CutWuBox(Box, Split, &Moments))
+            {
+                Variances[Next] = Variance(Box, &Moments);
+                Variances[BoxCount] = Variance(Split, &Moments);
+                BoxCount++;
+            }
+            else
+            {
+                // NOTE: Never picked again
+                Variances[Next] = 0.0;
+            }
+
+            Next = 0;
+            for(int BoxIndex = 1;
+                BoxIndex < BoxCount;
+                BoxIndex++)
+            {
+                if(Variances[BoxIndex] > Variances[Next])
+                {
+                    Next = BoxIndex;
+                }
+            }
+
+            if(Variances[Next] <= 0.0)
+            {
+                break;
+            }
+        }
+
+        for(int BoxIndex = 0;
+            BoxIndex < BoxCount;
+            BoxIndex++)
+        {
+            TagWuBox(Boxes + BoxIndex, (u32)BoxIndex, Tags);
+            ClearObservations(Context->Clusters + BoxIndex);
+        }
+        Context->ClusterCount = BoxCount;
+
+        for(int Y = 0;
+            Y < Bitmap.Height;
+            Y++)
+        {
+            u32 *Texels = (u32 *)GetBitmapPtr(Bitmap, 0, Y);
+            for(int X = 0;
+                X < Bitmap.Width;
+                X++)
+            {
+                int Index = Y*Bitmap.Width + X;
+                u32 ClusterIndex = Tags[GetWuCell(Texels[X])];
+                cluster *Cluster = Context->Clusters + ClusterIndex;
+                Cluster->ObservationSum += GetObservation(Observations, Index);
+                Cluster->ObservationCount++;
+                ClusterIndices[Index] = ClusterIndex;
+            }
+        }
+
+        // NOTE: Every pass recenters the clusters on their members and then
+        // reassigns, except the last which only recenters, so the weights
+        // belong to the same members the centroids were computed from
+        for(int Pass = 0;
+            Pass <= RefinementPassCount;
+            Pass++)
+        {
+            for(int ClusterIndex = 0;
+                ClusterIndex < Context->ClusterCount;
+                ClusterIndex++)
+            {
+                cluster *Cluster = Context->Clusters + ClusterIndex;
+                if(Cluster->ObservationCount)
+                {
+                    Cluster->Centroid = Cluster->ObservationSum*(1.0f / (f32)Cluster->ObservationCount);
+                }
+            }
+
+            if(Pass < RefinementPassCount)
+            {
+                for(int ClusterIndex = 0;
+                    ClusterIndex < Context->ClusterCount;
+                    ClusterIndex++)
+                {
+                    ClearObservations(Context->Clusters + ClusterIndex);
+                }
+                Kernels.AssignObservations(Context, Observations, 0, Observations->Count,
+                                           ClusterIndices, false);
+            }
+        }
+
+        Result = BoxCount;
+    }
+
+    free(Moments.Weight);
+    free(Moments.Red);
+    free(Moments.Green);
+    free(Moments.Blue);
+    free(Moments.SquaredLength);
+    free(Boxes);
+    free(Variances);
+    free(Tags);
+
+    return(Result);
+}